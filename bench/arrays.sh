@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Allocates short-lived arrays (and the strings in them) in a loop for
+# growing N and prints the cost per loop iteration, which should stay flat,
+# then the heap report of the largest run: the heap should stay a few
+# chunks however many arrays came and went.
+#
+#   bench/arrays.sh <path/to/rvt> [rvt run options...]
+set -euo pipefail
+
+rvt=${1:?usage: bench/arrays.sh <path/to/rvt> [options...]}
+shift
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%10s %12s %12s\n' iterations total_ms ns_per_iter
+for n in 10000 100000 1000000; do
+  cat > "$tmp/arrays.rvt" <<RVT
+var kept = 0;
+var i = 0;
+while (i < $n) {
+  let row = [i, i + 1, "r" + i];
+  let pair = [row, [i]];
+  kept = kept + len(pair) + len(row);
+  i = i + 1;
+}
+print kept;
+RVT
+  start=$(date +%s%N)
+  "$rvt" run "$@" "$tmp/arrays.rvt" > /dev/null
+  end=$(date +%s%N)
+  ns=$((end - start))
+  printf '%10d %12d %12d\n' "$n" $((ns / 1000000)) $((ns / n))
+done
+"$rvt" run --gc-stats "$@" "$tmp/arrays.rvt" > /dev/null
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Times `s = s + row` for growing N and prints the cost per append, which
+# should stay flat if concatenation is amortized O(1).
+#
+#   bench/concat.sh <path/to/rvt> [rvt run options...]
+set -euo pipefail
+
+rvt=${1:?usage: bench/concat.sh <path/to/rvt> [options...]}
+shift
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '%10s %12s %14s\n' appends total_ms ns_per_append
+for n in 1000 10000 100000 1000000; do
+  cat > "$tmp/concat.rvt" <<RVT
+var s = "";
+var i = 0;
+while (i < $n) { s = s + "row "; i = i + 1; }
+print s == "";
+RVT
+  start=$(date +%s%N)
+  "$rvt" run "$@" "$tmp/concat.rvt" > /dev/null
+  end=$(date +%s%N)
+  ns=$((end - start))
+  printf '%10d %12d %14d\n' "$n" $((ns / 1000000)) $((ns / n))
+done
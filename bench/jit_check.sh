@@ -0,0 +1,113 @@
+#!/usr/bin/env bash
+# Checks that --jit never changes what a program does. Each case runs on the
+# tree walker with and without --jit; stdout, stderr and the exit status
+# must match. --jit-dump must also show that the functions a case is about
+# were compiled (and, where the case says so, deopted), so that no case
+# passes just because nothing was compiled. The programs in bench/corpus
+# and any files given are compared too. Exits 1 on any difference.
+#
+#   bench/jit_check.sh <path/to/rvt> [file.rvt ...]
+set -euo pipefail
+
+rvt=${1:?usage: bench/jit_check.sh <path/to/rvt> [file.rvt ...]}
+shift
+here=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+run() { "$rvt" run "$@" 2>&1 && echo "exit=0" || echo "exit=$?"; }
+
+# compare <file>: the same output and exit status with and without --jit.
+compare() {
+  local plain jit
+  plain=$(run "$1")
+  jit=$(run --jit "$1")
+  if [ "$plain" != "$jit" ]; then
+    echo "FAIL $(basename "$1"): output differs with --jit"
+    diff <(echo "$plain") <(echo "$jit") | head -10 || true
+    fail=1
+  fi
+}
+
+# check <name> <expectations> <program>; expectations are words: a function
+# name that must be compiled, or "deopt" for at least one deopt.
+check() {
+  local file="$tmp/$1.rvt" dump
+  printf '%s\n' "$3" > "$file"
+  compare "$file"
+  dump=$("$rvt" run --jit-dump "$file" 2>&1 >/dev/null || true)
+  for want in $2; do
+    if [ "$want" = deopt ]; then
+      echo "$dump" | grep -Eq ' [1-9][0-9]* deopts?$' || { echo "FAIL $1: no deopt"; fail=1; }
+    else
+      echo "$dump" | grep -q "^jit: fn $want(" || { echo "FAIL $1: $want was not compiled"; fail=1; }
+    fi
+  done
+}
+
+# NaN is unordered: every comparison but != is false.
+check nan-compare "cmp" '
+fn cmp(a, b) {
+  var n = 0;
+  if (a < b) n = n + 1;
+  if (a <= b) n = n + 2;
+  if (a > b) n = n + 4;
+  if (a >= b) n = n + 8;
+  if (a == b) n = n + 16;
+  if (a != b) n = n + 32;
+  return n;
+}
+let nan = sqrt(-1);
+for (var i = 0; i < 15; i = i + 1) print cmp(i, 7);
+print cmp(nan, 1);
+print cmp(1, nan);
+print cmp(nan, nan);
+print cmp(-0, 0);'
+
+# Functions that return conditions print true/false, not 1/0.
+check predicates "even between" '
+fn even(n) { return floor(n / 2) * 2 == n; }
+fn between(x, lo, hi) { return x >= lo && x <= hi; }
+for (var i = 0; i < 15; i = i + 1) print even(i);
+for (var i = 0; i < 15; i = i + 1) print between(i, 3, 9) || !even(i);
+print even(sqrt(-1));'
+
+# A string argument fails the compiled guard; the interpreter reruns the call.
+check deopt-string "twice deopt" '
+fn twice(x) { return x + x; }
+for (var i = 0; i < 15; i = i + 1) print twice(i);
+print twice("ab");
+print twice(2.5);'
+
+# Division by zero makes the compiled code give up, and the rerun reports
+# the error exactly as the interpreter does.
+check deopt-division "ratio" '
+fn ratio(a, b) { return a / b; }
+for (var i = 1; i < 15; i = i + 1) print ratio(10, i);
+print ratio(1, 0);
+print "not reached";'
+
+# Self tail calls become jumps: deep enough to overflow the stack otherwise.
+check tail-recursion "count gcd" '
+fn count(n, acc) { if (n == 0) return acc; return count(n - 1, acc + 1); }
+fn gcd(a, b) { if (b == 0) return a; return gcd(b, a - floor(a / b) * b); }
+for (var i = 0; i < 15; i = i + 1) print gcd(i * 12, 18) + count(i, 0);
+print count(200000, 0);
+print count(12, 0.5);'
+
+# Callers of memoized functions: tri calls nothing, so compiled code may skip
+# its cache; fib recurses, so fib_user stays interpreted and keeps using it.
+check memoized-callee "user tri" '
+fn tri(n) { var s = 0; var i = 0; while (i < n) { s = s + i; i = i + 1; } return s; }
+fn fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+fn user(n) { return tri(n) * 2 + 1; }
+fn fib_user(n) { return fib(n) - 1; }
+for (var i = 0; i < 15; i = i + 1) print user(i);
+for (var i = 0; i < 15; i = i + 1) print fib_user(i + 20);
+print fib_user(60);'
+
+for f in "$here"/corpus/*.rvt "$@"; do compare "$f"; done
+
+[ $fail = 0 ] && echo "jit: all cases match the tree walker"
+exit $fail
@@ -0,0 +1,75 @@
+// Lexer throughput for each scan kernel this CPU supports.
+//
+//   rvt_lexer_bench [file.rvt]
+//
+// Without a file, lexes a generated ~64 MB script mixing indentation,
+// comments, identifiers, numbers and strings.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "lexer.hpp"
+#include "scan.hpp"
+
+using namespace rivet;
+
+static std::string generated_source(size_t target_bytes) {
+  const char* chunk =
+    "// running totals for the report\n"
+    "fn accumulate(values, scale) {\n"
+    "    var total_amount = 0;\n"
+    "    for value in values {\n"
+    "        /* skip negative rows, they were refunded */\n"
+    "        if (value >= 0 && scale != 0) { total_amount = total_amount + value * scale / 100.25; }\n"
+    "    }\n"
+    "    print \"accumulated: \" + total_amount;\n"
+    "    return total_amount;\n"
+    "}\n"
+    "let quarterly_results = [1200, 3400.5, 560, 78000, 91];\n"
+    "\n";
+  std::string s;
+  s.reserve(target_bytes + 512);
+  while (s.size() < target_bytes) s += chunk;
+  return s;
+}
+
+static size_t lex_all(std::string_view src, const ScanKernels& k) {
+  Lexer lex(src, "<bench>", k);
+  size_t n = 0;
+  for (Token t = lex.next(); t.kind != TokenKind::End; t = lex.next()) {
+    if (t.kind == TokenKind::Error) { std::fprintf(stderr, "lex error: %s\n", lex.error().c_str()); break; }
+    ++n;
+  }
+  return n;
+}
+
+int main(int argc, char** argv) {
+  std::string src;
+  if (argc > 1) {
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) { std::fprintf(stderr, "cannot open %s\n", argv[1]); return 1; }
+    std::ostringstream ss; ss << in.rdbuf(); src = ss.str();
+  } else {
+    src = generated_source(64u << 20);
+  }
+  const double mb = static_cast<double>(src.size()) / (1024.0 * 1024.0);
+  std::printf("source: %.1f MB, default kernels: %s\n", mb, scan_kernels().name);
+  std::printf("%-8s %12s %10s\n", "kernels", "tokens", "MB/s");
+
+  for (ScanLevel level : {ScanLevel::Scalar, ScanLevel::SSE2, ScanLevel::AVX2}) {
+    const ScanKernels* k = scan_kernels(level);
+    if (!k) continue;
+    double best = 1e300;
+    size_t tokens = 0;
+    for (int rep = 0; rep < 3; ++rep) {
+      auto t0 = std::chrono::steady_clock::now();
+      tokens = lex_all(src, *k);
+      std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+      best = std::min(best, dt.count());
+    }
+    std::printf("%-8s %12zu %10.1f\n", k->name, tokens, mb / best);
+  }
+  return 0;
+}
@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+# Checks that the result cache of pure functions never changes what a
+# program prints: each case runs on the tree walker, the VM and with --jit,
+# and must print exactly what it would without caching. Exits 1 on any
+# difference.
+#
+#   bench/memo_check.sh <path/to/rvt>
+set -euo pipefail
+
+rvt=${1:?usage: bench/memo_check.sh <path/to/rvt>}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+# check <name> <expected output> <program>
+check() {
+  printf '%s\n' "$3" > "$tmp/$1.rvt"
+  for opts in "--engine=tree" "--engine=vm" "--jit"; do
+    if ! out=$("$rvt" run $opts "$tmp/$1.rvt" 2>&1) || [ "$out" != "$2" ]; then
+      echo "FAIL $1 ($opts)"
+      diff <(printf '%s\n' "$2") <(printf '%s\n' "$out") || true
+      fail=1
+    fi
+  done
+}
+
+# The loop makes f worth caching; 0 and -0 are equal but print differently.
+check negative-zero $'0\n-0\n0\n-0' '
+fn f(x) { var i = 0; while (i < 1) { i = i + 1; } return x * 2; }
+print f(0);
+print f(-0);
+print f(0);
+print f(-0);'
+
+check negative-zero-in-array $'[0]\n[-0]' '
+fn g(a) { var i = 0; while (i < 1) { i = i + 1; } return a; }
+print g([0]);
+print g([-0]);'
+
+check nan $'nan\nnan\n4' '
+fn h(x) { var i = 0; while (i < 1) { i = i + 1; } return x + 1; }
+print h(sqrt(-1));
+print h(sqrt(-1));
+print h(3);'
+
+check strings $'ab!\nab!\nb!' '
+fn s(x) { var i = 0; while (i < 1) { i = i + 1; } return x + "!"; }
+print s("ab");
+print s("a" + "b");
+print s("b");'
+
+check fib $'832040\n832040' '
+fn fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+print fib(30);
+print fib(30);'
+
+[ $fail = 0 ] && echo "memo: all cases print the same with and without caching"
+exit $fail
@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+# Checks reduce and parallel_reduce around the 4096-element chunk boundary
+# with folds whose accumulator is not of the element type, so the result
+# only comes out right if no element ever starts an accumulator. Each case
+# runs on the tree walker, the VM and with --jit. Exits 1 on any difference.
+#
+#   bench/reduce_check.sh <path/to/rvt>
+set -euo pipefail
+
+rvt=${1:?usage: bench/reduce_check.sh <path/to/rvt>}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+# check <name> <expected output> <program>
+check() {
+  printf '%s\n' "$3" > "$tmp/$1.rvt"
+  for opts in "--engine=tree" "--engine=vm" "--jit"; do
+    if ! out=$("$rvt" run $opts "$tmp/$1.rvt" 2>&1) || [ "$out" != "$2" ]; then
+      echo "FAIL $1 ($opts)"
+      diff <(printf '%s\n' "$2") <(printf '%s\n' "$out") || true
+      fail=1
+    fi
+  done
+}
+
+# Sizes on both sides of one and two chunks.
+sizes='[0, 1, 4095, 4096, 4097, 5000, 8192, 8193, 20000]'
+
+check count $'0\n1\n4095\n4096\n4097\n5000\n8192\n8193\n20000' "
+fn count(acc, x) { return acc + 1; }
+for n in $sizes {
+  var a = [];
+  for (var i = 0; i < n; i = i + 1) push(a, i * 3);
+  print reduce(a, count, 0);
+}"
+
+check string-lengths $'10000\n10003' '
+fn addlen(acc, s) { return acc + len(s); }
+var a = [];
+for (var i = 0; i < 5000; i = i + 1) push(a, "ab");
+print reduce(a, addlen, 0);
+print reduce(a, addlen, 3);'
+
+# Neither associative nor commutative: only a left fold gives these.
+check order $'789\n19999' '
+fn digits(acc, x) { let d = acc * 10 + x; return d - floor(d / 1000) * 1000; }
+fn last(acc, x) { return x; }
+var a = [];
+for (var i = 0; i < 20000; i = i + 1) push(a, i - floor(i / 10) * 10);
+print reduce(a, digits, 0);
+print reduce(a, last, -1) + 19990;'
+
+# reduce runs f on the calling thread, so f may update outside variables.
+check calling-thread $'5000\n5000' '
+var calls = 0;
+fn tally(acc, x) { calls = calls + 1; return acc + 1; }
+var a = [];
+for (var i = 1; i <= 5000; i = i + 1) push(a, i);
+print reduce(a, tally, 0);
+print calls;'
+
+# parallel_reduce starts every chunk from init and merges with combine.
+check parallel $'0\n4095\n4096\n4097\n5000\n8193\n20000\n10000\n7' "
+fn count(acc, x) { return acc + 1; }
+fn add(x, y) { return x + y; }
+fn addlen(acc, s) { return acc + len(s); }
+for n in [0, 4095, 4096, 4097, 5000, 8193, 20000] {
+  var a = [];
+  for (var i = 0; i < n; i = i + 1) push(a, \"x\");
+  print parallel_reduce(a, count, 0, add);
+}
+var s = [];
+for (var i = 0; i < 5000; i = i + 1) push(s, \"ab\");
+print parallel_reduce(s, addlen, 0, add);
+print parallel_reduce([], addlen, 7, add);"
+
+[ $fail = 0 ] && echo "reduce: all cases fold left to right"
+exit $fail
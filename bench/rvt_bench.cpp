@@ -0,0 +1,296 @@
+// Times the three stages of running a script, separately, over the bench
+// corpus: lexing (Lexer::next to the end), parsing (Parser::parse_program,
+// which lexes as it goes) and evaluating (exec_program on the tree walker,
+// in a fresh Env each run).
+//
+//   rvt_bench [options] [file.rvt ...]
+//
+// Without files it runs every bench/corpus/*.rvt plus a generated program of
+// a few MB. Each stage runs --warmup times untimed, then --reps times; a
+// stage that takes under a millisecond is timed in batches that take at
+// least that long, and a batch counts as one run of its average time. The
+// table shows the median, 99th percentile and fastest run. --json writes
+// the results for a later --baseline run to compare medians against.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "eval.hpp"
+#include "lexer.hpp"
+#include "memo.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+
+using namespace rivet;
+
+namespace {
+
+struct Options {
+  unsigned warmup = 2;
+  unsigned reps = 10;
+  bool stages[3] = {true, true, true};       // lex, parse, exec
+  std::string json;
+  std::string baseline;
+  double max_regression = -1;                // percent; < 0: never fail
+  std::vector<std::string> files;
+};
+
+constexpr const char* kStages[3] = {"lex", "parse", "exec"};
+
+struct Result {
+  std::string bench, stage;
+  size_t bytes {};
+  double median_ns {}, p99_ns {}, min_ns {}, mean_ns {};
+};
+
+struct Workload { std::string name, source; };
+
+constexpr double kMinSampleNs = 1e6;
+
+// About 4 MB of small functions, each declared, called once and printed: the
+// shape of a large machine-written script.
+std::string generated_source(size_t functions) {
+  std::string s;
+  for (size_t i = 0; i < functions; ++i) {
+    std::string n = std::to_string(i);
+    s += "// helper " + n + ": scales and sums its inputs, skipping refunds\n"
+         "fn helper_" + n + "(values, scale) {\n"
+         "  var total_" + n + " = 0;\n"
+         "  for value in values {\n"
+         "    /* negative rows were refunded */\n"
+         "    if (value >= 0 && scale != 0) { total_" + n + " = total_" + n + " + value * scale / 100.25; }\n"
+         "  }\n"
+         "  return total_" + n + ";\n"
+         "}\n"
+         "let result_" + n + " = helper_" + n + "([1200, 3400.5, -560, " + n + "], " + std::to_string(i % 7 + 1) + ");\n"
+         "print \"helper " + n + ": \" + result_" + n + ";\n\n";
+  }
+  return s;
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("cannot open " + path);
+  std::ostringstream ss; ss << in.rdbuf();
+  return ss.str();
+}
+
+std::vector<Workload> workloads(const Options& opts) {
+  std::vector<Workload> w;
+  auto add = [&](const std::string& path) {
+    w.push_back({std::filesystem::path(path).stem().string(), read_file(path)});
+  };
+  if (!opts.files.empty()) {
+    for (const auto& f : opts.files) add(f);
+    return w;
+  }
+  std::vector<std::string> corpus;
+  for (const auto& e : std::filesystem::directory_iterator(RIVET_BENCH_CORPUS))
+    if (e.path().extension() == ".rvt") corpus.push_back(e.path().string());
+  std::sort(corpus.begin(), corpus.end());
+  for (const auto& f : corpus) add(f);
+  w.push_back({"generated", generated_source(10000)});
+  return w;
+}
+
+// Where print goes while timing.
+struct NullBuf : std::streambuf {
+  int overflow(int c) override { return c; }
+};
+
+size_t lex_all(std::string_view src) {
+  Lexer lex(src, "<bench>");
+  size_t n = 0;
+  for (Token t = lex.next(); t.kind != TokenKind::End; t = lex.next()) {
+    if (t.kind == TokenKind::Error) throw std::runtime_error("lex error: " + lex.error());
+    ++n;
+  }
+  return n;
+}
+
+Result measure(const std::string& bench, const char* stage, size_t bytes, const Options& opts,
+               const std::function<void()>& run) {
+  auto timed = [&](size_t batch) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < batch; ++i) run();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count()
+           / static_cast<double>(batch);
+  };
+  double once = timed(1);
+  size_t batch = once >= kMinSampleNs ? 1 : static_cast<size_t>(std::ceil(kMinSampleNs / std::max(once, 1.0)));
+  for (unsigned i = 0; i < opts.warmup; ++i) (void)timed(batch);
+  std::vector<double> ns;
+  for (unsigned i = 0; i < opts.reps; ++i) ns.push_back(timed(batch));
+  std::sort(ns.begin(), ns.end());
+  Result r{bench, stage, bytes};
+  size_t n = ns.size();
+  r.median_ns = n % 2 ? ns[n / 2] : (ns[n / 2 - 1] + ns[n / 2]) / 2;
+  r.p99_ns = ns[static_cast<size_t>(std::ceil(0.99 * static_cast<double>(n))) - 1];   // nearest rank
+  r.min_ns = ns.front();
+  for (double t : ns) r.mean_ns += t / static_cast<double>(n);
+  return r;
+}
+
+std::vector<Result> run_workload(const Workload& w, const Options& opts) {
+  std::vector<Result> out;
+  size_t bytes = w.source.size();
+  if (opts.stages[0]) out.push_back(measure(w.name, "lex", bytes, opts, [&] { (void)lex_all(w.source); }));
+  if (opts.stages[1])
+    out.push_back(measure(w.name, "parse", bytes, opts, [&] { Parser p(w.source, w.name); (void)p.parse_program(); }));
+  if (opts.stages[2]) {
+    // Prepared as rvt run prepares it; only the run itself is timed. The
+    // tree keeps what the walker learned in earlier runs (quickened nodes),
+    // as a long-running script would.
+    Parser p(w.source, w.name);
+    Program prog = p.parse_program();
+    Resolver resolver;
+    resolver.resolve(prog);
+    mark_memoizable(prog);
+    NullBuf sink;
+    std::ostream null(&sink);
+    out.push_back(measure(w.name, "exec", bytes, opts, [&] {
+      Env env(prog);
+      env.ensure_main(resolver.main_frame_size());
+      env.out = &null;
+      (void)exec_program(prog, env);
+    }));
+  }
+  return out;
+}
+
+// "812 ns", "3.41 us", "12.7 ms", "1.20 s"
+std::string duration_text(double ns) {
+  char buf[32];
+  if (ns < 1e3) std::snprintf(buf, sizeof buf, "%.0f ns", ns);
+  else if (ns < 1e6) std::snprintf(buf, sizeof buf, "%.2f us", ns / 1e3);
+  else if (ns < 1e9) std::snprintf(buf, sizeof buf, "%.2f ms", ns / 1e6);
+  else std::snprintf(buf, sizeof buf, "%.2f s", ns / 1e9);
+  return buf;
+}
+
+void write_json(const std::vector<Result>& results, const Options& opts, std::ostream& out) {
+  out << "{\"tool\":\"rvt_bench\",\"warmup\":" << opts.warmup << ",\"reps\":" << opts.reps << ",\"results\":[\n";
+  out << std::fixed << std::setprecision(0);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    out << "{\"bench\":\"" << r.bench << "\",\"stage\":\"" << r.stage << "\",\"bytes\":" << r.bytes
+        << ",\"median_ns\":" << r.median_ns << ",\"p99_ns\":" << r.p99_ns << ",\"min_ns\":" << r.min_ns
+        << ",\"mean_ns\":" << r.mean_ns << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "]}\n";
+}
+
+// Reads back what write_json wrote: one result per line.
+std::vector<Result> read_baseline(const std::string& path) {
+  std::vector<Result> v;
+  std::istringstream in(read_file(path));
+  auto text = [](const std::string& line, const char* key) {
+    size_t at = line.find(std::string("\"") + key + "\":\"");
+    if (at == std::string::npos) return std::string();
+    at += std::char_traits<char>::length(key) + 4;
+    return line.substr(at, line.find('"', at) - at);
+  };
+  auto number = [](const std::string& line, const char* key) {
+    size_t at = line.find(std::string("\"") + key + "\":");
+    return at == std::string::npos ? 0.0 : std::strtod(line.c_str() + at + std::char_traits<char>::length(key) + 3, nullptr);
+  };
+  for (std::string line; std::getline(in, line);) {
+    if (line.find("\"bench\":") == std::string::npos) continue;
+    v.push_back({text(line, "bench"), text(line, "stage"), 0, number(line, "median_ns")});
+  }
+  if (v.empty()) throw std::runtime_error(path + ": no rvt_bench results");
+  return v;
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&](const char* flag) -> const char* {
+      size_t n = std::char_traits<char>::length(flag);
+      return arg.compare(0, n, flag) == 0 ? arg.c_str() + n : nullptr;
+    };
+    if (const char* v = value("--warmup=")) opts.warmup = static_cast<unsigned>(std::strtoul(v, nullptr, 10));
+    else if (const char* v = value("--reps=")) opts.reps = static_cast<unsigned>(std::strtoul(v, nullptr, 10));
+    else if (const char* v = value("--stages=")) {
+      std::string list = std::string(",") + v + ",";
+      for (size_t s = 0; s < 3; ++s) opts.stages[s] = list.find(std::string(",") + kStages[s] + ",") != std::string::npos;
+    }
+    else if (const char* v = value("--json=")) opts.json = v;
+    else if (const char* v = value("--baseline=")) opts.baseline = v;
+    else if (const char* v = value("--max-regression=")) opts.max_regression = std::strtod(v, nullptr);
+    else if (arg == "--emit-generated") { std::fputs(generated_source(10000).c_str(), stdout); std::exit(0); }
+    else if (arg.rfind("-", 0) == 0) return false;
+    else opts.files.push_back(arg);
+  }
+  return opts.reps > 0 && (opts.stages[0] || opts.stages[1] || opts.stages[2]);
+}
+
+}
+
+int main(int argc, char** argv) {
+  Options opts;
+  if (!parse_args(argc, argv, opts)) {
+    std::fprintf(stderr,
+      "usage: rvt_bench [options] [file.rvt ...]\n"
+      "  --warmup=N             untimed runs of each stage first (default 2)\n"
+      "  --reps=N               timed runs of each stage (default 10)\n"
+      "  --stages=lex,parse,exec  which stages to time (default all)\n"
+      "  --json=<file>          write the results as JSON\n"
+      "  --baseline=<file>      compare medians with an earlier --json file\n"
+      "  --max-regression=<pct> with --baseline, exit 1 if a median is more than pct%% slower\n"
+      "  --emit-generated       print the generated benchmark program and exit\n");
+    return 2;
+  }
+  try {
+    std::vector<Result> base;
+    if (!opts.baseline.empty()) base = read_baseline(opts.baseline);
+    auto find_base = [&](const Result& r) -> const Result* {
+      for (const Result& b : base) if (b.bench == r.bench && b.stage == r.stage) return &b;
+      return nullptr;
+    };
+
+    std::printf("warmup %u, reps %u\n", opts.warmup, opts.reps);
+    std::printf("%-12s %-6s %10s %12s %12s %12s %10s%s\n", "bench", "stage", "size", "median", "p99", "min", "MB/s",
+                base.empty() ? "" : "   vs base");
+    std::vector<Result> results;
+    bool regressed = false;
+    for (const Workload& w : workloads(opts)) {
+      for (const Result& r : run_workload(w, opts)) {
+        // Throughput of source text; it says nothing about running it.
+        char mbs[32] = "-";
+        if (r.stage != "exec")
+          std::snprintf(mbs, sizeof mbs, "%.1f", static_cast<double>(r.bytes) / (1024.0 * 1024.0) / (r.median_ns / 1e9));
+        std::printf("%-12s %-6s %8.1fKB %12s %12s %12s %10s", r.bench.c_str(), r.stage.c_str(),
+                    static_cast<double>(r.bytes) / 1024.0, duration_text(r.median_ns).c_str(),
+                    duration_text(r.p99_ns).c_str(), duration_text(r.min_ns).c_str(), mbs);
+        if (const Result* b = find_base(r); b && b->median_ns > 0) {
+          double change = (r.median_ns / b->median_ns - 1.0) * 100.0;
+          bool worse = opts.max_regression >= 0 && change > opts.max_regression;
+          regressed = regressed || worse;
+          std::printf("   %+7.1f%%%s", change, worse ? "  REGRESSION" : "");
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+        results.push_back(r);
+      }
+    }
+    if (!opts.json.empty()) {
+      std::ofstream out(opts.json);
+      if (!out) throw std::runtime_error("cannot write " + opts.json);
+      write_json(results, opts, out);
+      std::printf("results written to %s\n", opts.json.c_str());
+    }
+    return regressed ? 1 : 0;
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "rvt_bench: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,71 @@
+// Array kernel throughput for each level this CPU supports.
+//
+//   rvt_vec_bench [elements]
+//
+// Runs element-wise add, compare, sum and min over arrays of numbers
+// (default 10M elements) and checks every level against the scalar results.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "vec.hpp"
+
+using namespace rivet;
+
+template<class F> static double best_of(F&& f) {
+  double best = 1e300;
+  for (int rep = 0; rep < 5; ++rep) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    best = std::min(best, dt.count());
+  }
+  return best;
+}
+
+static bool same_bits(const std::vector<Value>& a, const std::vector<Value>& b) {
+  for (size_t i = 0; i < a.size(); ++i) if (a[i].raw() != b[i].raw()) return false;
+  return true;
+}
+static bool same_bits(double a, double b) { return std::memcmp(&a, &b, sizeof a) == 0 || (a != a && b != b); }
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  std::vector<Value> a, b;
+  a.reserve(n); b.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    a.emplace_back(std::sin(static_cast<double>(i)) * 1000.0);
+    b.emplace_back(static_cast<double>(i % 977) - 488.0);
+  }
+  std::vector<Value> out(n), ref_add(n), ref_lt(n);
+  const VecKernels& scalar = *vec_kernels(ScanLevel::Scalar);
+  scalar.binary[static_cast<size_t>(VecOp::Add)](a.data(), 1, b.data(), 1, ref_add.data(), n);
+  scalar.binary[static_cast<size_t>(VecOp::Lt)](a.data(), 1, b.data(), 1, ref_lt.data(), n);
+  const double ref_sum = scalar.sum(a.data(), n), ref_min = scalar.min(a.data(), n);
+
+  const double melem = static_cast<double>(n) / 1e6;
+  std::printf("elements: %zu (%.0f MB per array), default kernels: %s\n",
+              n, static_cast<double>(n * sizeof(Value)) / (1024.0 * 1024.0), vec_kernels().name);
+  std::printf("%-8s %12s %12s %12s %12s   (M elements/s)\n", "kernels", "add", "lt", "sum", "min");
+
+  int bad = 0;
+  for (ScanLevel level : {ScanLevel::Scalar, ScanLevel::SSE2, ScanLevel::AVX2}) {
+    const VecKernels* k = vec_kernels(level);
+    if (!k) continue;
+    double s = 0, m = 0;
+    double t_add = best_of([&] { k->binary[static_cast<size_t>(VecOp::Add)](a.data(), 1, b.data(), 1, out.data(), n); });
+    bool ok = same_bits(out, ref_add);
+    double t_lt = best_of([&] { k->binary[static_cast<size_t>(VecOp::Lt)](a.data(), 1, b.data(), 1, out.data(), n); });
+    ok = ok && same_bits(out, ref_lt);
+    double t_sum = best_of([&] { s = k->sum(a.data(), n); });
+    double t_min = best_of([&] { m = k->min(a.data(), n); });
+    ok = ok && same_bits(s, ref_sum) && same_bits(m, ref_min);
+    std::printf("%-8s %12.0f %12.0f %12.0f %12.0f   %s\n", k->name,
+                melem / t_add, melem / t_lt, melem / t_sum, melem / t_min, ok ? "" : "MISMATCH");
+    bad += !ok;
+  }
+  return bad ? 1 : 0;
+}
@@ -1,87 +1,161 @@
 #pragma once
-#include <memory>
-#include <string>
+#include <cstdint>
 #include <variant>
 #include <vector>
+#include "rivet/native.hpp"
+#include "rivet/symbol.hpp"
 #include "rivet/token.hpp"
+#include "rivet/value.hpp"
 
 namespace rivet {
 
-// ============== Expressions ==============
-struct Expr;
-using ExprPtr = std::unique_ptr<Expr>;
+// ============== Resolution ==============
+// Filled in by the resolver (src/resolver.hpp) before a program runs.
+//   Local   slot in the current function's frame
+//   Global  slot in the main program's frame, read from a function body
+//   Dynamic looked up by name through the active frames, innermost first
+enum class RefKind : uint8_t { Dynamic, Local, Global };
+struct VarRef { RefKind kind {RefKind::Dynamic}; uint32_t slot {}; };
+
+// ============== Node storage ==============
+// Nodes live contiguously in their Program and link to each other by 32-bit
+// index; a run of children (block statements, call arguments, array elements,
+// parameters) is a List into one of the Program's pools. Every node type is
+// trivially destructible, so dropping a Program frees a handful of buffers.
+enum class ExprId : uint32_t {};
+enum class StmtId : uint32_t {};
+inline constexpr ExprId kNoExpr {UINT32_MAX};
+inline constexpr StmtId kNoStmt {UINT32_MAX};
+
+template<class T> struct List { uint32_t begin {}, size {}; };
+
+template<class T> struct Span {
+  const T* first; uint32_t n;
+  const T* begin() const { return first; }
+  const T* end() const { return first + n; }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  const T& operator[](size_t i) const { return first[i]; }
+};
+
+// ============== Quickening ==============
+// The tree walker rewrites a Binary or Variable node in place the first time
+// it evaluates it, to a version specialized to the operand types or the
+// reference it saw (see src/eval.cpp). A specialized node checks that its
+// guess still holds; when it does not, the node falls back to the generic
+// version for good.
+enum class Quick : uint8_t {
+  Cold,                                     // not evaluated yet
+  Generic,                                  // nothing to specialize to
+  Deopt,                                    // was specialized; a guard failed
+  AddNumNum, SubNumNum, MulNumNum, DivNumNum,
+  EqNumNum, NeNumNum, LtNumNum, LeNumNum, GtNumNum, GeNumNum,
+  AddStrAny,                                // string + anything
+  LocalSlot, GlobalSlot,                    // Variable: read its slot directly
+};
 
+// ============== Expressions ==============
 struct NumberLit { double value; };
 struct BoolLit   { bool   value; };
-struct StringLit { std::string value; };
-struct ArrayLit  { std::vector<ExprPtr> elems; };
-struct Grouping  { ExprPtr inner; };
+struct StringLit { uint32_t id; };                 // index into Program::strings
+struct ArrayLit  { List<ExprId> elems; };
+struct Grouping  { ExprId inner; };
 
 enum class UnaryOp { Negate, Not };
-struct Unary { UnaryOp op; ExprPtr right; };
+struct Unary { UnaryOp op; ExprId right; };
 
 enum class BinaryOp { Add, Sub, Mul, Div, Eq, Ne, Lt, Le, Gt, Ge, LAnd, LOr };
-struct Binary { ExprPtr left; BinaryOp op; ExprPtr right; };
+struct Binary { ExprId left; BinaryOp op; ExprId right; mutable Quick quick {}; };
 
-struct Variable { std::string name; };
+struct Variable { Symbol name; VarRef ref {}; mutable Quick quick {}; };
 
+// `native` is set by the resolver when the callee is a native function (see
+// rivet/native.hpp) rather than one the program declares.
 struct Call {
-  std::string callee;
-  std::vector<ExprPtr> args;
+  Symbol callee;
+  List<ExprId> args;
+  uint32_t native {kNoNative};
 };
 
 struct Expr {
   std::variant<NumberLit, BoolLit, StringLit, ArrayLit, Grouping, Unary, Binary, Variable, Call> node;
-
-  static ExprPtr make_number(double v){ return std::make_unique<Expr>(Expr{NumberLit{v}}); }
-  static ExprPtr make_bool(bool v){ return std::make_unique<Expr>(Expr{BoolLit{v}}); }
-  static ExprPtr make_string(std::string v){ return std::make_unique<Expr>(Expr{StringLit{std::move(v)}}); }
-  static ExprPtr make_array(std::vector<ExprPtr> es){ return std::make_unique<Expr>(Expr{ArrayLit{std::move(es)}}); }
-  static ExprPtr make_grouping(ExprPtr e){ return std::make_unique<Expr>(Expr{Grouping{std::move(e)}}); }
-  static ExprPtr make_unary(UnaryOp op, ExprPtr r){ return std::make_unique<Expr>(Expr{Unary{op, std::move(r)}}); }
-  static ExprPtr make_binary(ExprPtr l, BinaryOp op, ExprPtr r){ return std::make_unique<Expr>(Expr{Binary{std::move(l), op, std::move(r)}}); }
-  static ExprPtr make_variable(std::string n){ return std::make_unique<Expr>(Expr{Variable{std::move(n)}}); }
-  static ExprPtr make_call(std::string n, std::vector<ExprPtr> as){ return std::make_unique<Expr>(Expr{Call{std::move(n), std::move(as)}}); }
 };
 
 // ============== Statements ==============
-struct Stmt;
-using StmtPtr = std::unique_ptr<Stmt>;
-
-struct Let     { std::string name; ExprPtr init; };
-struct Var     { std::string name; ExprPtr init; };
-struct Assign  { std::string name; ExprPtr value; };
-struct ExprStmt{ ExprPtr expr; };
-struct Block   { std::vector<StmtPtr> stmts; };
-struct If      { ExprPtr cond; StmtPtr then_br; StmtPtr else_br; };
-struct While   { ExprPtr cond; StmtPtr body; };
-struct Print   { ExprPtr expr; };
-struct FnDecl  { std::string name; std::vector<std::string> params; StmtPtr body; };
-struct Return  { ExprPtr value; };
-
-// for-in: for ident in expr { ... }
-struct ForIn   { std::string var; ExprPtr iterable; StmtPtr body; };
-
-// C-style for: for (init; cond; step) body
-struct ForC    { StmtPtr init; ExprPtr cond; StmtPtr step; StmtPtr body; };
+struct Let     { Symbol name; ExprId init; uint32_t slot {}; };
+struct Var     { Symbol name; ExprId init; uint32_t slot {}; };
+struct Assign  { Symbol name; ExprId value; VarRef ref {}; };
+struct ExprStmt{ ExprId expr; };
+// [slot_begin, slot_end) are the frame slots declared directly in this scope.
+struct Block   { List<StmtId> stmts; uint32_t slot_begin {}, slot_end {}; };
+struct If      { ExprId cond; StmtId then_br; StmtId else_br; };
+struct While   { ExprId cond; StmtId body; };
+struct Print   { ExprId expr; };
+// Parameters occupy slots [0, params.size) of a frame_size-slot frame.
+// `memo` (see src/memo.hpp) caches results by argument values.
+struct FnDecl  { Symbol name; List<Symbol> params; StmtId body; uint32_t frame_size {}; bool memo {}; };
+// `tail` (set by the resolver) marks `return f(...)` whose call may reuse the
+// returning function's frame.
+struct Return  { ExprId value; bool tail {}; };
+
+// for-in: [parallel] for ident in expr { ... }
+// The loop variable lives in `slot`; each iteration's scope is [slot, slot_end).
+// A parallel loop runs its iterations on worker threads (see eval.hpp).
+struct ForIn   { Symbol var; ExprId iterable; StmtId body; bool parallel {}; uint32_t slot {}, slot_end {}; };
+
+// C-style for: for (init; cond; step) body. Missing clauses are kNoStmt/kNoExpr.
+struct ForC    { StmtId init; ExprId cond; StmtId step; StmtId body; uint32_t slot_begin {}, slot_end {}; };
 
 struct Stmt {
   std::variant<Let, Var, Assign, ExprStmt, Block, If, While, Print, FnDecl, Return, ForIn, ForC> node;
-
-  static StmtPtr make_let(std::string n, ExprPtr e){ return std::make_unique<Stmt>(Stmt{Let{std::move(n), std::move(e)}}); }
-  static StmtPtr make_var(std::string n, ExprPtr e){ return std::make_unique<Stmt>(Stmt{Var{std::move(n), std::move(e)}}); }
-  static StmtPtr make_assign(std::string n, ExprPtr e){ return std::make_unique<Stmt>(Stmt{Assign{std::move(n), std::move(e)}}); }
-  static StmtPtr make_expr(ExprPtr e){ return std::make_unique<Stmt>(Stmt{ExprStmt{std::move(e)}}); }
-  static StmtPtr make_block(std::vector<StmtPtr> ss){ return std::make_unique<Stmt>(Stmt{Block{std::move(ss)}}); }
-  static StmtPtr make_if(ExprPtr c, StmtPtr t, StmtPtr e){ return std::make_unique<Stmt>(Stmt{If{std::move(c), std::move(t), std::move(e)}}); }
-  static StmtPtr make_while(ExprPtr c, StmtPtr b){ return std::make_unique<Stmt>(Stmt{While{std::move(c), std::move(b)}}); }
-  static StmtPtr make_print(ExprPtr e){ return std::make_unique<Stmt>(Stmt{Print{std::move(e)}}); }
-  static StmtPtr make_fn(std::string n, std::vector<std::string> ps, StmtPtr b){ return std::make_unique<Stmt>(Stmt{FnDecl{std::move(n), std::move(ps), std::move(b)}}); }
-  static StmtPtr make_return(ExprPtr v){ return std::make_unique<Stmt>(Stmt{Return{std::move(v)}}); }
-  static StmtPtr make_for_in(std::string v, ExprPtr it, StmtPtr b){ return std::make_unique<Stmt>(Stmt{ForIn{std::move(v), std::move(it), std::move(b)}}); }
-  static StmtPtr make_for_c(StmtPtr i, ExprPtr c, StmtPtr s, StmtPtr b){ return std::make_unique<Stmt>(Stmt{ForC{std::move(i), std::move(c), std::move(s), std::move(b)}}); }
 };
 
-using Program = std::vector<StmtPtr>;
+// ============== Program ==============
+struct Program {
+  std::vector<Expr>   exprs;
+  std::vector<Stmt>   stmts;
+  std::vector<ExprId> expr_lists;
+  std::vector<StmtId> stmt_lists;
+  std::vector<Symbol> symbol_lists;
+  std::vector<Value>  strings;                     // string literal pool
+  std::vector<StmtId> body;                        // top-level statements in order
+  // Where each node starts in the source, by id. Kept beside the nodes
+  // rather than in them, since only tools such as the profiler read them.
+  std::vector<SourcePos> expr_pos, stmt_pos;
+
+  Expr&       operator[](ExprId id)       { return exprs[static_cast<uint32_t>(id)]; }
+  const Expr& operator[](ExprId id) const { return exprs[static_cast<uint32_t>(id)]; }
+  Stmt&       operator[](StmtId id)       { return stmts[static_cast<uint32_t>(id)]; }
+  const Stmt& operator[](StmtId id) const { return stmts[static_cast<uint32_t>(id)]; }
+
+  Span<ExprId> operator[](List<ExprId> l) const { return {expr_lists.data() + l.begin, l.size}; }
+  Span<StmtId> operator[](List<StmtId> l) const { return {stmt_lists.data() + l.begin, l.size}; }
+  Span<Symbol> operator[](List<Symbol> l) const { return {symbol_lists.data() + l.begin, l.size}; }
+
+  SourcePos pos(ExprId id) const { return expr_pos[static_cast<uint32_t>(id)]; }
+  SourcePos pos(StmtId id) const { return stmt_pos[static_cast<uint32_t>(id)]; }
+
+  template<class N> ExprId add_expr(N n, SourcePos at) {
+    exprs.push_back(Expr{std::move(n)});
+    expr_pos.push_back(at);
+    return static_cast<ExprId>(exprs.size() - 1);
+  }
+  template<class N> StmtId add_stmt(N n, SourcePos at) {
+    stmts.push_back(Stmt{std::move(n)});
+    stmt_pos.push_back(at);
+    return static_cast<StmtId>(stmts.size() - 1);
+  }
+
+  List<ExprId> add_list(const ExprId* b, const ExprId* e) { return append(expr_lists, b, e); }
+  List<StmtId> add_list(const StmtId* b, const StmtId* e) { return append(stmt_lists, b, e); }
+  List<Symbol> add_list(const Symbol* b, const Symbol* e) { return append(symbol_lists, b, e); }
+
+private:
+  template<class T> static List<T> append(std::vector<T>& pool, const T* b, const T* e) {
+    List<T> l{static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(e - b)};
+    pool.insert(pool.end(), b, e);
+    return l;
+  }
+};
 
-}
\ No newline at end of file
+}
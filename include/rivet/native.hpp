@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include "rivet/symbol.hpp"
+#include "rivet/value.hpp"
+
+namespace rivet {
+
+// ============== Native functions ==============
+// Functions written in C++ and called from Rivet like any other function. A
+// native takes a fixed number of arguments (at most kMaxNativeArity) as an
+// array of exactly that many Values, returns one Value, and reports errors by
+// throwing std::runtime_error.
+//
+// Call sites are bound to natives when a program is resolved, so an embedder
+// registers its natives before resolving the programs that call them. A
+// function the program declares with the same name takes precedence.
+//
+//   static Value twice(Value* args) { return rivet::as_number(args[0]) * 2; }
+//   rivet::register_native("twice", 1, twice, rivet::kNativePure);
+using NativeFn = Value (*)(Value* args);
+
+// The running program, as seen by a native that calls back into it. A Rivet
+// function is passed to a native by name: `map(xs, f)` hands over the string
+// "f" (a bare function or native name in that position becomes its name), so
+// a variable holding a name works too.
+class Caller {
+public:
+  // Calls the function, or else the native, named by the string `fn`.
+  virtual Value call(const Value& fn, Value* args, uint32_t argc) = 0;
+
+  // Calls body(caller, i) for every i in [0, tasks) on the thread pool, each
+  // worker with a Caller of its own, under the rules of `parallel for`: the
+  // functions called cannot assign to variables from outside, what they print
+  // comes out in task order, and the error of the first failing task is
+  // rethrown. Even a single task runs this way, so a callback behaves the
+  // same whatever the size of the input.
+  virtual void parallel(size_t tasks, const std::function<void(Caller&, size_t task)>& body) = 0;
+
+protected:
+  ~Caller() = default;
+};
+
+using NativeCallerFn = Value (*)(Value* args, Caller& caller);
+
+enum NativeFlags : uint8_t {
+  // The result depends only on the arguments and nothing else is read or
+  // changed, so Rivet functions calling it can still be memoized.
+  kNativePure    = 1,
+  // The native updates args[0] in place. When the first argument is a
+  // variable, args[0] is that variable's value, moved in for the call and
+  // stored back afterwards, so an unshared array is modified without a copy.
+  // Not allowed for a native that takes a Caller.
+  kNativeInPlace = 2,
+};
+
+struct Native {
+  Symbol   name;
+  uint32_t arity;
+  NativeFn fn;                // exactly one of fn and with_caller is set
+  NativeCallerFn with_caller;
+  uint8_t  flags;
+
+  Value call(Value* args, Caller& caller) const { return fn ? fn(args) : with_caller(args, caller); }
+};
+
+inline constexpr uint32_t kNoNative = UINT32_MAX;
+inline constexpr uint32_t kMaxNativeArity = 8;
+
+// Registers `fn` under `name` and returns its id; registering a name again
+// replaces the earlier native but keeps its id. The builtins (len, push, pop,
+// sqrt, floor, abs, min, max, sum, str, num, sort, sort_by, map, filter,
+// reduce, parallel_reduce) are registered from the start.
+uint32_t register_native(std::string_view name, uint32_t arity, NativeFn fn, uint8_t flags = 0);
+uint32_t register_native(std::string_view name, uint32_t arity, NativeCallerFn fn, uint8_t flags = 0);
+
+// The id of the native called `name`, or kNoNative.
+uint32_t find_native(Symbol name);
+const Native& native(uint32_t id);
+
+}
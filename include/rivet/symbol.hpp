@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace rivet {
+
+// Identifiers are interned once by the lexer; the AST and the runtime carry
+// the compact id and compare/hash it instead of the name.
+using Symbol = uint32_t;
+inline constexpr Symbol kNoSymbol = 0;
+
+Symbol intern(std::string_view name);
+// The symbol for `name` if it was ever interned, else kNoSymbol. Never adds
+// one, so it is safe from several threads while nothing is being interned.
+Symbol find_symbol(std::string_view name);
+const std::string& symbol_name(Symbol s);
+// One past the largest symbol handed out so far; usable as a table size.
+size_t symbol_count();
+
+}
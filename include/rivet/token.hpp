@@ -2,6 +2,7 @@
 #include <string>
 #include <string_view>
 #include <cstdint>
+#include "rivet/symbol.hpp"
 
 namespace rivet {
 
@@ -20,6 +21,7 @@ enum class TokenKind : uint16_t {
   KwElse,
   KwWhile,
   KwFor,
+  KwParallel,
   KwIn,
   KwReturn,
   KwPrint,
@@ -48,10 +50,14 @@ struct SourcePos {
   int col  = 1;
 };
 
+// A token is a view into the lexer's source: [offset, offset + length).
+// For strings the view excludes the quotes. Lexer::text() reads it and
+// Lexer::position() turns the offset into a line and column.
 struct Token {
   TokenKind   kind {TokenKind::End};
-  std::string lexeme;
-  SourcePos   pos {};
+  uint32_t    offset {};
+  uint32_t    length {};
+  Symbol      sym {kNoSymbol};   // interned name, for identifiers only
 };
 
 inline const char* to_string(TokenKind k) {
@@ -69,6 +75,7 @@ inline const char* to_string(TokenKind k) {
     case TokenKind::KwElse: return "else";
     case TokenKind::KwWhile: return "while";
     case TokenKind::KwFor: return "for";
+    case TokenKind::KwParallel: return "parallel";
     case TokenKind::KwIn: return "in";
     case TokenKind::KwReturn: return "return";
     case TokenKind::KwPrint: return "print";
@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rivet {
+
+// Set while `parallel for` workers may share Values (src/pool.hpp). Reference
+// counts are then updated with atomic read-modify-writes, and strings stop
+// growing shared buffers in place; otherwise both stay single-threaded code.
+inline bool threads_active = false;
+
+// Heap payloads share a small header with an intrusive reference count. The
+// count is a plain integer so the single-threaded path stays plain increments
+// the compiler can combine; starting and joining workers orders the switch.
+struct Obj {
+  enum class Kind : uint8_t { String, Array };
+  explicit Obj(Kind k) : kind(k) {}
+  uint32_t refs {0};
+  Kind     kind;
+  bool     charged {};      // counted by --mem-stats (mem_charge in src/heap.hpp)
+
+  // Objects live on Rivet's object heap (src/heap.hpp), not malloc's.
+  static void* operator new(size_t size);
+  static void  operator delete(void* p, size_t size);
+
+  void retain() {
+    if (!threads_active) ++refs;
+    else atomic_add(1);
+  }
+  // True when this dropped the last reference.
+  bool release() {
+    if (!threads_active) return --refs == 0;
+    return atomic_add(-1) == 0;
+  }
+  // The count as of the last retain or release by any thread.
+  uint32_t count() const {
+#if defined(_MSC_VER)
+    return static_cast<uint32_t>(_InterlockedOr(reinterpret_cast<volatile long*>(const_cast<uint32_t*>(&refs)), 0));
+#else
+    return __atomic_load_n(&refs, __ATOMIC_ACQUIRE);
+#endif
+  }
+
+private:
+  uint32_t atomic_add(int d) {
+#if defined(_MSC_VER)
+    return static_cast<uint32_t>(_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(&refs), d) + d);
+#else
+    return __atomic_add_fetch(&refs, static_cast<uint32_t>(d), __ATOMIC_ACQ_REL);
+#endif
+  }
+};
+
+struct StrObj;
+struct Array;
+
+// A NaN-boxed 64-bit value. Doubles are stored as themselves; everything else
+// lives in the quiet-NaN space that arithmetic never produces:
+//
+//   0x7FFC'0000'0000'000b   bool b
+//   0xFFFC'pppp'pppp'pppp   StrObj*  (48-bit pointer)
+//   0xFFFD'pppp'pppp'pppp   Array*
+//
+// NaN results are canonicalized to 0x7FF8'0000'0000'0000 so they can never
+// alias a boxed value. Copies of heap values bump the payload's refcount.
+class Value {
+public:
+  Value() = default;                                     // the number 0
+  Value(double d) {
+    if (d != d) bits = kCanonicalNaN; else std::memcpy(&bits, &d, sizeof d);
+  }
+  Value(bool b) : bits(b ? kTrue : kFalse) {}
+  Value(std::string s);
+  Value(const char* s) : Value(std::string(s)) {}
+  static Value array(std::vector<Value> items = {});
+  static Value concat(const Value& l, std::string_view r);    // l must be a string
+  static Value character(unsigned char c);                    // shared 1-char strings
+
+  Value(const Value& o) : bits(o.bits) { retain(); }
+  Value(Value&& o) noexcept : bits(o.bits) { o.bits = 0; }
+  Value& operator=(const Value& o) {
+    o.retain();
+    release();
+    bits = o.bits;
+    return *this;
+  }
+  Value& operator=(Value&& o) noexcept {
+    if (this != &o) { release(); bits = o.bits; o.bits = 0; }
+    return *this;
+  }
+  ~Value() { release(); }
+
+  bool is_number() const { return (bits & kQNaN) != kQNaN; }
+  bool is_bool()   const { return (bits | 1) == kTrue; }
+  bool is_string() const { return (bits & kTagMask) == kStringTag; }
+  bool is_array()  const { return (bits & kTagMask) == kArrayTag; }
+  bool is_heap()   const { return (bits & kHeapTag) == kHeapTag; }
+
+  double number() const { double d; std::memcpy(&d, &bits, sizeof d); return d; }
+  bool   boolean() const { return bits == kTrue; }
+  std::string_view string() const;
+  Array* array_ptr() const { return reinterpret_cast<Array*>(bits & kPtrMask); }
+  Array* mutable_array();           // unshares first; see Array
+  Obj*   obj() const { return reinterpret_cast<Obj*>(bits & kPtrMask); }
+
+  uint64_t raw() const { return bits; }
+  static constexpr uint64_t bool_bits(bool b) { return b ? kTrue : kFalse; }
+
+private:
+  static constexpr uint64_t kQNaN        = 0x7FFC'0000'0000'0000ull;
+  static constexpr uint64_t kCanonicalNaN= 0x7FF8'0000'0000'0000ull;
+  static constexpr uint64_t kFalse       = kQNaN;
+  static constexpr uint64_t kTrue        = kQNaN | 1;
+  static constexpr uint64_t kHeapTag     = 0xFFFC'0000'0000'0000ull;
+  static constexpr uint64_t kStringTag   = 0xFFFC'0000'0000'0000ull;
+  static constexpr uint64_t kArrayTag    = 0xFFFD'0000'0000'0000ull;
+  static constexpr uint64_t kTagMask     = 0xFFFF'0000'0000'0000ull;
+  static constexpr uint64_t kPtrMask     = 0x0000'FFFF'FFFF'FFFFull;
+
+  Value(Obj* o, uint64_t tag) : bits(tag | reinterpret_cast<uint64_t>(o)) { o->retain(); }
+
+  void retain() const { if (is_heap()) obj()->retain(); }
+  void release() { if (is_heap() && obj()->release()) destroy(obj()); }
+  static void destroy(Obj* o);
+
+  uint64_t bits {0};
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed");
+
+// A string is a prefix of a growable buffer. A plain string owns its buffer
+// (base == nullptr); concatenating onto the string whose length equals the
+// buffer's current size (the buffer's "tip") appends in place and returns a
+// new, longer prefix of the same buffer, so `s = s + row` in a loop is
+// amortized O(1) per append. Older prefixes stay valid: bytes below their
+// length are never rewritten.
+struct StrObj : Obj {
+  explicit StrObj(std::string s) : Obj(Kind::String), buf(std::move(s)), len(buf.size()) {}
+  StrObj(StrObj* owner, size_t n) : Obj(Kind::String), base(owner), len(n) { owner->retain(); }
+
+  StrObj*       owner()       { return base ? base : this; }
+  const StrObj* owner() const { return base ? base : this; }
+  std::string_view view() const { return {owner()->buf.data(), len}; }
+
+  std::string buf;                  // used only by owners
+  StrObj*     base {nullptr};
+  size_t      len {};
+  size_t      buf_charged {};       // bytes of buf counted by --mem-stats
+};
+
+// Arrays are values with copy-on-write storage: copying a Value shares the
+// Array, and Value::mutable_array() gives the writer a private copy of the
+// items first whenever anybody else still holds them. Reads never copy.
+struct Array : Obj {
+  Array() : Obj(Kind::Array) {}
+  std::vector<Value> items;
+  // Whether every item is a number, so the SIMD kernels (src/vec.hpp) can
+  // run over `items` as doubles. Worked out on first use; writers reset it.
+  // Atomic because parallel for workers may work it out at the same time.
+  enum class Shape : uint8_t { Unknown, Numbers, Mixed };
+  mutable std::atomic<Shape> shape {Shape::Unknown};
+
+  // Counts `items` again for --mem-stats after a write that may have grown
+  // or shrunk it.
+  void recharge() { if (charged) recharge_items(); }
+  size_t items_charged {};
+
+private:
+  void recharge_items();
+};
+
+inline std::string_view Value::string() const { return reinterpret_cast<StrObj*>(bits & kPtrMask)->view(); }
+
+// --- helpers ---
+inline bool is_number(const Value& v){ return v.is_number(); }
+inline bool is_bool  (const Value& v){ return v.is_bool(); }
+inline bool is_string(const Value& v){ return v.is_string(); }
+inline bool is_array (const Value& v){ return v.is_array(); }
+
+inline double as_number(const Value& v){ return v.number(); }
+inline bool as_bool(const Value& v){ return v.boolean(); }
+inline std::string_view as_string(const Value& v){ return v.string(); }
+inline Array* as_array(const Value& v){ return v.array_ptr(); }
+
+inline bool truthy(const Value& v) {
+  if (is_bool(v))   return as_bool(v);
+  if (is_number(v)) return as_number(v) != 0.0;
+  if (is_string(v)) return !as_string(v).empty();
+  if (is_array(v))  return !as_array(v)->items.empty();
+  return false;
+}
+
+}
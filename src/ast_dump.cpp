@@ -0,0 +1,157 @@
+#include "ast_dump.hpp"
+#include <string>
+#include <type_traits>
+#include "eval.hpp"
+#include "rivet/symbol.hpp"
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+const char* op_text(UnaryOp op) { return op == UnaryOp::Negate ? "-" : "!"; }
+
+const char* op_text(BinaryOp op) {
+  switch (op) {
+    case BinaryOp::Add:  return "+";
+    case BinaryOp::Sub:  return "-";
+    case BinaryOp::Mul:  return "*";
+    case BinaryOp::Div:  return "/";
+    case BinaryOp::Eq:   return "==";
+    case BinaryOp::Ne:   return "!=";
+    case BinaryOp::Lt:   return "<";
+    case BinaryOp::Le:   return "<=";
+    case BinaryOp::Gt:   return ">";
+    case BinaryOp::Ge:   return ">=";
+    case BinaryOp::LAnd: return "&&";
+    case BinaryOp::LOr:  return "||";
+  }
+  return "?";
+}
+
+namespace {
+
+class Dumper {
+public:
+  Dumper(const Program& prog, std::ostream& os) : p(prog), out(os) {}
+
+  void expr(ExprId e) {
+    std::visit([&](const auto& node) {
+      using T = std::decay_t<decltype(node)>;
+      if constexpr (std::is_same_v<T, NumberLit>) out << to_string_value(Value(node.value));
+      else if constexpr (std::is_same_v<T, BoolLit>) out << (node.value ? "true" : "false");
+      else if constexpr (std::is_same_v<T, StringLit>) quoted(as_string(p.strings[node.id]));
+      else if constexpr (std::is_same_v<T, ArrayLit>) {
+        out << "(array";
+        for (ExprId el : p[node.elems]) { out << ' '; expr(el); }
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, Grouping>) { out << "(group "; expr(node.inner); out << ')'; }
+      else if constexpr (std::is_same_v<T, Unary>) { out << '(' << op_text(node.op) << ' '; expr(node.right); out << ')'; }
+      else if constexpr (std::is_same_v<T, Binary>) {
+        out << '(' << op_text(node.op) << ' ';
+        expr(node.left);
+        out << ' ';
+        expr(node.right);
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, Variable>) out << symbol_name(node.name);
+      else if constexpr (std::is_same_v<T, Call>) {
+        out << "(call " << symbol_name(node.callee);
+        for (ExprId a : p[node.args]) { out << ' '; expr(a); }
+        out << ')';
+      }
+      else static_assert(always_false_v<T>, "Unhandled Expr node");
+    }, p[e].node);
+  }
+
+  void stmt(StmtId s, int depth) {
+    indent(depth);
+    std::visit([&](const auto& node) {
+      using T = std::decay_t<decltype(node)>;
+      if constexpr (std::is_same_v<T, Let>) { out << "(let " << symbol_name(node.name) << ' '; expr(node.init); out << ')'; }
+      else if constexpr (std::is_same_v<T, Var>) { out << "(var " << symbol_name(node.name) << ' '; expr(node.init); out << ')'; }
+      else if constexpr (std::is_same_v<T, Assign>) { out << "(set " << symbol_name(node.name) << ' '; expr(node.value); out << ')'; }
+      else if constexpr (std::is_same_v<T, ExprStmt>) expr(node.expr);
+      else if constexpr (std::is_same_v<T, Print>) { out << "(print "; expr(node.expr); out << ')'; }
+      else if constexpr (std::is_same_v<T, Return>) { out << "(return "; expr(node.value); out << ')'; }
+      else if constexpr (std::is_same_v<T, Block>) {
+        out << "(block";
+        for (StmtId st : p[node.stmts]) { out << '\n'; stmt(st, depth + 1); }
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, If>) {
+        out << "(if ";
+        expr(node.cond);
+        out << '\n'; stmt(node.then_br, depth + 1);
+        out << '\n'; stmt(node.else_br, depth + 1);
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, While>) {
+        out << "(while ";
+        expr(node.cond);
+        out << '\n'; stmt(node.body, depth + 1);
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, FnDecl>) {
+        out << "(fn " << symbol_name(node.name) << " (";
+        bool first = true;
+        for (Symbol param : p[node.params]) { out << (first ? "" : " ") << symbol_name(param); first = false; }
+        out << ")\n";
+        stmt(node.body, depth + 1);
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, ForIn>) {
+        out << (node.parallel ? "(parallel-for-in " : "(for-in ") << symbol_name(node.var) << ' ';
+        expr(node.iterable);
+        out << '\n'; stmt(node.body, depth + 1);
+        out << ')';
+      }
+      else if constexpr (std::is_same_v<T, ForC>) {
+        out << "(for";
+        clause(node.init, depth + 1);
+        out << '\n'; indent(depth + 1);
+        if (node.cond != kNoExpr) expr(node.cond); else out << '_';
+        clause(node.step, depth + 1);
+        out << '\n'; stmt(node.body, depth + 1);
+        out << ')';
+      }
+      else static_assert(always_false_v<T>, "Unhandled Stmt node");
+    }, p[s].node);
+  }
+
+private:
+  void indent(int depth) { for (int i = 0; i < depth; ++i) out << "  "; }
+
+  void clause(StmtId s, int depth) {
+    out << '\n';
+    if (s != kNoStmt) { stmt(s, depth); return; }
+    indent(depth);
+    out << '_';
+  }
+
+  void quoted(std::string_view s) {
+    out << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') out << '\\' << c;
+      else if (c == '\n') out << "\\n";
+      else if (c == '\t') out << "\\t";
+      else out << c;
+    }
+    out << '"';
+  }
+
+  const Program& p;
+  std::ostream& out;
+};
+
+}
+
+void dump_ast(const Program& p, std::ostream& out) {
+  Dumper d(p, out);
+  for (StmtId s : p.body) {
+    d.stmt(s, 0);
+    out << '\n';
+  }
+}
+
+}
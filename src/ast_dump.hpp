@@ -0,0 +1,15 @@
+#pragma once
+#include <ostream>
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// Writes the program as indented S-expressions, one top-level statement per
+// line group: `(let x (+ 1 2))`, `(if cond <then> <else>)`, ...
+void dump_ast(const Program& p, std::ostream& out);
+
+// An operator as written in source: "-", "+", "<=", ...
+const char* op_text(UnaryOp op);
+const char* op_text(BinaryOp op);
+
+}
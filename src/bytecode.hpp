@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "eval.hpp"
+
+namespace rivet {
+
+// Operand encoding: every operand is a little-endian u32 following the opcode
+// byte. Jump operands are i32 offsets relative to the end of the instruction.
+//
+//   Const k          push constants[k]
+//   True / False     push a bool
+//   Pop              drop top of stack
+//   MakeArray n      pop n values, push an array of them
+//   Negate / Not     unary operators
+//   Add .. Ge        binary operators (pop r, pop l, push l op r)
+//   Truthy           replace top with truthy(top)
+//   Jump off         unconditional jump
+//   JumpIfFalse off  pop, jump if !truthy
+//   GetLocal s       push frame slot s
+//   GetGlobal s n    push main-frame slot s (symbol n for errors)
+//   GetDynamic n     push the innermost live binding of symbol n
+//   SetLocal s n     pop, assign to frame slot s
+//   SetGlobal s n    pop, assign to main-frame slot s
+//   SetDynamic n     pop, assign to the innermost live binding of symbol n
+//   DefLet s n       pop, bind immutable symbol n to frame slot s
+//   DefVar s n       pop, bind mutable symbol n to frame slot s
+//   ClearSlots b e   unbind frame slots [b, e) when a scope ends
+//   Print            pop and print
+//   SetLast          pop into the top-level "last value" register
+//   ClearLast        reset the "last value" register
+//   DefineFn f       register fns[f] under its name
+//   CallBegin n argc look up function n, check arity, reserve the callee frame
+//   SetParam i       pop into parameter slot i of the pending call
+//   CallEnd          jump into the pending callee
+//   TailCall         replace the current function's frame with the pending
+//                    callee's and jump into it; its Return goes to our caller
+//   Return           pop the return value and leave the current function
+//   Native f argc    call native f on the top argc values, push its result
+//   NativeVar f argc k s n
+//                    call in-place native f with variable n (RefKind k,
+//                    slot s) as its first argument and the top argc-1
+//                    values as the rest; the variable gets args[0] back
+//   IterInit         pop an array/string and start iterating it
+//   IterNext s n off bind the next element to symbol n in frame slot s, or
+//                    finish the loop and jump by off
+//   ParallelFor s off pop an array/string and run parallel for-in statement s
+//                    over it: workers run the body that follows, up to its
+//                    EndBody, once per element; then jump by off
+//   EndBody          end of a parallel for body
+//   Halt             end of the main program
+//   Exit             pop and return the value to the native that called a
+//                    function; the return address of every such call
+#define RIVET_OPCODES(X) \
+  X(Const) X(True) X(False) X(Pop) X(MakeArray) \
+  X(Negate) X(Not) \
+  X(Add) X(Sub) X(Mul) X(Div) X(Eq) X(Ne) X(Lt) X(Le) X(Gt) X(Ge) \
+  X(Truthy) X(Jump) X(JumpIfFalse) \
+  X(GetLocal) X(GetGlobal) X(GetDynamic) X(SetLocal) X(SetGlobal) X(SetDynamic) \
+  X(DefLet) X(DefVar) X(ClearSlots) \
+  X(Print) X(SetLast) X(ClearLast) \
+  X(DefineFn) X(CallBegin) X(SetParam) X(CallEnd) X(TailCall) X(Return) \
+  X(Native) X(NativeVar) \
+  X(IterInit) X(IterNext) X(ParallelFor) X(EndBody) \
+  X(Halt) X(Exit)
+
+enum class Op : uint8_t {
+#define RIVET_OP_ENUM(name) name,
+  RIVET_OPCODES(RIVET_OP_ENUM)
+#undef RIVET_OP_ENUM
+};
+
+struct FnProto {
+  Symbol name {};
+  std::vector<Symbol> params;
+  uint32_t entry {};                // offset of the body in Module::code
+  uint32_t frame_size {};
+  StmtId decl {kNoStmt};            // the FnDecl; MemoCache key when memo is set
+  bool memo {};
+};
+
+// A whole compiled program: one code buffer shared by the main program and
+// every function body, plus a module-wide constant pool. Name operands are
+// Symbols.
+struct Module {
+  std::vector<uint8_t>     code;
+  std::vector<Value>       constants;
+  std::vector<FnProto>     fns;
+  uint32_t                 entry {};
+  uint32_t                 exit {};   // the Exit instruction
+};
+
+inline uint32_t read_u32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, sizeof v); return v; }
+inline int32_t  read_i32(const uint8_t* p) { int32_t v;  std::memcpy(&v, p, sizeof v); return v; }
+
+}
@@ -0,0 +1,309 @@
+#include "compiler.hpp"
+#include <deque>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+namespace {
+
+class Compiler {
+public:
+  explicit Compiler(const Program& prog) : p(prog) {}
+
+  Module compile() {
+    m.entry = here();
+    for (StmtId s : p.body) stmt(s);
+    emit(Op::Halt);
+    m.exit = here();
+    emit(Op::Exit);
+
+    // Function bodies are appended after the main program. Compiling one may
+    // discover nested declarations, which are queued behind it.
+    track_last = false;
+    while (!pending.empty()) {
+      auto [fn, idx] = pending.front();
+      pending.pop_front();
+      m.fns[idx].entry = here();
+      stmt(fn->body);
+      emit_u32(Op::Const, constant(0.0));
+      emit(Op::Return);
+    }
+    return std::move(m);
+  }
+
+private:
+  // ========== emission ==========
+  uint32_t here() const { return static_cast<uint32_t>(m.code.size()); }
+  void emit(Op op) { m.code.push_back(static_cast<uint8_t>(op)); }
+  void put_u32(uint32_t v) {
+    uint8_t b[4]; std::memcpy(b, &v, sizeof v);
+    m.code.insert(m.code.end(), b, b + 4);
+  }
+  void emit_u32(Op op, uint32_t a) { emit(op); put_u32(a); }
+  void emit_u32(Op op, uint32_t a, uint32_t b) { emit(op); put_u32(a); put_u32(b); }
+  void clear_slots(uint32_t begin, uint32_t end) { if (end > begin) emit_u32(Op::ClearSlots, begin, end); }
+
+  void get_var(Symbol n, VarRef ref) {
+    switch (ref.kind) {
+      case RefKind::Local:   emit_u32(Op::GetLocal, ref.slot); break;
+      case RefKind::Global:  emit_u32(Op::GetGlobal, ref.slot, n); break;
+      case RefKind::Dynamic: emit_u32(Op::GetDynamic, n); break;
+    }
+  }
+  void set_var(Symbol n, VarRef ref) {
+    switch (ref.kind) {
+      case RefKind::Local:   emit_u32(Op::SetLocal, ref.slot, n); break;
+      case RefKind::Global:  emit_u32(Op::SetGlobal, ref.slot, n); break;
+      case RefKind::Dynamic: emit_u32(Op::SetDynamic, n); break;
+    }
+  }
+
+  uint32_t emit_jump(Op op) { emit(op); uint32_t at = here(); put_u32(0); return at; }
+  void patch_jump(uint32_t at) { patch_jump_to(at, here()); }
+  void patch_jump_to(uint32_t at, uint32_t target) {
+    int32_t off = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+    std::memcpy(&m.code[at], &off, sizeof off);
+  }
+  void emit_loop(uint32_t target) { patch_jump_to(emit_jump(Op::Jump), target); }
+
+  // The top-level program reports the value of its last expression statement,
+  // so main code keeps a "last value" register in sync; function bodies and
+  // for-loop init/step clauses discard expression results instead.
+  void clear_last() { if (track_last) emit(Op::ClearLast); }
+
+  uint32_t constant(Value v) {
+    if (is_number(v)) {
+      double d = as_number(v); uint64_t bits; std::memcpy(&bits, &d, sizeof bits);
+      auto [it, fresh] = num_consts.try_emplace(bits, static_cast<uint32_t>(m.constants.size()));
+      if (fresh) m.constants.push_back(std::move(v));
+      return it->second;
+    }
+    if (is_string(v)) {
+      auto [it, fresh] = str_consts.try_emplace(std::string(as_string(v)), static_cast<uint32_t>(m.constants.size()));
+      if (fresh) m.constants.push_back(std::move(v));
+      return it->second;
+    }
+    m.constants.push_back(std::move(v));
+    return static_cast<uint32_t>(m.constants.size() - 1);
+  }
+
+  // ========== stmts ==========
+  void stmt(StmtId s) {
+    std::visit([&](auto const& node) {
+      using T = std::decay_t<decltype(node)>;
+
+      if constexpr (std::is_same_v<T, Let>) {
+        expr(node.init); emit_u32(Op::DefLet, node.slot, node.name); clear_last();
+
+      } else if constexpr (std::is_same_v<T, Var>) {
+        expr(node.init); emit_u32(Op::DefVar, node.slot, node.name); clear_last();
+
+      } else if constexpr (std::is_same_v<T, Assign>) {
+        expr(node.value); set_var(node.name, node.ref); clear_last();
+
+      } else if constexpr (std::is_same_v<T, ExprStmt>) {
+        expr(node.expr); emit(track_last ? Op::SetLast : Op::Pop);
+
+      } else if constexpr (std::is_same_v<T, Print>) {
+        expr(node.expr); emit(Op::Print); clear_last();
+
+      } else if constexpr (std::is_same_v<T, Block>) {
+        if (node.stmts.size == 0) clear_last();
+        for (StmtId st : p[node.stmts]) stmt(st);
+        clear_slots(node.slot_begin, node.slot_end);
+
+      } else if constexpr (std::is_same_v<T, If>) {
+        expr(node.cond);
+        uint32_t to_else = emit_jump(Op::JumpIfFalse);
+        stmt(node.then_br);
+        uint32_t to_end = emit_jump(Op::Jump);
+        patch_jump(to_else);
+        stmt(node.else_br);
+        patch_jump(to_end);
+
+      } else if constexpr (std::is_same_v<T, While>) {
+        clear_last();
+        uint32_t top = here();
+        expr(node.cond);
+        uint32_t to_exit = emit_jump(Op::JumpIfFalse);
+        stmt(node.body);
+        emit_loop(top);
+        patch_jump(to_exit);
+
+      } else if constexpr (std::is_same_v<T, ForC>) {
+        if (node.init != kNoStmt) discarding(node.init);
+        clear_last();
+        uint32_t top = here();
+        uint32_t to_exit = 0;
+        if (node.cond != kNoExpr) { expr(node.cond); to_exit = emit_jump(Op::JumpIfFalse); }
+        stmt(node.body);
+        if (node.step != kNoStmt) discarding(node.step);
+        emit_loop(top);
+        if (node.cond != kNoExpr) patch_jump(to_exit);
+        clear_slots(node.slot_begin, node.slot_end);
+
+      } else if constexpr (std::is_same_v<T, ForIn>) {
+        expr(node.iterable);
+        if (node.parallel) {
+          emit_u32(Op::ParallelFor, static_cast<uint32_t>(s));
+          uint32_t to_end = here(); put_u32(0);
+          discarding(node.body);
+          emit(Op::EndBody);
+          patch_jump(to_end);
+          clear_last();
+          return;
+        }
+        emit(Op::IterInit);
+        uint32_t top = here();
+        emit_u32(Op::IterNext, node.slot, node.var);
+        uint32_t to_exit = here(); put_u32(0);
+        stmt(node.body);
+        clear_slots(node.slot, node.slot_end);
+        emit_loop(top);
+        patch_jump(to_exit);
+        clear_last();
+
+      } else if constexpr (std::is_same_v<T, FnDecl>) {
+        FnProto proto;
+        proto.name = node.name;
+        for (Symbol param : p[node.params]) proto.params.push_back(param);
+        proto.frame_size = node.frame_size;
+        proto.decl = s;
+        proto.memo = node.memo;
+        uint32_t idx = static_cast<uint32_t>(m.fns.size());
+        m.fns.push_back(std::move(proto));
+        pending.emplace_back(&node, idx);
+        emit_u32(Op::DefineFn, idx);
+        clear_last();
+
+      } else if constexpr (std::is_same_v<T, Return>) {
+        if (node.tail) call(std::get<Call>(p[node.value].node), Op::TailCall);
+        else { expr(node.value); emit(Op::Return); }
+
+      } else {
+        static_assert(always_false_v<T>, "Unhandled Stmt node");
+      }
+    }, p[s].node);
+  }
+
+  void discarding(StmtId s) {
+    bool saved = track_last; track_last = false;
+    stmt(s);
+    track_last = saved;
+  }
+
+  // ========== exprs ==========
+  void expr(ExprId e) {
+    std::visit([&](auto const& node) {
+      using T = std::decay_t<decltype(node)>;
+
+      if constexpr (std::is_same_v<T, NumberLit>) {
+        emit_u32(Op::Const, constant(node.value));
+      } else if constexpr (std::is_same_v<T, BoolLit>) {
+        emit(node.value ? Op::True : Op::False);
+      } else if constexpr (std::is_same_v<T, StringLit>) {
+        emit_u32(Op::Const, constant(p.strings[node.id]));
+      } else if constexpr (std::is_same_v<T, ArrayLit>) {
+        for (ExprId el : p[node.elems]) expr(el);
+        emit_u32(Op::MakeArray, node.elems.size);
+      } else if constexpr (std::is_same_v<T, Grouping>) {
+        expr(node.inner);
+      } else if constexpr (std::is_same_v<T, Unary>) {
+        expr(node.right);
+        emit(node.op == UnaryOp::Negate ? Op::Negate : Op::Not);
+      } else if constexpr (std::is_same_v<T, Binary>) {
+        binary(node);
+      } else if constexpr (std::is_same_v<T, Variable>) {
+        get_var(node.name, node.ref);
+      } else if constexpr (std::is_same_v<T, Call>) {
+        if (node.native != kNoNative) native_call(node);
+        else call(node, Op::CallEnd);
+      } else {
+        static_assert(always_false_v<T>, "Unhandled Expr node");
+      }
+    }, p[e].node);
+  }
+
+  // `end` is CallEnd, or TailCall for a `return` the resolver marked tail.
+  void call(const Call& c, Op end) {
+    emit_u32(Op::CallBegin, c.callee);
+    put_u32(c.args.size);
+    auto args = p[c.args];
+    for (uint32_t i = 0; i < args.size(); ++i) {
+      expr(args[i]);
+      emit_u32(Op::SetParam, i);
+    }
+    emit(end);
+  }
+
+  // A call with the wrong number of arguments compiles to a bare Native,
+  // which fails before any argument is evaluated, as in the tree walker.
+  void native_call(const Call& c) {
+    auto args = p[c.args];
+    if (c.args.size != native(c.native).arity) { emit_u32(Op::Native, c.native, c.args.size); return; }
+    const Variable* target = nullptr;
+    if (native(c.native).flags & kNativeInPlace) target = std::get_if<Variable>(&p[args[0]].node);
+    for (size_t i = target ? 1 : 0; i < args.size(); ++i) expr(args[i]);
+    if (!target) { emit_u32(Op::Native, c.native, c.args.size); return; }
+    emit_u32(Op::NativeVar, c.native, c.args.size);
+    put_u32(static_cast<uint32_t>(target->ref.kind));
+    put_u32(target->ref.slot);
+    put_u32(target->name);
+  }
+
+  void binary(const Binary& b) {
+    if (b.op == BinaryOp::LOr) {
+      expr(b.left);
+      uint32_t to_rhs = emit_jump(Op::JumpIfFalse);
+      emit(Op::True);
+      uint32_t to_end = emit_jump(Op::Jump);
+      patch_jump(to_rhs);
+      expr(b.right); emit(Op::Truthy);
+      patch_jump(to_end);
+      return;
+    }
+    if (b.op == BinaryOp::LAnd) {
+      expr(b.left);
+      uint32_t to_false = emit_jump(Op::JumpIfFalse);
+      expr(b.right); emit(Op::Truthy);
+      uint32_t to_end = emit_jump(Op::Jump);
+      patch_jump(to_false);
+      emit(Op::False);
+      patch_jump(to_end);
+      return;
+    }
+    expr(b.left);
+    expr(b.right);
+    switch (b.op) {
+      case BinaryOp::Add: emit(Op::Add); break;
+      case BinaryOp::Sub: emit(Op::Sub); break;
+      case BinaryOp::Mul: emit(Op::Mul); break;
+      case BinaryOp::Div: emit(Op::Div); break;
+      case BinaryOp::Eq:  emit(Op::Eq);  break;
+      case BinaryOp::Ne:  emit(Op::Ne);  break;
+      case BinaryOp::Lt:  emit(Op::Lt);  break;
+      case BinaryOp::Le:  emit(Op::Le);  break;
+      case BinaryOp::Gt:  emit(Op::Gt);  break;
+      case BinaryOp::Ge:  emit(Op::Ge);  break;
+      default: throw std::runtime_error("compile: unknown binary op");
+    }
+  }
+
+private:
+  const Program& p;
+  Module m;
+  std::unordered_map<uint64_t, uint32_t>    num_consts;
+  std::unordered_map<std::string, uint32_t> str_consts;
+  std::deque<std::pair<const FnDecl*, uint32_t>> pending;
+  bool track_last = true;
+};
+
+}
+
+Module compile_program(const Program& p) { return Compiler{p}.compile(); }
+
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "bytecode.hpp"
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// Lowers a resolved program to bytecode for the VM. The returned Module does
+// not reference the Program: literals are copied into its constant pool.
+Module compile_program(const Program& p);
+
+}
@@ -1,4 +1,16 @@
 #include "eval.hpp"
+#include "jit.hpp"
+#include "memstats.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "vec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iomanip>
+#include <iterator>
 #include <stdexcept>
 #include <type_traits>
 #include <iostream>
@@ -10,47 +22,98 @@ namespace rivet {
 template<class> inline constexpr bool always_false_v = false;
 
 // ========== Env ==========
-void Env::push() { scopes.emplace_back(); }
-void Env::pop()  { if (!scopes.empty()) scopes.pop_back(); }
-
-void Env::define_let(const std::string& name, Value v) {
-  if (scopes.empty()) push();
-  scopes.back()[name] = VarCell{std::move(v), false};
-}
-void Env::define_var(const std::string& name, Value v) {
-  if (scopes.empty()) push();
-  scopes.back()[name] = VarCell{std::move(v), true};
-}
-void Env::assign(const std::string& name, Value v) {
-  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-    auto f = it->find(name);
-    if (f != it->end()) {
-      if (!f->second.mut)
-        throw std::runtime_error("runtime error: cannot assign to immutable 'let " + name + "'");
-      f->second.val = std::move(v);
-      return;
+Env::Env(const Program& p) : prog(p) { frames.push_back(Frame{0, 0}); recharge(); }
+
+Env Env::fork() const {
+  Env e(prog);
+  e.cells = cells;
+  e.frames = frames;
+  e.base = base;
+  e.fns = fns;
+  for (VarCell& c : e.cells)
+    if (c.name != kNoSymbol) { c.mut = false; c.shared = true; }
+  e.recharge();
+  return e;
+}
+
+void Env::ensure_main(uint32_t size) {
+  if (cells.size() < size) cells.resize(size);
+  frames.front().size = cells.size();
+  recharge();
+}
+
+size_t Env::open_frame(uint32_t size) {
+  size_t b = cells.size();
+  cells.resize(b + size);
+  recharge();
+  return b;
+}
+void Env::drop_frame(size_t b) { cells.resize(b); }
+void Env::enter_frame(size_t b, uint32_t size) {
+  if (counting) ++run_counters().frames_entered;
+  frames.push_back(Frame{b, size});
+  base = b;
+  recharge();
+}
+void Env::replace_frame(size_t args, uint32_t argc, uint32_t size) {
+  if (counting) ++run_counters().frames_reused;
+  Frame& f = frames.back();
+  for (uint32_t i = 0; i < argc; ++i) cells[f.base + i] = std::move(cells[args + i]);
+  for (size_t i = f.base + argc; i < cells.size(); ++i) cells[i] = VarCell{};
+  cells.resize(f.base + size);
+  f.size = size;
+  recharge();
+}
+void Env::leave_frame() {
+  if (counting) ++run_counters().frames_left;
+  cells.resize(frames.back().base);
+  frames.pop_back();
+  base = frames.back().base;
+}
+
+void Env::define(uint32_t slot, Symbol name, Value v, bool mut) {
+  VarCell& c = cells[base + slot];
+  c.val = std::move(v); c.name = name; c.mut = mut;
+}
+void Env::clear(uint32_t begin, uint32_t end) {
+  if (counting) ++run_counters().scopes_left;
+  for (size_t i = base + begin; i < base + end; ++i) cells[i] = VarCell{};
+}
+
+VarCell* Env::find(Symbol name) {
+  for (auto f = frames.rbegin(); f != frames.rend(); ++f) {
+    for (size_t i = f->base + f->size; i-- > f->base; ) {
+      if (cells[i].name != name) continue;
+      if (counting) count_dynamic_lookup(static_cast<size_t>(f - frames.rbegin()) + 1);
+      return &cells[i];
     }
   }
-  throw std::runtime_error("runtime error: assignment to undefined variable '" + name + "'");
+  if (counting) count_dynamic_lookup(0);
+  return nullptr;
 }
-bool Env::get(const std::string& name, Value& out) const {
-  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-    auto f = it->find(name);
-    if (f != it->end()) { out = f->second.val; return true; }
+
+VarCell* Env::lookup(Symbol name, VarRef ref) {
+  if (counting && ref.kind != RefKind::Dynamic)
+    ++(ref.kind == RefKind::Local ? run_counters().local_reads : run_counters().global_reads);
+  switch (ref.kind) {
+    case RefKind::Local:  return &cells[base + ref.slot];
+    case RefKind::Global: return cells[ref.slot].name != kNoSymbol ? &cells[ref.slot] : nullptr;
+    case RefKind::Dynamic: break;
   }
-  return false;
+  return find(name);
 }
-void Env::define_fn(const FnDecl* fn) { fns[fn->name] = fn; }
-const FnDecl* Env::get_fn(const std::string& name) const {
-  auto it = fns.find(name);
-  return it == fns.end() ? nullptr : it->second;
+
+void Env::define_fn(StmtId fn) {
+  Symbol name = std::get<FnDecl>(prog[fn].node).name;
+  if (fns.size() <= name) fns.resize(name + 1, kNoStmt);
+  fns[name] = fn;
 }
 
 // ========== helpers ==========
-static std::string to_string_value(const Value& v) {
+std::string to_string_value(const Value& v) {
   if (is_number(v)) { std::ostringstream os; os << as_number(v); return os.str(); }
   if (is_bool(v))   return as_bool(v) ? "true" : "false";
-  if (is_string(v)) return as_string(v);
+  if (is_string(v)) return std::string(as_string(v));
   const auto& arr = *as_array(v);
   std::string s = "[";
   for (size_t i = 0; i < arr.items.size(); ++i) {
@@ -61,36 +124,89 @@ static std::string to_string_value(const Value& v) {
   return s;
 }
 
-static bool equal_values(const Value& a, const Value& b) {
-  if (a.index() != b.index()) return false;
-  if (is_number(a)) return as_number(a) == as_number(b);
-  if (is_bool(a))   return as_bool(a)   == as_bool(b);
-  if (is_string(a)) return as_string(a) == as_string(b);
-  auto A = as_array(a), B = as_array(b);
+// ========== arrays ==========
+bool numeric(const Array& a) {
+  if (a.shape == Array::Shape::Unknown)
+    a.shape = vec_kernels().all_numbers(a.items.data(), a.items.size()) ? Array::Shape::Numbers : Array::Shape::Mixed;
+  return a.shape == Array::Shape::Numbers;
+}
+
+// The operators that apply element-wise to arrays.
+static std::optional<VecOp> vec_op(BinaryOp op) {
+  switch (op) {
+    case BinaryOp::Add: return VecOp::Add;
+    case BinaryOp::Sub: return VecOp::Sub;
+    case BinaryOp::Mul: return VecOp::Mul;
+    case BinaryOp::Div: return VecOp::Div;
+    case BinaryOp::Lt:  return VecOp::Lt;
+    case BinaryOp::Le:  return VecOp::Le;
+    case BinaryOp::Gt:  return VecOp::Gt;
+    case BinaryOp::Ge:  return VecOp::Ge;
+    default:            return std::nullopt;
+  }
+}
+
+// Arithmetic and ordering between an array and a same-length array or a
+// scalar apply per element. Arrays of numbers go through the SIMD kernels;
+// anything else applies binary_op item by item.
+static Value elementwise(BinaryOp op, VecOp vop, const Value& l, const Value& r) {
+  const Array* la = is_array(l) ? as_array(l) : nullptr;
+  const Array* ra = is_array(r) ? as_array(r) : nullptr;
+  size_t n = la ? la->items.size() : ra->items.size();
+  if (la && ra && ra->items.size() != n)
+    throw std::runtime_error("runtime error: element-wise operation on arrays of length " +
+                             std::to_string(n) + " and " + std::to_string(ra->items.size()));
+
+  std::vector<Value> out(n);
+  if ((la ? numeric(*la) : is_number(l)) && (ra ? numeric(*ra) : is_number(r))) {
+    const VecKernels& k = vec_kernels();
+    if (op == BinaryOp::Div && (ra ? k.any_zero(ra->items.data(), n) : as_number(r) == 0.0))
+      throw std::runtime_error("runtime error: division by zero");
+    k.binary[static_cast<size_t>(vop)](la ? la->items.data() : &l, la ? 1 : 0,
+                                       ra ? ra->items.data() : &r, ra ? 1 : 0, out.data(), n);
+    Value v = Value::array(std::move(out));
+    as_array(v)->shape = vop <= VecOp::Div ? Array::Shape::Numbers : Array::Shape::Mixed;
+    return v;
+  }
+  for (size_t i = 0; i < n; ++i) out[i] = binary_op(op, la ? la->items[i] : l, ra ? ra->items[i] : r);
+  return Value::array(std::move(out));
+}
+
+bool equal_values(const Value& a, const Value& b) {
+  if (is_number(a)) return is_number(b) && as_number(a) == as_number(b);
+  if (is_bool(a))   return is_bool(b)   && as_bool(a)   == as_bool(b);
+  if (is_string(a)) return is_string(b) && as_string(a) == as_string(b);
+  if (!is_array(b)) return false;
+  const Array* A = as_array(a);
+  const Array* B = as_array(b);
+  if (A == B) return true;
   if (A->items.size() != B->items.size()) return false;
+  if (numeric(*A) && numeric(*B)) return vec_kernels().equal(A->items.data(), B->items.data(), A->items.size());
   for (size_t i = 0; i < A->items.size(); ++i)
     if (!equal_values(A->items[i], B->items[i])) return false;
   return true;
 }
 
-static Value eval_node(const Expr& e, const Env& env);
+static Value eval_node(ExprId e, const Env& env);
+static const Value& eval_borrow(ExprId e, const Env& env, Value& tmp);
 static Value eval_call(const Call& c, Env& env);
+static const FnDecl* callee(const Call& c, const Env& env);
+static void bind_args(const Call& c, const FnDecl& fn, Env& env, size_t base);
 
 // ========== expr ==========
 static Value eval_number(const NumberLit& n){ return n.value; }
 static Value eval_bool  (const BoolLit& b){ return b.value; }
-static Value eval_string(const StringLit& s){ return s.value; }
+static Value eval_string(const StringLit& s, const Env& env){ return env.program().strings[s.id]; }
 static Value eval_array (const ArrayLit& a, const Env& env){
-  auto out = std::make_shared<Array>();
-  out->items.reserve(a.elems.size());
-  for (auto& e : a.elems) out->items.push_back(eval_node(*e, env));
-  return out;
+  std::vector<Value> items;
+  items.reserve(a.elems.size);
+  for (ExprId e : env.program()[a.elems]) items.push_back(eval_node(e, env));
+  return Value::array(std::move(items));
 }
-static Value eval_group (const Grouping& g, const Env& env){ return eval_node(*g.inner, env); }
+static Value eval_group (const Grouping& g, const Env& env){ return eval_node(g.inner, env); }
 
-static Value eval_unary(const Unary& u, const Env& env){
-  Value r = eval_node(*u.right, env);
-  switch (u.op) {
+Value unary_op(UnaryOp op, const Value& r){
+  switch (op) {
     case UnaryOp::Negate:
       if (!is_number(r)) throw std::runtime_error("type error: unary '-' expects number");
       return -as_number(r);
@@ -100,16 +216,16 @@ static Value eval_unary(const Unary& u, const Env& env){
   throw std::runtime_error("eval: unknown unary op");
 }
 
-static Value eval_binary(const Binary& b, const Env& env){
-  if (b.op == BinaryOp::LOr)  { Value l = eval_node(*b.left, env); if (truthy(l)) return true;  Value r = eval_node(*b.right, env); return truthy(r); }
-  if (b.op == BinaryOp::LAnd) { Value l = eval_node(*b.left, env); if (!truthy(l)) return false; Value r = eval_node(*b.right, env); return truthy(r); }
-
-  Value l = eval_node(*b.left, env);
-  Value r = eval_node(*b.right, env);
-  switch (b.op) {
+Value binary_op(BinaryOp op, const Value& l, const Value& r){
+  if (is_array(l) || is_array(r)) {
+    auto vop = vec_op(op);
+    if (vop && !(op == BinaryOp::Add && (is_string(l) || is_string(r)))) return elementwise(op, *vop, l, r);
+  }
+  switch (op) {
     case BinaryOp::Add:
       if (is_number(l) && is_number(r)) return as_number(l) + as_number(r);
-      if (is_string(l) || is_string(r)) return to_string_value(l) + to_string_value(r);
+      if (is_string(l)) return Value::concat(l, is_string(r) ? as_string(r) : to_string_value(r));
+      if (is_string(r)) { std::string out = to_string_value(l); out.append(as_string(r)); return out; }
       throw std::runtime_error("type error: '+' expects number+number or string (+ anything)");
     case BinaryOp::Sub:
       if (is_number(l) && is_number(r)) return as_number(l) - as_number(r);
@@ -146,124 +262,329 @@ static Value eval_binary(const Binary& b, const Env& env){
   throw std::runtime_error("eval: unknown binary op");
 }
 
-static Value eval_variable(const Variable& v, const Env& env){
-  Value out;
-  if (!env.get(v.name, out))
-    throw std::runtime_error("runtime error: undefined variable '" + v.name + "'");
-  return out;
+static Value eval_unary(const Unary& u, const Env& env){
+  Value tmp;
+  return unary_op(u.op, eval_borrow(u.right, env, tmp));
 }
 
-static Value eval_node(const Expr& e, const Env& env_ro){
+// Evaluating a literal or a variable runs no code, so a value borrowed
+// before it is still intact afterwards.
+static bool is_leaf(ExprId e, const Env& env){
+  const auto& n = env.program()[e].node;
+  return !std::holds_alternative<Call>(n) && !std::holds_alternative<Binary>(n) &&
+         !std::holds_alternative<Unary>(n) && !std::holds_alternative<Grouping>(n) &&
+         !std::holds_alternative<ArrayLit>(n);
+}
+
+// ========== quickening ==========
+// Nodes are only rewritten while no parallel code runs; worker threads read
+// the state the main thread left and take the generic path on a guard miss.
+static void quicken(const Binary& b, Quick q) { if (!threads_active) b.quick = q; }
+
+// What a Binary that first sees l and r specializes to.
+static Quick specialize(BinaryOp op, const Value& l, const Value& r){
+  if (is_number(l) && is_number(r)) {
+    switch (op) {
+      case BinaryOp::Add: return Quick::AddNumNum;
+      case BinaryOp::Sub: return Quick::SubNumNum;
+      case BinaryOp::Mul: return Quick::MulNumNum;
+      case BinaryOp::Div: return Quick::DivNumNum;
+      case BinaryOp::Eq:  return Quick::EqNumNum;
+      case BinaryOp::Ne:  return Quick::NeNumNum;
+      case BinaryOp::Lt:  return Quick::LtNumNum;
+      case BinaryOp::Le:  return Quick::LeNumNum;
+      case BinaryOp::Gt:  return Quick::GtNumNum;
+      case BinaryOp::Ge:  return Quick::GeNumNum;
+      default: break;
+    }
+  }
+  if (op == BinaryOp::Add && is_string(l)) return Quick::AddStrAny;
+  return Quick::Generic;
+}
+
+static const char* quick_name(Quick q){
+  switch (q) {
+    case Quick::Cold:       return "Cold";
+    case Quick::Generic:    return "Generic";
+    case Quick::Deopt:      return "Deopt";
+    case Quick::AddNumNum:  return "AddNumNum";
+    case Quick::SubNumNum:  return "SubNumNum";
+    case Quick::MulNumNum:  return "MulNumNum";
+    case Quick::DivNumNum:  return "DivNumNum";
+    case Quick::EqNumNum:   return "EqNumNum";
+    case Quick::NeNumNum:   return "NeNumNum";
+    case Quick::LtNumNum:   return "LtNumNum";
+    case Quick::LeNumNum:   return "LeNumNum";
+    case Quick::GtNumNum:   return "GtNumNum";
+    case Quick::GeNumNum:   return "GeNumNum";
+    case Quick::AddStrAny:  return "AddStrAny";
+    case Quick::LocalSlot:  return "LocalSlot";
+    case Quick::GlobalSlot: return "GlobalSlot";
+  }
+  return "?";
+}
+
+void report_quickening(const Program& p, std::ostream& out){
+  size_t counts[static_cast<size_t>(Quick::GlobalSlot) + 1] {};
+  for (const Expr& e : p.exprs) {
+    if (auto* b = std::get_if<Binary>(&e.node)) ++counts[static_cast<size_t>(b->quick)];
+    else if (auto* v = std::get_if<Variable>(&e.node)) ++counts[static_cast<size_t>(v->quick)];
+  }
+  size_t deopt = counts[static_cast<size_t>(Quick::Deopt)], specialized = deopt;
+  for (size_t q = static_cast<size_t>(Quick::AddNumNum); q < std::size(counts); ++q) specialized += counts[q];
+  out << "quick: " << specialized << " nodes specialized, " << deopt << " deoptimized since, "
+      << counts[static_cast<size_t>(Quick::Generic)] << " generic\n";
+  for (size_t q = static_cast<size_t>(Quick::AddNumNum); q < std::size(counts); ++q)
+    if (counts[q]) out << "  " << std::left << std::setw(12) << quick_name(static_cast<Quick>(q)) << std::right << counts[q] << "\n";
+}
+
+// For --stats: whether this evaluation passes its node's guard, takes
+// binary_op's generic path, or misses the guard and deopts the node.
+static void count_binary(Quick q, bool nums, const Value& l){
+  RunCounters& c = run_counters();
+  ++c.type_checks;
+  switch (q) {
+    case Quick::Cold: case Quick::Deopt: case Quick::Generic: ++c.generic_ops; return;
+    case Quick::AddStrAny: ++(is_string(l) ? c.specialized_ops : c.deopts); return;
+    default: ++(nums ? c.specialized_ops : c.deopts); return;
+  }
+}
+
+static Value eval_binary(const Binary& b, ExprId id, const Env& env){
+  Value ltmp, rtmp;
+  if (b.op == BinaryOp::LOr)  { if (truthy(eval_borrow(b.left, env, ltmp))) return true;  return truthy(eval_borrow(b.right, env, rtmp)); }
+  if (b.op == BinaryOp::LAnd) { if (!truthy(eval_borrow(b.left, env, ltmp))) return false; return truthy(eval_borrow(b.right, env, rtmp)); }
+
+  // The left operand may only be borrowed when evaluating the right one
+  // cannot reassign it or move the slot stack.
+  const Value& l = is_leaf(b.right, env) ? eval_borrow(b.left, env, ltmp) : (ltmp = eval_node(b.left, env));
+  const Value& r = eval_borrow(b.right, env, rtmp);
+
+  // A specialized node only checks its guard: no array test, no search
+  // through binary_op's cases for the operand types.
+  bool nums = is_number(l) && is_number(r);
+  if (counting) count_binary(b.quick, nums, l);
+  switch (b.quick) {
+    case Quick::AddNumNum: if (nums) return as_number(l) + as_number(r); break;
+    case Quick::SubNumNum: if (nums) return as_number(l) - as_number(r); break;
+    case Quick::MulNumNum: if (nums) return as_number(l) * as_number(r); break;
+    case Quick::DivNumNum:
+      // Division by zero is binary_op's error to report, not a type miss.
+      if (nums) return as_number(r) != 0.0 ? Value(as_number(l) / as_number(r)) : binary_op(b.op, l, r);
+      break;
+    case Quick::EqNumNum:  if (nums) return as_number(l) == as_number(r); break;
+    case Quick::NeNumNum:  if (nums) return as_number(l) != as_number(r); break;
+    case Quick::LtNumNum:  if (nums) return as_number(l) <  as_number(r); break;
+    case Quick::LeNumNum:  if (nums) return as_number(l) <= as_number(r); break;
+    case Quick::GtNumNum:  if (nums) return as_number(l) >  as_number(r); break;
+    case Quick::GeNumNum:  if (nums) return as_number(l) >= as_number(r); break;
+    case Quick::AddStrAny:
+      if (is_string(l)) {
+        MemSite site(id);
+        return Value::concat(l, is_string(r) ? as_string(r) : to_string_value(r));
+      }
+      break;
+    case Quick::Cold: {
+      MemSite site(id);
+      quicken(b, specialize(b.op, l, r));
+      return binary_op(b.op, l, r);
+    }
+    default: {
+      MemSite site(id);
+      return binary_op(b.op, l, r);
+    }
+  }
+  quicken(b, Quick::Deopt);
+  MemSite site(id);
+  return binary_op(b.op, l, r);
+}
+
+// Resolved references quicken to a direct slot read; Dynamic ones depend on
+// which frames are live and stay generic.
+static const VarCell& read_variable(const Variable& v, Env& env){
+  switch (v.quick) {
+    case Quick::LocalSlot:
+      if (counting) ++run_counters().local_reads;
+      return env.local(v.ref.slot);
+    case Quick::GlobalSlot:
+      if (const VarCell& c = env.global(v.ref.slot); c.name != kNoSymbol) {
+        if (counting) ++run_counters().global_reads;
+        return c;
+      }
+      break;
+    case Quick::Cold:
+      if (threads_active) break;
+      v.quick = v.ref.kind == RefKind::Local ? Quick::LocalSlot
+              : v.ref.kind == RefKind::Global ? Quick::GlobalSlot : Quick::Generic;
+      break;
+    default: break;
+  }
+  const VarCell* c = env.lookup(v.name, v.ref);
+  if (!c) throw std::runtime_error("runtime error: undefined variable '" + symbol_name(v.name) + "'");
+  return *c;
+}
+
+static Value eval_variable(const Variable& v, Env& env){ return read_variable(v, env).val; }
+
+// Variables and literals are read in place; anything else is evaluated into
+// `tmp`. A borrowed value is good until the next evaluation or assignment.
+static const Value& eval_borrow(ExprId id, const Env& env_ro, Value& tmp){
   Env& env = const_cast<Env&>(env_ro);
+  const auto& n = env.program()[id].node;
+  if (auto* v = std::get_if<Variable>(&n)) {
+    if (counting) ++run_counters().exprs[n.index()];
+    return read_variable(*v, env).val;
+  }
+  if (auto* s = std::get_if<StringLit>(&n)) {
+    if (counting) ++run_counters().exprs[n.index()];
+    return env.program().strings[s->id];
+  }
+  return tmp = eval_node(id, env);
+}
+
+std::string immutable_error(const VarCell& c, const char* what) {
+  if (c.shared)
+    return std::string("runtime error: cannot ") + what + " '" + symbol_name(c.name) + "' from parallel code";
+  return std::string("runtime error: cannot ") + what + " immutable 'let " + symbol_name(c.name) + "'";
+}
+
+static void assign_variable(const Assign& a, Env& env, Value v){
+  VarCell* c = env.lookup(a.name, a.ref);
+  if (!c) throw std::runtime_error("runtime error: assignment to undefined variable '" + symbol_name(a.name) + "'");
+  if (!c->mut) throw std::runtime_error(immutable_error(*c, "assign to"));
+  c->val = std::move(v);
+}
+
+// Unbinds a scope's slots however the scope is left (fallthrough, return or
+// a runtime error unwinding to the REPL).
+struct ScopeExit {
+  Env& env; uint32_t begin, end;
+  ~ScopeExit() { env.clear(begin, end); }
+};
+
+static Value eval_node(ExprId id, const Env& env_ro){
+  Env& env = const_cast<Env&>(env_ro);
+  if (counting) ++run_counters().exprs[env.program()[id].node.index()];
   return std::visit([&](auto const& node) -> Value {
     using T = std::decay_t<decltype(node)>;
     if constexpr (std::is_same_v<T, NumberLit>) return eval_number(node);
     else if constexpr (std::is_same_v<T, BoolLit>) return eval_bool(node);
-    else if constexpr (std::is_same_v<T, StringLit>) return eval_string(node);
-    else if constexpr (std::is_same_v<T, ArrayLit>) return eval_array(node, env);
+    else if constexpr (std::is_same_v<T, StringLit>) return eval_string(node, env);
+    else if constexpr (std::is_same_v<T, ArrayLit>) { MemSite site(id); return eval_array(node, env); }
     else if constexpr (std::is_same_v<T, Grouping>)  return eval_group(node, env);
     else if constexpr (std::is_same_v<T, Unary>)     return eval_unary(node, env);
-    else if constexpr (std::is_same_v<T, Binary>)    return eval_binary(node, env);
+    else if constexpr (std::is_same_v<T, Binary>)    return eval_binary(node, id, env);
     else if constexpr (std::is_same_v<T, Variable>)  return eval_variable(node, env);
-    else if constexpr (std::is_same_v<T, Call>)      return eval_call(node, env);
+    else if constexpr (std::is_same_v<T, Call>)      { MemSite site(id); return eval_call(node, env); }
     else { static_assert(always_false_v<T>, "Unhandled Expr node"); return {}; }
-  }, e.node);
+  }, env.program()[id].node);
 }
 
-Value eval_expr(const Expr& e, const Env& env) { return eval_node(e, env); }
+Value eval_expr(ExprId e, const Env& env) { return eval_node(e, env); }
 
 // ========== Stmts ==========
-std::optional<Value> exec_stmt(const Stmt& s, Env& env, bool* returned, Value* ret_val){
+std::optional<Value> exec_stmt(StmtId id, Env& env, bool* returned, Value* ret_val){
+  ProfileStmt running(id);
+  if (counting) ++run_counters().stmts[env.program()[id].node.index()];
   auto mark_return = [&](Value v){ if (returned) *returned = true; if (ret_val) *ret_val = std::move(v); };
 
   return std::visit([&](auto const& node) -> std::optional<Value> {
     using T = std::decay_t<decltype(node)>;
 
     if constexpr (std::is_same_v<T, Let>) {
-      Value v = eval_node(*node.init, env);
-      env.define_let(node.name, std::move(v));
+      Value v = eval_node(node.init, env);
+      env.define(node.slot, node.name, std::move(v), false);
       return std::nullopt;
 
     } else if constexpr (std::is_same_v<T, Var>) {
-      Value v = eval_node(*node.init, env);
-      env.define_var(node.name, std::move(v));
+      Value v = eval_node(node.init, env);
+      env.define(node.slot, node.name, std::move(v), true);
       return std::nullopt;
 
     } else if constexpr (std::is_same_v<T, Assign>) {
-      Value v = eval_node(*node.value, env);
-      env.assign(node.name, std::move(v));
+      Value v = eval_node(node.value, env);
+      assign_variable(node, env, std::move(v));
       return std::nullopt;
 
     } else if constexpr (std::is_same_v<T, ExprStmt>) {
-      return eval_node(*node.expr, env);
+      return eval_node(node.expr, env);
 
     } else if constexpr (std::is_same_v<T, Print>) {
-      Value v = eval_node(*node.expr, env);
-      std::cout << to_string_value(v) << "\n";
+      Value tmp;
+      *env.out << to_string_value(eval_borrow(node.expr, env, tmp)) << "\n";
       return std::nullopt;
 
     } else if constexpr (std::is_same_v<T, Block>) {
-      env.push();
+      ScopeExit scope{env, node.slot_begin, node.slot_end};
       std::optional<Value> last;
-      for (auto const& st : node.stmts) {
+      for (StmtId st : env.program()[node.stmts]) {
         bool ret = false; Value rv{};
-        last = exec_stmt(*st, env, &ret, &rv);
-        if (ret) { env.pop(); mark_return(std::move(rv)); return std::nullopt; }
+        last = exec_stmt(st, env, &ret, &rv);
+        if (ret) { mark_return(std::move(rv)); return std::nullopt; }
       }
-      env.pop();
       return last;
 
     } else if constexpr (std::is_same_v<T, If>) {
-      Value c = eval_node(*node.cond, env);
-      return exec_stmt(truthy(c) ? *node.then_br : *node.else_br, env, returned, ret_val);
+      Value tmp;
+      bool c = truthy(eval_borrow(node.cond, env, tmp));
+      return exec_stmt(c ? node.then_br : node.else_br, env, returned, ret_val);
 
     } else if constexpr (std::is_same_v<T, While>) {
       std::optional<Value> last;
-      while (truthy(eval_node(*node.cond, env))) {
+      Value tmp;
+      while (truthy(eval_borrow(node.cond, env, tmp))) {
+        TraceSpan traced(tracing_stmts, TraceKind::Loop, static_cast<uint32_t>(id));
         bool ret = false; Value rv{};
-        last = exec_stmt(*node.body, env, &ret, &rv);
+        last = exec_stmt(node.body, env, &ret, &rv);
         if (ret) { mark_return(std::move(rv)); return std::nullopt; }
       }
       return last;
 
     } else if constexpr (std::is_same_v<T, ForC>) {
-      env.push();
-      if (node.init) (void)exec_stmt(*node.init, env);
+      ScopeExit scope{env, node.slot_begin, node.slot_end};
+      if (node.init != kNoStmt) (void)exec_stmt(node.init, env);
       std::optional<Value> last;
-      while (!node.cond || truthy(eval_node(*node.cond, env))) {
+      Value tmp;
+      while (node.cond == kNoExpr || truthy(eval_borrow(node.cond, env, tmp))) {
+        TraceSpan traced(tracing_stmts, TraceKind::Loop, static_cast<uint32_t>(id));
         bool ret = false; Value rv{};
-        last = exec_stmt(*node.body, env, &ret, &rv);
-        if (ret) { env.pop(); mark_return(std::move(rv)); return std::nullopt; }
-        if (node.step) {
+        last = exec_stmt(node.body, env, &ret, &rv);
+        if (ret) { mark_return(std::move(rv)); return std::nullopt; }
+        if (node.step != kNoStmt) {
           bool sret = false; Value srv{};
-          (void)exec_stmt(*node.step, env, &sret, &srv);
-          if (sret) { env.pop(); mark_return(std::move(srv)); return std::nullopt; }
+          (void)exec_stmt(node.step, env, &sret, &srv);
+          if (sret) { mark_return(std::move(srv)); return std::nullopt; }
         }
       }
-      env.pop();
       return last;
 
     } else if constexpr (std::is_same_v<T, ForIn>) {
-      Value iter = eval_node(*node.iterable, env);
+      // `iter` keeps the Array shared for the whole loop, so a body that
+      // writes to the variable gets its own copy and leaves this one intact.
+      Value iter = eval_node(node.iterable, env);
+      if (node.parallel) {
+        parallel_for_in(node, iter, env);
+        return std::nullopt;
+      }
       if (is_array(iter)) {
         auto arr = as_array(iter);
         for (auto& v : arr->items) {
-          env.push();
-          env.define_var(node.var, v);
+          TraceSpan traced(tracing_stmts, TraceKind::Loop, static_cast<uint32_t>(id));
+          ScopeExit scope{env, node.slot, node.slot_end};
+          env.define(node.slot, node.var, v, true);
           bool ret = false; Value rv{};
-          (void)exec_stmt(*node.body, env, &ret, &rv);
-          env.pop();
+          (void)exec_stmt(node.body, env, &ret, &rv);
           if (ret) { mark_return(std::move(rv)); return std::nullopt; }
         }
         return std::nullopt;
       } else if (is_string(iter)) {
-        const auto& s = as_string(iter);
-        for (char ch : s) {
-          env.push();
-          env.define_var(node.var, std::string(1, ch));
+        // Re-read the view each step: the body may append to the shared buffer.
+        for (size_t i = 0; i < as_string(iter).size(); ++i) {
+          TraceSpan traced(tracing_stmts, TraceKind::Loop, static_cast<uint32_t>(id));
+          ScopeExit scope{env, node.slot, node.slot_end};
+          env.define(node.slot, node.var, Value::character(static_cast<unsigned char>(as_string(iter)[i])), true);
           bool ret = false; Value rv{};
-          (void)exec_stmt(*node.body, env, &ret, &rv);
-          env.pop();
+          (void)exec_stmt(node.body, env, &ret, &rv);
           if (ret) { mark_return(std::move(rv)); return std::nullopt; }
         }
         return std::nullopt;
@@ -271,11 +592,23 @@ std::optional<Value> exec_stmt(const Stmt& s, Env& env, bool* returned, Value* r
       throw std::runtime_error("type error: for-in expects array or string");
 
     } else if constexpr (std::is_same_v<T, FnDecl>) {
-      env.define_fn(&node);
+      env.define_fn(id);
       return std::nullopt;
 
     } else if constexpr (std::is_same_v<T, Return>) {
-      Value v = eval_node(*node.value, env);
+      if (node.tail) {
+        // Only stage the arguments; eval_call rebinds its frame once this
+        // function's scopes have unwound.
+        const Call& c = std::get<Call>(env.program()[node.value].node);
+        const FnDecl* fn = callee(c, env);
+        size_t args = env.open_frame(fn->params.size);
+        try { bind_args(c, *fn, env, args); }
+        catch (...) { env.drop_frame(args); throw; }
+        env.tail = Env::TailCall{fn, args, env.fn_decl(c.callee)};
+        mark_return(Value{});
+        return std::nullopt;
+      }
+      Value v = eval_node(node.value, env);
       mark_return(std::move(v));
       return std::nullopt;
 
@@ -283,36 +616,233 @@ std::optional<Value> exec_stmt(const Stmt& s, Env& env, bool* returned, Value* r
       static_assert(always_false_v<T>, "Unhandled Stmt node");
       return std::nullopt;
     }
-  }, s.node);
+  }, env.program()[id].node);
 }
 
 std::optional<Value> exec_program(const Program& p, Env& env) {
   std::optional<Value> last;
-  for (auto const& s : p) {
+  for (StmtId s : p.body) {
+    TraceSpan traced(tracing_stmts, TraceKind::Stmt, static_cast<uint32_t>(s));
     bool ret = false; Value rv{};
-    last = exec_stmt(*s, env, &ret, &rv);
+    last = exec_stmt(s, env, &ret, &rv);
     if (ret) return rv;
   }
   return last;
 }
 
+// ========== parallel for ==========
+void run_parallel(Env& env, size_t tasks, const ParallelTask& task) {
+  ThreadPool& pool = ThreadPool::instance();
+  std::vector<std::optional<Env>> envs(pool.size());      // per worker, forked on first use
+  std::vector<std::string> output(tasks);
+  std::vector<std::exception_ptr> errors(tasks);
+  std::atomic<size_t> failed {SIZE_MAX};                   // first failing task so far
+
+  bool nested = threads_active;
+  if (!nested) threads_active = pool.size() > 1 && tasks > 1;
+  const ProfileCall* calls = profile_thread.top.load(std::memory_order_relaxed);
+  StmtId loop = profile_thread.stmt.load(std::memory_order_relaxed);
+  pool.run(tasks, [&](size_t w, size_t t) {
+    // Run one after another, the tasks would have stopped before this one.
+    if (t > failed.load(std::memory_order_relaxed)) return;
+    ProfileTask on_behalf(calls, loop);
+    if (!envs[w]) envs[w].emplace(env.fork());
+    Env& e = *envs[w];
+    std::ostringstream os;
+    e.out = &os;
+    try {
+      task(e, w, t);
+    } catch (...) {
+      envs[w].reset();
+      errors[t] = std::current_exception();
+      size_t f = failed.load();
+      while (t < f && !failed.compare_exchange_weak(f, t)) {}
+    }
+    output[t] = os.str();
+  });
+  if (!nested) threads_active = false;
+
+  size_t f = failed.load();
+  for (size_t t = 0; t < tasks && t <= f; ++t) *env.out << output[t];
+  if (f != SIZE_MAX) std::rethrow_exception(errors[f]);
+}
+
+void parallel_for_in(const ForIn& loop, const Value& iter, Env& env, const LoopBody* body) {
+  if (!is_array(iter) && !is_string(iter)) throw std::runtime_error("type error: for-in expects array or string");
+  size_t n = is_array(iter) ? as_array(iter)->items.size() : as_string(iter).size();
+  if (n == 0) return;
+
+  // Sixteen blocks per worker even out iterations of uneven cost.
+  size_t workers = ThreadPool::instance().size();
+  size_t grain = (n + workers * 16 - 1) / (workers * 16);
+  run_parallel(env, (n + grain - 1) / grain, [&](Env& e, size_t w, size_t b) {
+    for (size_t i = b * grain, end = std::min(n, i + grain); i < end; ++i) {
+      ScopeExit scope{e, loop.slot, loop.slot_end};
+      Value item = is_array(iter) ? as_array(iter)->items[i]
+                                  : Value::character(static_cast<unsigned char>(as_string(iter)[i]));
+      e.define(loop.slot, loop.var, std::move(item), true);
+      if (body) (*body)(e, w);
+      else (void)exec_stmt(loop.body, e);
+    }
+  });
+}
+
 // ========== Calls ==========
-static Value eval_call(const Call& c, Env& env) {
+struct CallFrame {
+  Env& env; size_t base; bool entered = false;
+  ~CallFrame() { if (entered) env.leave_frame(); else env.drop_frame(base); }
+};
+
+static const FnDecl* callee(const Call& c, const Env& env) {
   const FnDecl* fn = env.get_fn(c.callee);
-  if (!fn) throw std::runtime_error("runtime error: undefined function '" + c.callee + "'");
-  if (c.args.size() != fn->params.size())
-    throw std::runtime_error("runtime error: function '" + c.callee + "' arity mismatch");
-
-  env.push();
-  for (size_t i = 0; i < c.args.size(); ++i) {
-    Value v = eval_node(*c.args[i], env);
-    env.define_var(fn->params[i], std::move(v));
+  if (!fn) throw std::runtime_error("runtime error: undefined function '" + symbol_name(c.callee) + "'");
+  if (c.args.size != fn->params.size)
+    throw std::runtime_error("runtime error: function '" + symbol_name(c.callee) + "' arity mismatch");
+  return fn;
+}
+
+// Arguments are evaluated in the caller's frame, straight into the callee's
+// parameter slots starting at `base`.
+static void bind_args(const Call& c, const FnDecl& fn, Env& env, size_t base) {
+  const Program& prog = env.program();
+  auto args = prog[c.args];
+  auto params = prog[fn.params];
+  for (size_t i = 0; i < args.size(); ++i) {
+    Value v = eval_node(args[i], env);
+    env.cell(base + i) = VarCell{std::move(v), params[i], true};
+  }
+}
+
+// Runs fn, its parameters already bound in the frame reserved at frame.base.
+static Value run_call(const FnDecl* fn, Symbol name, CallFrame& frame, Env& env) {
+  TraceSpan traced(tracing, TraceKind::Call, static_cast<uint32_t>(env.fn_decl(name)), fn->params.size);
+  if (counting) ++run_counters().calls;
+  StmtId memo_id = kNoStmt;
+  std::vector<Value> memo_args;
+  if (fn->memo) {
+    memo_id = env.fn_decl(name);
+    for (size_t i = 0; i < fn->params.size; ++i) memo_args.push_back(env.cell(frame.base + i).val);
+    if (const Value* hit = env.memo.find(memo_id, memo_args.data(), memo_args.size())) {
+      if (counting) ++run_counters().memo_hits;
+      return *hit;
+    }
+  }
+  ProfileScope in_call(env.fn_decl(name));
+
+  Value compiled;
+  const VarCell* params = fn->params.size ? &env.cell(frame.base) : nullptr;
+  if (env.jit && env.jit->call(env.fn_decl(name), *fn, params, env, compiled)) {
+    if (counting) ++run_counters().compiled_calls;
+    if (memo_id != kNoStmt) env.memo.insert(memo_id, std::move(memo_args), compiled);
+    return compiled;
+  }
+
+  env.enter_frame(frame.base, fn->frame_size);
+  frame.entered = true;
+
+  // A tail call in the body hands back the next function to run in this
+  // same frame, so tail recursion neither grows the slot stack nor recurses.
+  for (;;) {
+    bool ret = false; Value rv{};
+    exec_stmt(fn->body, env, &ret, &rv);
+    if (!env.tail.fn) {
+      Value result = ret ? rv : Value(0.0);
+      if (memo_id != kNoStmt) env.memo.insert(memo_id, std::move(memo_args), result);
+      return result;
+    }
+    fn = env.tail.fn;
+    in_call.retarget(env.tail.decl);
+    traced.retarget(static_cast<uint32_t>(env.tail.decl), fn->params.size);
+    if (counting) ++run_counters().calls;
+    env.replace_frame(env.tail.args, fn->params.size, fn->frame_size);
+    env.tail = {};
+  }
+}
+
+namespace {
+
+// Natives call back into the tree walker through this.
+class EvalCaller final : public Caller {
+public:
+  explicit EvalCaller(Env& e) : env(e) {}
+
+  Value call(const Value& fn, Value* args, uint32_t argc) override {
+    if (!is_string(fn)) throw std::runtime_error("type error: expected a function name");
+    // Natives call the same function over and over: look its name up once.
+    if (as_string(fn) != name) {
+      name = as_string(fn);
+      sym = find_symbol(name);
+      decl = sym != kNoSymbol ? env.get_fn(sym) : nullptr;
+      nat = sym != kNoSymbol && !decl ? find_native(sym) : kNoNative;
+    }
+    if (!decl && nat == kNoNative) throw std::runtime_error("runtime error: undefined function '" + std::string(as_string(fn)) + "'");
+    uint32_t arity = decl ? decl->params.size : native(nat).arity;
+    if (argc != arity) throw std::runtime_error("runtime error: function '" + symbol_name(sym) + "' arity mismatch");
+    if (!decl) {
+      if (counting) ++run_counters().native_calls;
+      Value argv[kMaxNativeArity];
+      for (uint32_t i = 0; i < argc; ++i) argv[i] = args[i];
+      return native(nat).call(argv, *this);
+    }
+    CallFrame frame{env, env.open_frame(decl->frame_size)};
+    auto params = env.program()[decl->params];
+    for (uint32_t i = 0; i < argc; ++i) env.cell(frame.base + i) = VarCell{args[i], params[i], true};
+    return run_call(decl, sym, frame, env);
   }
-  bool ret = false; Value rv{};
-  exec_stmt(*fn->body, env, &ret, &rv);
-  env.pop();
-  if (!ret) return 0.0;
-  return rv;
+
+  void parallel(size_t tasks, const std::function<void(Caller&, size_t)>& body) override {
+    run_parallel(env, tasks, [&](Env& e, size_t, size_t t) {
+      EvalCaller c(e);
+      body(c, t);
+    });
+  }
+
+private:
+  Env& env;
+  std::string name;
+  Symbol sym {kNoSymbol};
+  const FnDecl* decl {};
+  uint32_t nat {kNoNative};
+};
+
 }
 
-}
\ No newline at end of file
+// Natives take their arguments from a buffer on the C++ stack: no frame is
+// reserved and nothing is bound by name.
+static Value call_native(const Call& c, Env& env) {
+  const Native& n = native(c.native);
+  if (c.args.size != n.arity)
+    throw std::runtime_error("runtime error: function '" + symbol_name(c.callee) + "' arity mismatch");
+  TraceSpan traced(tracing, TraceKind::Native, c.native, c.args.size);
+  if (counting) ++run_counters().native_calls;
+  auto args = env.program()[c.args];
+  Value argv[kMaxNativeArity];
+  EvalCaller caller(env);
+  const Variable* target = (n.flags & kNativeInPlace) ? std::get_if<Variable>(&env.program()[args[0]].node) : nullptr;
+  for (size_t i = target ? 1 : 0; i < args.size(); ++i) argv[i] = eval_node(args[i], env);
+  if (!target) return n.call(argv, caller);
+
+  // The variable's value is moved into argv[0] for the call, so an array
+  // nobody else holds is updated without a copy, and moved back however the
+  // call ends.
+  VarCell* cell = env.lookup(target->name, target->ref);
+  if (!cell) throw std::runtime_error("runtime error: undefined variable '" + symbol_name(target->name) + "'");
+  if (!cell->mut) throw std::runtime_error(immutable_error(*cell, "modify"));
+  struct Restore {
+    VarCell& cell; Value& arg;
+    ~Restore() { cell.val = std::move(arg); }
+  };
+  argv[0] = std::move(cell->val);
+  Restore restore{*cell, argv[0]};
+  return n.call(argv, caller);
+}
+
+static Value eval_call(const Call& c, Env& env) {
+  if (c.native != kNoNative) return call_native(c, env);
+  const FnDecl* fn = callee(c, env);
+  CallFrame frame{env, env.open_frame(fn->frame_size)};
+  bind_args(c, *fn, env, frame.base);
+  return run_call(fn, c.callee, frame, env);
+}
+
+}
@@ -1,71 +1,142 @@
 #pragma once
+#include <functional>
+#include <iostream>
 #include <optional>
 #include <string>
-#include <unordered_map>
-#include <variant>
 #include <vector>
-#include <memory>
+#include "heap.hpp"
+#include "memo.hpp"
 #include "rivet/ast.hpp"
+#include "rivet/value.hpp"
 
 namespace rivet {
 
+class Jit;
 
-struct Array;
-
-
-using Value = std::variant<double, bool, std::string, std::shared_ptr<Array>>;
-
-
-struct Array { std::vector<Value> items; };
-
-// --- helpers ---
-inline bool is_number(const Value& v){ return std::holds_alternative<double>(v); }
-inline bool is_bool  (const Value& v){ return std::holds_alternative<bool>(v); }
-inline bool is_string(const Value& v){ return std::holds_alternative<std::string>(v); }
-inline bool is_array (const Value& v){ return std::holds_alternative<std::shared_ptr<Array>>(v); }
-
-inline double as_number(const Value& v){ return std::get<double>(v); }
-inline bool as_bool(const Value& v){ return std::get<bool>(v); }
-inline const std::string& as_string(const Value& v){ return std::get<std::string>(v); }
-inline std::shared_ptr<Array> as_array(const Value& v){ return std::get<std::shared_ptr<Array>>(v); }
-
-inline bool truthy(const Value& v) {
-  if (is_bool(v))   return as_bool(v);
-  if (is_number(v)) return as_number(v) != 0.0;
-  if (is_string(v)) return !as_string(v).empty();
-  if (is_array(v))  return !as_array(v)->items.empty();
-  return false;
-}
-
-struct VarCell { Value val{}; bool mut{}; };
+// A cell whose name is kNoSymbol is not currently bound. `shared` marks a
+// parallel for worker's read-only view of a variable from outside the loop.
+struct VarCell { Value val{}; Symbol name{kNoSymbol}; bool mut{}; bool shared{}; };
 
+// Variables live in flat frames laid out back to back in one slot stack: the
+// main program's frame first, then one frame per active call. Slot numbers
+// come from the resolver, so reads and writes are plain indexed accesses and
+// leaving a scope only unbinds its slots.
 class Env {
 public:
-  void push();
-  void pop();
-
-  void define_let(const std::string& name, Value v);
-  void define_var(const std::string& name, Value v);
-  void assign(const std::string& name, Value v);
-  bool  get(const std::string& name, Value& out) const;
-
-  void define_fn(const FnDecl* fn);
-  const FnDecl* get_fn(const std::string& name) const;
+  // The program whose nodes the tree walker evaluates. The REPL keeps
+  // appending to it, so functions are remembered by id rather than address.
+  explicit Env(const Program& prog);
+
+  const Program& program() const { return prog; }
+
+  // A parallel for worker's environment: a copy of every frame, with all
+  // variables bound so far made read-only, and a result cache of its own.
+  Env fork() const;
+
+  // Grows the main program's frame; only valid while no call is active.
+  void ensure_main(uint32_t size);
+
+  // Reserves a callee frame above everything live. The caller's frame stays
+  // current until enter_frame, so arguments are evaluated in the caller.
+  size_t open_frame(uint32_t size);
+  void   drop_frame(size_t base);
+  void   enter_frame(size_t base, uint32_t size);
+  void   leave_frame();
+  // Tail call: the current frame becomes a `size`-slot frame whose first
+  // `argc` slots take the arguments staged at `args` by open_frame.
+  void   replace_frame(size_t args, uint32_t argc, uint32_t size);
+
+  VarCell& local(uint32_t slot)  { return cells[base + slot]; }
+  VarCell& global(uint32_t slot) { return cells[slot]; }
+  VarCell& cell(size_t index)    { return cells[index]; }
+
+  void define(uint32_t slot, Symbol name, Value v, bool mut);
+  void clear(uint32_t begin, uint32_t end);
+
+  // Innermost bound cell for `name` in the current frame, then its callers.
+  VarCell* find(Symbol name);
+  // The cell a resolved reference denotes, or null when it is unbound.
+  VarCell* lookup(Symbol name, VarRef ref);
+
+  // Set when a tail `return f(...)` unwinds: the innermost call loops into f
+  // with the arguments staged at `args` instead of returning.
+  struct TailCall { const FnDecl* fn {}; size_t args {}; StmtId decl {kNoStmt}; };
+  TailCall tail;
+
+  MemoCache memo;                     // results of FnDecl::memo functions
+  std::ostream* out {&std::cout};     // where print writes
+  Jit* jit {};                        // compiles hot functions (--jit); never forked
+
+  void define_fn(StmtId fn);
+  StmtId fn_decl(Symbol name) const { return name < fns.size() ? fns[name] : kNoStmt; }
+  const FnDecl* get_fn(Symbol name) const {
+    return name < fns.size() && fns[name] != kNoStmt ? std::get_if<FnDecl>(&prog[fns[name]].node) : nullptr;
+  }
 
 private:
-  std::vector<std::unordered_map<std::string, VarCell>> scopes;
-  std::unordered_map<std::string, const FnDecl*> fns;
+  struct Frame { size_t base; size_t size; };
+  // Charges the slot stack and frame records to --mem-stats once they grew.
+  void recharge() {
+    if (!mem_tracking) return;
+    cells_mem.set(cells.capacity() * sizeof(VarCell));
+    frames_mem.set(frames.capacity() * sizeof(Frame));
+  }
+
+  std::vector<VarCell> cells;
+  std::vector<Frame>   frames;
+  MemCharge<MemKind::Slots>  cells_mem;
+  MemCharge<MemKind::Frames> frames_mem;
+  size_t base {0};
+  const Program& prog;
+  std::vector<StmtId> fns;            // indexed by Symbol
 };
 
 
-Value eval_expr(const Expr& e, const Env& env);
+std::string to_string_value(const Value& v);
+// The error for writing a VarCell that is not `mut`: a `let`, or a variable
+// from outside parallel code. `what` is "assign to" or "modify".
+std::string immutable_error(const VarCell& c, const char* what);
+bool equal_values(const Value& a, const Value& b);
+// Whether every item is a number; worked out once and cached in Array::shape.
+bool numeric(const Array& a);
+
+// Operator semantics shared by the tree walker and the bytecode VM.
+Value unary_op(UnaryOp op, const Value& r);
+Value binary_op(BinaryOp op, const Value& l, const Value& r);
 
 
-std::optional<Value> exec_stmt(const Stmt& s, Env& env,
+Value eval_expr(ExprId e, const Env& env);
+
+
+std::optional<Value> exec_stmt(StmtId s, Env& env,
                                bool* returned = nullptr,
                                Value* ret_val = nullptr);
 
 
 std::optional<Value> exec_program(const Program& p, Env& env);
 
+// Counts the Binary and Variable nodes of p the tree walker has specialized
+// (see Quick in rivet/ast.hpp), by kind, and how many of them fell back.
+void report_quickening(const Program& p, std::ostream& out);
+
+// Runs task(env, worker, i) for every i in [0, tasks) on the thread pool
+// (src/pool.hpp). Each worker runs its tasks in its own forked Env, forked
+// afresh after a task throws, and buffers what they print; the buffers are
+// written out in task order, so the output is exactly that of running the
+// tasks one after another. Assigning to a variable from outside is a runtime
+// error. When a task fails, the tasks after it are skipped, the output up to
+// it is written, and its error rethrown.
+using ParallelTask = std::function<void(Env& env, size_t worker, size_t task)>;
+void run_parallel(Env& env, size_t tasks, const ParallelTask& task);
+
+// Runs the body of `parallel for var in iter` once per element, as
+// run_parallel tasks over blocks of consecutive elements.
+//
+// `body`, when given, runs one iteration (the loop variable already bound)
+// in place of exec_stmt(loop.body): the VM passes its compiled body. It is
+// called with the worker's Env and index; after it throws, that worker's Env
+// is forked afresh.
+using LoopBody = std::function<void(Env& env, size_t worker)>;
+void parallel_for_in(const ForIn& loop, const Value& iter, Env& env, const LoopBody* body = nullptr);
+
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "heap.hpp"
+#include "rivet/value.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+// Under AddressSanitizer every block goes to operator new instead, so that
+// use after free is still caught.
+#if defined(__SANITIZE_ADDRESS__)
+#define RIVET_HEAP_PASSTHROUGH 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define RIVET_HEAP_PASSTHROUGH 1
+#endif
+#endif
+#ifndef RIVET_HEAP_PASSTHROUGH
+#define RIVET_HEAP_PASSTHROUGH 0
+#endif
+
+namespace rivet {
+
+namespace {
+
+constexpr size_t kGrain = 16;
+constexpr size_t kClasses = 8;                  // blocks of 16, 32, ..., 128 bytes
+constexpr size_t kChunk = 64 * 1024;
+
+struct FreeBlock { FreeBlock* next; };
+
+// A thread's chunks and free blocks. Caches are never destroyed: a Value
+// may be released during static destruction, after its thread's cache
+// would otherwise be gone, and heap_stats reads them all.
+struct Cache {
+  FreeBlock* free[kClasses] {};
+  char* cur {};
+  char* end {};
+  char* chunks {};                              // each chunk's first word links the next
+  HeapStats stats;
+  std::unordered_map<uint32_t, MemCount> sites; // --mem-stats, by ExprId
+  Cache* next {};
+};
+
+std::mutex registry_m;
+Cache* registry = nullptr;
+thread_local Cache* local = nullptr;
+
+Cache& cache() {
+  if (!local) {
+    local = new Cache();
+    std::lock_guard<std::mutex> lk(registry_m);
+    local->next = registry;
+    registry = local;
+  }
+  return *local;
+}
+
+void refill(Cache& c) {
+  auto* chunk = static_cast<char*>(std::malloc(kChunk));
+  if (!chunk) throw std::bad_alloc();
+  std::memcpy(chunk, &c.chunks, sizeof c.chunks);
+  c.chunks = chunk;
+  c.cur = chunk + kGrain;
+  c.end = chunk + kChunk;
+  ++c.stats.chunks;
+}
+
+size_t size_class(size_t size) { return (size + kGrain - 1) / kGrain - 1; }
+
+struct Counter {
+  std::atomic<int64_t>  live {}, peak {};
+  std::atomic<uint64_t> allocations {}, bytes {};
+};
+Counter kinds[kMemKinds];
+std::atomic<int64_t> total_live {}, total_peak {};
+
+void raise(std::atomic<int64_t>& peak, int64_t now) {
+  int64_t p = peak.load(std::memory_order_relaxed);
+  while (now > p && !peak.compare_exchange_weak(p, now, std::memory_order_relaxed)) {}
+}
+
+}
+
+void* heap_allocate(size_t size) {
+  Cache& c = cache();
+  ++c.stats.allocated;
+  size_t k = size_class(size);
+  if (RIVET_HEAP_PASSTHROUGH || k >= kClasses) return ::operator new(size);
+  if (FreeBlock* b = c.free[k]) {
+    c.free[k] = b->next;
+    ++c.stats.recycled;
+    return b;
+  }
+  size_t n = (k + 1) * kGrain;
+  if (static_cast<size_t>(c.end - c.cur) < n) refill(c);
+  void* p = c.cur;
+  c.cur += n;
+  return p;
+}
+
+void heap_free(void* p, size_t size) {
+  Cache& c = cache();
+  ++c.stats.freed;
+  size_t k = size_class(size);
+  if (RIVET_HEAP_PASSTHROUGH || k >= kClasses) { ::operator delete(p); return; }
+  auto* b = static_cast<FreeBlock*>(p);
+  b->next = c.free[k];
+  c.free[k] = b;
+}
+
+void heap_record_release(uint64_t ns) {
+  HeapStats& s = cache().stats;
+  ++s.releases;
+  s.release_ns += ns;
+  s.longest_release_ns = std::max(s.longest_release_ns, ns);
+}
+
+HeapStats heap_stats() {
+  HeapStats total;
+  std::lock_guard<std::mutex> lk(registry_m);
+  for (const Cache* c = registry; c; c = c->next) {
+    total.chunks += c->stats.chunks;
+    total.allocated += c->stats.allocated;
+    total.recycled += c->stats.recycled;
+    total.freed += c->stats.freed;
+    total.releases += c->stats.releases;
+    total.release_ns += c->stats.release_ns;
+    total.longest_release_ns = std::max(total.longest_release_ns, c->stats.longest_release_ns);
+  }
+  return total;
+}
+
+void heap_report(std::ostream& out) {
+  HeapStats s = heap_stats();
+  double reused = s.allocated ? 100.0 * static_cast<double>(s.recycled) / static_cast<double>(s.allocated) : 0.0;
+  out << "gc: reference counted, no collection pauses; " << s.allocated - s.freed << " objects live at exit\n"
+      << "heap: " << s.chunks << " chunks (" << s.chunks * kChunk / 1024 << " KiB), "
+      << s.allocated << " objects allocated, " << std::fixed << std::setprecision(1) << reused
+      << "% in recycled blocks\n"
+      << "releases of arrays of " << kTimedRelease << "+ items: " << s.releases << ", "
+      << std::setprecision(3) << static_cast<double>(s.release_ns) / 1e6 << " ms in all, longest "
+      << static_cast<double>(s.longest_release_ns) / 1e6 << " ms\n";
+  out.unsetf(std::ios::floatfield);
+  out << std::setprecision(6);
+}
+
+void mem_charge(MemKind kind, int64_t bytes, uint64_t allocations) {
+  Counter& c = kinds[static_cast<size_t>(kind)];
+  int64_t live = c.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t all = total_live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  c.allocations.fetch_add(allocations, std::memory_order_relaxed);
+  if (bytes <= 0) return;
+  raise(c.peak, live);
+  raise(total_peak, all);
+  c.bytes.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed);
+  if (kind == MemKind::Ast || kind == MemKind::Slots || kind == MemKind::Frames) return;
+  MemCount& site = cache().sites[mem_site];
+  site.allocations += allocations;
+  site.bytes += static_cast<uint64_t>(bytes);
+}
+
+MemStats mem_stats() {
+  MemStats s;
+  for (size_t k = 0; k < kMemKinds; ++k) {
+    s.kinds[k].live = kinds[k].live.load(std::memory_order_relaxed);
+    s.kinds[k].peak = kinds[k].peak.load(std::memory_order_relaxed);
+    s.kinds[k].allocations = kinds[k].allocations.load(std::memory_order_relaxed);
+    s.kinds[k].bytes = kinds[k].bytes.load(std::memory_order_relaxed);
+  }
+  s.live = total_live.load(std::memory_order_relaxed);
+  s.peak = total_peak.load(std::memory_order_relaxed);
+  return s;
+}
+
+std::vector<std::pair<uint32_t, MemCount>> mem_sites() {
+  std::unordered_map<uint32_t, MemCount> total;
+  {
+    std::lock_guard<std::mutex> lk(registry_m);
+    for (const Cache* c = registry; c; c = c->next)
+      for (const auto& [site, n] : c->sites) {
+        total[site].allocations += n.allocations;
+        total[site].bytes += n.bytes;
+      }
+  }
+  return {total.begin(), total.end()};
+}
+
+void* Obj::operator new(size_t size) { return heap_allocate(size); }
+void Obj::operator delete(void* p, size_t size) { heap_free(p, size); }
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace rivet {
+
+// Where StrObj and Array headers live (see Obj in rivet/value.hpp). Blocks
+// come in 16-byte size classes; each thread bump-allocates from 64 KiB
+// chunks of its own and keeps the blocks freed on it in per-class free
+// lists, so the short-lived arrays and strings of a loop cycle through the
+// same few cache lines without a trip to malloc. Chunks are never handed
+// back: the heap's size is its high-water mark.
+//
+// Objects are still reclaimed by reference count, the moment the last Value
+// lets go: copy-on-write arrays and in-place string appends need the exact
+// count, and since an array is only ever written while unshared, no array
+// can come to contain itself, so there are no cycles to trace.
+void* heap_allocate(size_t size);
+void  heap_free(void* p, size_t size);
+
+struct HeapStats {
+  size_t   chunks {};               // 64 KiB each
+  uint64_t allocated {};            // blocks handed out, in all
+  uint64_t recycled {};             // ... of which were reused free blocks
+  uint64_t freed {};
+  uint64_t releases {};             // timed releases of large arrays
+  uint64_t release_ns {}, longest_release_ns {};
+};
+
+// Set by --gc-stats: time every release of an array with at least
+// kTimedRelease items, which is where freeing can pause the program.
+inline bool heap_timing = false;
+inline constexpr size_t kTimedRelease = 1024;
+void heap_record_release(uint64_t ns);
+
+// Totals over every thread that allocated. Call it while no other thread
+// allocates, e.g. once the program has finished.
+HeapStats heap_stats();
+void heap_report(std::ostream& out);
+
+// ========== Memory accounting (--mem-stats) ==========
+// While `mem_tracking` is set, whatever owns interpreter memory charges the
+// bytes it holds to a kind as it grows, and gives them back when it shrinks
+// or goes away:
+//   Ast          the Program's node, list and position tables
+//   Arrays       Array headers             ArrayItems   their `items` storage
+//   Strings      StrObj headers            StringBytes  string buffers
+//   Slots        Env variable slots        Frames       Env call frame records
+// Arrays and strings count what they were charged in the objects themselves
+// (Obj::charged), so those made before tracking began give nothing back.
+// What they add is also counted against `mem_site`.
+enum class MemKind : uint8_t { Ast, Arrays, ArrayItems, Strings, StringBytes, Slots, Frames };
+inline constexpr size_t kMemKinds = 7;
+inline bool mem_tracking = false;
+
+// The ExprId of the innermost array literal, binary operation or call being
+// evaluated on this thread (see MemSite in memstats.hpp); UINT32_MAX outside.
+inline thread_local uint32_t mem_site = UINT32_MAX;
+
+// Adds `bytes` (a negative count gives them back) and `allocations` to `kind`.
+void mem_charge(MemKind kind, int64_t bytes, uint64_t allocations);
+
+// Moves one owner's charge from `charged` to `now` bytes.
+inline void mem_recharge(MemKind kind, size_t& charged, size_t now) {
+  if (now == charged) return;
+  mem_charge(kind, static_cast<int64_t>(now) - static_cast<int64_t>(charged), now > charged);
+  charged = now;
+}
+
+// What a container member holds, charged to K and given back with its
+// owner. A copy starts out charged nothing: its owner recharges it.
+template<MemKind K> class MemCharge {
+public:
+  MemCharge() = default;
+  MemCharge(const MemCharge&) {}
+  MemCharge(MemCharge&& o) noexcept : bytes(o.bytes) { o.bytes = 0; }
+  MemCharge& operator=(const MemCharge&) = delete;
+  MemCharge& operator=(MemCharge&&) = delete;
+  ~MemCharge() { if (bytes) mem_charge(K, -static_cast<int64_t>(bytes), 0); }
+
+  void set(size_t now) { mem_recharge(K, bytes, now); }
+
+private:
+  size_t bytes {};
+};
+
+struct MemCount {
+  int64_t  live {}, peak {};
+  uint64_t allocations {}, bytes {};     // bytes: everything ever added
+};
+struct MemStats {
+  MemCount kinds[kMemKinds];
+  int64_t  live {}, peak {};             // all kinds together
+};
+// Safe to call while the program runs; counts may be a moment apart.
+MemStats mem_stats();
+// Allocations and bytes added by each site, over every thread; peak and
+// live are not kept per site. Call it while no other thread allocates.
+std::vector<std::pair<uint32_t, MemCount>> mem_sites();
+
+}
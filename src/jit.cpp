@@ -0,0 +1,636 @@
+#include "jit.hpp"
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define RIVET_JIT 1
+#include <sys/mman.h>
+#else
+#define RIVET_JIT 0
+#endif
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+namespace {
+
+// Compiled code gives up once the native stack pointer drops below this.
+// Only the main thread runs compiled code (forked Envs have no Jit).
+uintptr_t stack_limit = 0;
+constexpr size_t kStackBudget = 1u << 20;
+
+// Thrown while compiling a function the JIT cannot handle.
+struct Ineligible {};
+
+// ========== assembler ==========
+// Collects machine code and, next to it, a listing of what was emitted:
+// the JIT's disassembly is the assembler's own record.
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  int label() { labels.push_back(SIZE_MAX); return static_cast<int>(labels.size() - 1); }
+  void bind(int l) { labels[static_cast<size_t>(l)] = code.size(); }
+
+  void ins(std::initializer_list<uint8_t> bytes, std::string text) {
+    lines.push_back(Line{code.size(), bytes.size(), std::move(text), -1});
+    code.insert(code.end(), bytes);
+  }
+  void imm32(uint32_t v) { put(&v, 4); }
+  void imm64(uint64_t v) { put(&v, 8); }
+  // A jump or call with a rel32 to `target`.
+  void jump(std::initializer_list<uint8_t> op, const char* mnemonic, int target) {
+    ins(op, mnemonic);
+    lines.back().target = target;
+    fixups.emplace_back(code.size(), target);
+    imm32(0);
+  }
+
+  void resolve() {
+    for (auto [at, l] : fixups) {
+      int32_t rel = static_cast<int32_t>(static_cast<int64_t>(labels[static_cast<size_t>(l)]) - static_cast<int64_t>(at + 4));
+      std::memcpy(code.data() + at, &rel, 4);
+    }
+  }
+
+  std::string listing() const {
+    std::string out;
+    char buf[32];
+    for (const Line& ln : lines) {
+      std::snprintf(buf, sizeof buf, "  %04zx  ", ln.at);
+      out += buf;
+      std::string bytes;
+      for (size_t i = 0; i < ln.len; ++i) {
+        std::snprintf(buf, sizeof buf, "%02x ", code[ln.at + i]);
+        bytes += buf;
+      }
+      bytes.resize(std::max<size_t>(bytes.size(), 33), ' ');
+      out += bytes + ln.text;
+      if (ln.target >= 0) {
+        std::snprintf(buf, sizeof buf, " 0x%04zx", labels[static_cast<size_t>(ln.target)]);
+        out += buf;
+      }
+      out += '\n';
+    }
+    return out;
+  }
+
+private:
+  struct Line { size_t at, len; std::string text; int target; };
+
+  void put(const void* p, size_t n) {
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    code.insert(code.end(), b, b + n);
+    lines.back().len += n;
+  }
+
+  std::vector<Line> lines;
+  std::vector<size_t> labels;
+  std::vector<std::pair<size_t, int>> fixups;
+};
+
+std::string disp(int32_t d) { return d < 0 ? "-" + std::to_string(-d) : "+" + std::to_string(d); }
+
+}
+
+// ========== executable memory ==========
+struct Jit::Code {
+  void* mem {};
+  size_t size {};
+  std::string listing;
+
+  ~Code() {
+#if RIVET_JIT
+    if (mem) munmap(mem, size);
+#endif
+  }
+};
+
+// ========== compiler ==========
+// One function's body in one pass. Every value is a double: locals live in
+// the machine frame at rbp-16-8*slot, expressions leave their result in
+// xmm0 (numbers) or eax (booleans), and intermediate results go on the stack.
+//
+// Frame: rbx holds the result pointer; rsp is 16-byte aligned whenever no
+// temporaries are pushed, `depth` counting those that are.
+class FnCompiler {
+public:
+  FnCompiler(Jit& j, const Env& e, StmtId d)
+    : jit(j), env(e), p(j.prog), decl(d), fn(std::get<FnDecl>(p[d].node)), mut(fn.frame_size, true),
+      boolean_result(j.entry(d).boolean) {}
+
+  std::unique_ptr<Jit::Code> compile() {
+    bail = a.label(); done = a.label(); ret = a.label(); body = a.label();
+    uint32_t frame = 8 * fn.frame_size + (fn.frame_size % 2 ? 0 : 8);
+    a.ins({0x55}, "push rbp");
+    a.ins({0x48, 0x89, 0xE5}, "mov rbp, rsp");
+    a.ins({0x53}, "push rbx");
+    a.ins({0x48, 0x89, 0xF3}, "mov rbx, rsi");
+    a.ins({0x48, 0x81, 0xEC}, "sub rsp, " + std::to_string(frame)); a.imm32(frame);
+    mov_rax(reinterpret_cast<uint64_t>(&stack_limit), "&stack_limit");
+    a.ins({0x48, 0x3B, 0x20}, "cmp rsp, [rax]");
+    a.jump({0x0F, 0x82}, "jb", bail);
+    for (uint32_t i = 0; i < fn.params.size; ++i) {
+      a.ins({0xF2, 0x0F, 0x10, 0x87}, "movsd xmm0, [rdi" + disp(static_cast<int32_t>(8 * i)) + "]"); a.imm32(8 * i);
+      store(i);
+    }
+    a.bind(body);
+    stmt(fn.body);
+    // Falling off the end returns 0, which a boolean function cannot.
+    if (boolean_result) a.jump({0xE9}, "jmp", bail);
+    else a.ins({0x66, 0x0F, 0x57, 0xC0}, "xorpd xmm0, xmm0");
+    a.bind(ret);
+    a.ins({0xF2, 0x0F, 0x11, 0x03}, "movsd [rbx], xmm0");
+    a.ins({0x31, 0xC0}, "xor eax, eax");
+    a.bind(done);
+    a.ins({0x48, 0x8B, 0x5D, 0xF8}, "mov rbx, [rbp-8]");
+    a.ins({0xC9}, "leave");
+    a.ins({0xC3}, "ret");
+    a.bind(bail);
+    a.ins({0xB8}, "mov eax, 1"); a.imm32(1);
+    a.jump({0xE9}, "jmp", done);
+    a.resolve();
+    return finish();
+  }
+
+  bool calls_functions {};      // emitted a call to a compiled function
+
+private:
+  // ========== emission helpers ==========
+  static int32_t slot_disp(uint32_t slot) { return -16 - 8 * static_cast<int32_t>(slot); }
+
+  void mov_rax(uint64_t v, const std::string& what) { a.ins({0x48, 0xB8}, "mov rax, " + what); a.imm64(v); }
+
+  void load(uint32_t slot, int xmm) {
+    int32_t d = slot_disp(slot);
+    a.ins({0xF2, 0x0F, 0x10, static_cast<uint8_t>(xmm ? 0x8D : 0x85)}, "movsd xmm" + std::to_string(xmm) + ", [rbp" + disp(d) + "]");
+    a.imm32(static_cast<uint32_t>(d));
+  }
+  void store(uint32_t slot) {
+    int32_t d = slot_disp(slot);
+    a.ins({0xF2, 0x0F, 0x11, 0x85}, "movsd [rbp" + disp(d) + "], xmm0");
+    a.imm32(static_cast<uint32_t>(d));
+  }
+  void constant(double v, int xmm) {
+    uint64_t bits; std::memcpy(&bits, &v, sizeof bits);
+    char buf[40]; std::snprintf(buf, sizeof buf, "%.17g", v);
+    mov_rax(bits, buf);
+    a.ins({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(xmm ? 0xC8 : 0xC0)}, "movq xmm" + std::to_string(xmm) + ", rax");
+  }
+  void push() {
+    a.ins({0x48, 0x81, 0xEC}, "sub rsp, 8"); a.imm32(8);
+    a.ins({0xF2, 0x0F, 0x11, 0x04, 0x24}, "movsd [rsp], xmm0");
+    ++depth;
+  }
+  void pop(int xmm) {
+    a.ins({0xF2, 0x0F, 0x10, static_cast<uint8_t>(xmm ? 0x0C : 0x04), 0x24}, "movsd xmm" + std::to_string(xmm) + ", [rsp]");
+    drop(1);
+  }
+  void drop(uint32_t n) {
+    if (!n) return;
+    a.ins({0x48, 0x81, 0xC4}, "add rsp, " + std::to_string(8 * n)); a.imm32(8 * n);
+    depth -= n;
+  }
+  void reserve(uint32_t n) {
+    if (!n) return;
+    a.ins({0x48, 0x81, 0xEC}, "sub rsp, " + std::to_string(8 * n)); a.imm32(8 * n);
+    depth += n;
+  }
+  void test_eax() { a.ins({0x85, 0xC0}, "test eax, eax"); }
+  void setcc(uint8_t cc, const char* name, bool cl = false) {
+    a.ins({0x0F, cc, static_cast<uint8_t>(cl ? 0xC1 : 0xC0)}, std::string(name) + (cl ? " cl" : " al"));
+  }
+
+  // ========== types ==========
+  const Expr& node(ExprId e) const { return p[e]; }
+
+  bool is_bool(ExprId e) const { return jit.is_bool(e); }
+
+  // ========== expressions ==========
+  // A literal or a local goes straight into xmm1.
+  bool leaf(ExprId e) {
+    const auto& n = node(e).node;
+    if (auto* l = std::get_if<NumberLit>(&n)) { constant(l->value, 1); return true; }
+    if (auto* v = std::get_if<Variable>(&n)) { load(local(*v), 1); return true; }
+    return false;
+  }
+
+  // Left operand in xmm0, right operand in xmm1.
+  void operands(const Binary& b) {
+    num(b.left);
+    if (leaf(b.right)) return;
+    push();
+    num(b.right);
+    a.ins({0x66, 0x0F, 0x28, 0xC8}, "movapd xmm1, xmm0");
+    pop(0);
+  }
+
+  uint32_t local(const Variable& v) const {
+    if (v.ref.kind != RefKind::Local || v.ref.slot >= fn.frame_size) throw Ineligible{};
+    return v.ref.slot;
+  }
+
+  void num(ExprId e) {
+    std::visit([&](auto const& n) {
+      using T = std::decay_t<decltype(n)>;
+      if constexpr (std::is_same_v<T, NumberLit>) {
+        constant(n.value, 0);
+      } else if constexpr (std::is_same_v<T, Variable>) {
+        load(local(n), 0);
+      } else if constexpr (std::is_same_v<T, Grouping>) {
+        num(n.inner);
+      } else if constexpr (std::is_same_v<T, Unary>) {
+        if (n.op != UnaryOp::Negate) throw Ineligible{};
+        num(n.right);
+        a.ins({0x66, 0x48, 0x0F, 0x7E, 0xC0}, "movq rax, xmm0");
+        a.ins({0x48, 0x0F, 0xBA, 0xF8, 0x3F}, "btc rax, 63");
+        a.ins({0x66, 0x48, 0x0F, 0x6E, 0xC0}, "movq xmm0, rax");
+      } else if constexpr (std::is_same_v<T, Binary>) {
+        arith(n);
+      } else if constexpr (std::is_same_v<T, Call>) {
+        if (is_bool(e)) throw Ineligible{};
+        call(n);
+      } else if constexpr (std::is_same_v<T, BoolLit> || std::is_same_v<T, StringLit> || std::is_same_v<T, ArrayLit>) {
+        throw Ineligible{};
+      } else {
+        static_assert(always_false_v<T>, "Unhandled Expr node");
+      }
+    }, node(e).node);
+  }
+
+  void arith(const Binary& b) {
+    uint8_t op;
+    const char* name;
+    switch (b.op) {
+      case BinaryOp::Add: op = 0x58; name = "addsd xmm0, xmm1"; break;
+      case BinaryOp::Sub: op = 0x5C; name = "subsd xmm0, xmm1"; break;
+      case BinaryOp::Mul: op = 0x59; name = "mulsd xmm0, xmm1"; break;
+      case BinaryOp::Div: op = 0x5E; name = "divsd xmm0, xmm1"; break;
+      default: throw Ineligible{};
+    }
+    operands(b);
+    if (b.op == BinaryOp::Div) {
+      // The interpreter reports division by zero; let it.
+      int ok = a.label();
+      a.ins({0x66, 0x0F, 0x57, 0xD2}, "xorpd xmm2, xmm2");
+      a.ins({0x66, 0x0F, 0x2E, 0xCA}, "ucomisd xmm1, xmm2");
+      a.jump({0x0F, 0x8A}, "jp", ok);
+      a.jump({0x0F, 0x84}, "je", bail);
+      a.bind(ok);
+    }
+    a.ins({0xF2, 0x0F, op, 0xC1}, name);
+  }
+
+  // Result in xmm0. Arguments are pushed last to first, so args[0] ends up
+  // lowest, with the result slot below them.
+  void call(const Call& c) {
+    auto args = p[c.args];
+    if (c.native != kNoNative) { builtin(c); return; }
+    StmtId callee = jit.unique_fn(c.callee);
+    if (callee == kNoStmt || env.fn_decl(c.callee) != callee) throw Ineligible{};
+    const FnDecl& target = std::get<FnDecl>(p[callee].node);
+    if (args.size() != target.params.size) throw Ineligible{};
+    Jit::State st = jit.entry(callee).state;
+    if (st == Jit::State::Failed) throw Ineligible{};
+    if (st == Jit::State::Counting && !jit.compile(callee, env)) throw Ineligible{};
+    // Calling a memoized function bypasses its cache, which only costs
+    // what the cache would have saved unless it calls further functions.
+    // A callee still being compiled (recursion) has no code yet, so whether
+    // it is a leaf is not known.
+    if (target.memo && (!jit.entry(callee).mem || !jit.entry(callee).leaf)) throw Ineligible{};
+    calls_functions = true;
+
+    uint32_t k = static_cast<uint32_t>(args.size());
+    uint32_t pad = (depth + k + 1) % 2;
+    reserve(pad);
+    for (uint32_t i = k; i-- > 0;) { num(args[i]); push(); }
+    reserve(1);
+    a.ins({0x48, 0x8D, 0x7C, 0x24, 0x08}, "lea rdi, [rsp+8]");
+    a.ins({0x48, 0x89, 0xE6}, "mov rsi, rsp");
+    mov_rax(reinterpret_cast<uint64_t>(&jit.entry(callee).code), "&code of " + symbol_name(c.callee));
+    a.ins({0xFF, 0x10}, "call [rax]");
+    test_eax();
+    a.jump({0x0F, 0x85}, "jne", bail);
+    pop(0);
+    drop(k + pad);
+  }
+
+  void builtin(const Call& c) {
+    const std::string& name = symbol_name(c.callee);
+    if (c.args.size != 1 || native(c.native).arity != 1) throw Ineligible{};
+    if (name != "sqrt" && name != "abs" && name != "floor") throw Ineligible{};
+    num(p[c.args][0]);
+    if (name == "sqrt") {
+      a.ins({0xF2, 0x0F, 0x51, 0xC0}, "sqrtsd xmm0, xmm0");
+    } else if (name == "abs") {
+      a.ins({0x66, 0x48, 0x0F, 0x7E, 0xC0}, "movq rax, xmm0");
+      a.ins({0x48, 0x0F, 0xBA, 0xF0, 0x3F}, "btr rax, 63");
+      a.ins({0x66, 0x48, 0x0F, 0x6E, 0xC0}, "movq xmm0, rax");
+    } else {
+      uint32_t pad = depth % 2;
+      reserve(pad);
+      mov_rax(reinterpret_cast<uint64_t>(static_cast<double (*)(double)>(std::floor)), "floor");
+      a.ins({0xFF, 0xD0}, "call rax");
+      drop(pad);
+    }
+  }
+
+  // Result in eax, 0 or 1.
+  void boolean(ExprId e) {
+    const auto& n = node(e).node;
+    if (auto* g = std::get_if<Grouping>(&n)) { boolean(g->inner); return; }
+    if (auto* l = std::get_if<BoolLit>(&n)) { a.ins({0xB8}, l->value ? "mov eax, 1" : "mov eax, 0"); a.imm32(l->value); return; }
+    if (auto* c = std::get_if<Call>(&n)) {
+      call(*c);
+      a.ins({0xF2, 0x0F, 0x2C, 0xC0}, "cvttsd2si eax, xmm0");
+      return;
+    }
+    if (auto* u = std::get_if<Unary>(&n); u && u->op == UnaryOp::Not) {
+      cond(u->right);
+      a.ins({0x83, 0xF0, 0x01}, "xor eax, 1");
+      return;
+    }
+    auto* b = std::get_if<Binary>(&n);
+    if (!b) { cond(e); return; }
+    if (b->op == BinaryOp::LAnd || b->op == BinaryOp::LOr) {
+      int end = a.label();
+      cond(b->left);
+      test_eax();
+      a.jump({0x0F, static_cast<uint8_t>(b->op == BinaryOp::LAnd ? 0x84 : 0x85)}, b->op == BinaryOp::LAnd ? "je" : "jne", end);
+      cond(b->right);
+      a.bind(end);
+      return;
+    }
+    if (is_bool(b->left) || is_bool(b->right)) throw Ineligible{};
+    operands(*b);
+    // ucomisd leaves CF=ZF=PF=1 for NaN, which every test below reads as
+    // false (true for !=), as the interpreter does.
+    switch (b->op) {
+      case BinaryOp::Lt: a.ins({0x66, 0x0F, 0x2E, 0xC8}, "ucomisd xmm1, xmm0"); setcc(0x97, "seta");  break;
+      case BinaryOp::Le: a.ins({0x66, 0x0F, 0x2E, 0xC8}, "ucomisd xmm1, xmm0"); setcc(0x93, "setae"); break;
+      case BinaryOp::Gt: a.ins({0x66, 0x0F, 0x2E, 0xC1}, "ucomisd xmm0, xmm1"); setcc(0x97, "seta");  break;
+      case BinaryOp::Ge: a.ins({0x66, 0x0F, 0x2E, 0xC1}, "ucomisd xmm0, xmm1"); setcc(0x93, "setae"); break;
+      case BinaryOp::Eq:
+        a.ins({0x66, 0x0F, 0x2E, 0xC1}, "ucomisd xmm0, xmm1");
+        setcc(0x94, "sete"); setcc(0x9B, "setnp", true);
+        a.ins({0x20, 0xC8}, "and al, cl");
+        break;
+      case BinaryOp::Ne:
+        a.ins({0x66, 0x0F, 0x2E, 0xC1}, "ucomisd xmm0, xmm1");
+        setcc(0x95, "setne"); setcc(0x9A, "setp", true);
+        a.ins({0x08, 0xC8}, "or al, cl");
+        break;
+      default: throw Ineligible{};
+    }
+    a.ins({0x0F, 0xB6, 0xC0}, "movzx eax, al");
+  }
+
+  // truthy(e) in eax.
+  void cond(ExprId e) {
+    if (is_bool(e)) { boolean(e); return; }
+    num(e);
+    a.ins({0x66, 0x0F, 0x57, 0xD2}, "xorpd xmm2, xmm2");
+    a.ins({0x66, 0x0F, 0x2E, 0xC2}, "ucomisd xmm0, xmm2");
+    setcc(0x95, "setne"); setcc(0x9A, "setp", true);
+    a.ins({0x08, 0xC8}, "or al, cl");
+    a.ins({0x0F, 0xB6, 0xC0}, "movzx eax, al");
+  }
+
+  void branch_if_false(ExprId e, int target) {
+    cond(e);
+    test_eax();
+    a.jump({0x0F, 0x84}, "je", target);
+  }
+
+  // ========== statements ==========
+  void stmt(StmtId s) {
+    std::visit([&](auto const& n) {
+      using T = std::decay_t<decltype(n)>;
+      if constexpr (std::is_same_v<T, Let> || std::is_same_v<T, Var>) {
+        num(n.init);
+        if (n.slot >= fn.frame_size) throw Ineligible{};
+        store(n.slot);
+        mut[n.slot] = std::is_same_v<T, Var>;
+      } else if constexpr (std::is_same_v<T, Assign>) {
+        if (n.ref.kind != RefKind::Local || n.ref.slot >= fn.frame_size || !mut[n.ref.slot]) throw Ineligible{};
+        num(n.value);
+        store(n.ref.slot);
+      } else if constexpr (std::is_same_v<T, ExprStmt>) {
+        if (is_bool(n.expr)) boolean(n.expr); else num(n.expr);
+      } else if constexpr (std::is_same_v<T, Block>) {
+        for (StmtId st : p[n.stmts]) stmt(st);
+      } else if constexpr (std::is_same_v<T, If>) {
+        int other = a.label(), end = a.label();
+        branch_if_false(n.cond, other);
+        stmt(n.then_br);
+        a.jump({0xE9}, "jmp", end);
+        a.bind(other);
+        stmt(n.else_br);
+        a.bind(end);
+      } else if constexpr (std::is_same_v<T, While>) {
+        int top = a.label(), end = a.label();
+        a.bind(top);
+        branch_if_false(n.cond, end);
+        stmt(n.body);
+        a.jump({0xE9}, "jmp", top);
+        a.bind(end);
+      } else if constexpr (std::is_same_v<T, ForC>) {
+        int top = a.label(), end = a.label();
+        if (n.init != kNoStmt) stmt(n.init);
+        a.bind(top);
+        if (n.cond != kNoExpr) branch_if_false(n.cond, end);
+        stmt(n.body);
+        if (n.step != kNoStmt) stmt(n.step);
+        a.jump({0xE9}, "jmp", top);
+        a.bind(end);
+      } else if constexpr (std::is_same_v<T, Return>) {
+        const Call* c = std::get_if<Call>(&node(n.value).node);
+        if (n.tail && c && c->native == kNoNative && env.fn_decl(c->callee) == decl) {
+          // Self tail call: rebind the parameters and start over.
+          auto args = p[c->args];
+          if (args.size() != fn.params.size) throw Ineligible{};
+          for (size_t i = args.size(); i-- > 0;) { num(args[i]); push(); }
+          for (uint32_t i = 0; i < args.size(); ++i) { pop(0); store(i); }
+          a.jump({0xE9}, "jmp", body);
+          return;
+        }
+        if (boolean_result) {
+          boolean(n.value);
+          a.ins({0xF2, 0x0F, 0x2A, 0xC0}, "cvtsi2sd xmm0, eax");
+        } else {
+          num(n.value);
+        }
+        a.jump({0xE9}, "jmp", ret);
+      } else if constexpr (std::is_same_v<T, Print> || std::is_same_v<T, FnDecl> || std::is_same_v<T, ForIn>) {
+        throw Ineligible{};
+      } else {
+        static_assert(always_false_v<T>, "Unhandled Stmt node");
+      }
+    }, p[s].node);
+  }
+
+  std::unique_ptr<Jit::Code> finish() {
+    auto code = std::make_unique<Jit::Code>();
+#if RIVET_JIT
+    size_t page = 4096;
+    code->size = (a.code.size() + page - 1) / page * page;
+    void* mem = mmap(nullptr, code->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) throw Ineligible{};
+    code->mem = mem;
+    std::memcpy(mem, a.code.data(), a.code.size());
+    if (mprotect(mem, code->size, PROT_READ | PROT_EXEC) != 0) throw Ineligible{};
+#else
+    throw Ineligible{};
+#endif
+    if (jit.dump) {
+      std::string params;
+      for (Symbol s : p[fn.params]) params += (params.empty() ? "" : ", ") + symbol_name(s);
+      char head[64];
+      std::snprintf(head, sizeof head, " %u slots, %zu bytes at %p\n", fn.frame_size, a.code.size(), code->mem);
+      code->listing = "jit: fn " + symbol_name(fn.name) + "(" + params + "):" + head + a.listing();
+    }
+    return code;
+  }
+
+  Jit& jit;
+  const Env& env;
+  const Program& p;
+  StmtId decl;
+  const FnDecl& fn;
+  std::vector<bool> mut;        // whether each slot's current binding is a var
+  Assembler a;
+  int bail {}, done {}, ret {}, body {};
+  uint32_t depth {};
+  bool boolean_result;
+};
+
+// ========== Jit ==========
+Jit::Jit(const Program& p, std::ostream* dump_to) : prog(p), dump(dump_to), entries(p.stmts.size()) {
+  for (uint32_t i = 0; i < p.stmts.size(); ++i) {
+    auto* f = std::get_if<FnDecl>(&p.stmts[i].node);
+    if (!f) continue;
+    auto [it, fresh] = fns.emplace(f->name, StmtId{i});
+    if (!fresh) it->second = kNoStmt;
+  }
+
+  // Assume every function returns a boolean, then drop those with a return
+  // that is not a condition until nothing changes. What is left includes
+  // functions that only ever return their own (recursive) result.
+  for (auto& [name, d] : fns)
+    if (d != kNoStmt) entry(d).boolean = true;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto& [name, d] : fns) {
+      if (d == kNoStmt || !entry(d).boolean) continue;
+      bool any = false, all = true;
+      scan_returns(std::get<FnDecl>(p[d].node).body, any, all);
+      if (!any || !all) { entry(d).boolean = false; changed = true; }
+    }
+  }
+}
+
+void Jit::scan_returns(StmtId s, bool& any, bool& all) const {
+  const auto& n = prog[s].node;
+  if (auto* r = std::get_if<Return>(&n)) { any = true; all = all && is_bool(r->value); }
+  else if (auto* b = std::get_if<Block>(&n)) { for (StmtId st : prog[b->stmts]) scan_returns(st, any, all); }
+  else if (auto* i = std::get_if<If>(&n)) { scan_returns(i->then_br, any, all); scan_returns(i->else_br, any, all); }
+  else if (auto* w = std::get_if<While>(&n)) scan_returns(w->body, any, all);
+  else if (auto* f = std::get_if<ForC>(&n)) scan_returns(f->body, any, all);
+}
+
+bool Jit::is_bool(ExprId e) const {
+  const auto& n = prog[e].node;
+  if (std::holds_alternative<BoolLit>(n)) return true;
+  if (auto* g = std::get_if<Grouping>(&n)) return is_bool(g->inner);
+  if (auto* u = std::get_if<Unary>(&n)) return u->op == UnaryOp::Not;
+  if (auto* b = std::get_if<Binary>(&n)) return b->op >= BinaryOp::Eq;
+  if (auto* c = std::get_if<Call>(&n)) {
+    StmtId d = c->native == kNoNative ? unique_fn(c->callee) : kNoStmt;
+    return d != kNoStmt && entries[static_cast<uint32_t>(d)].boolean;
+  }
+  return false;
+}
+
+StmtId Jit::unique_fn(Symbol name) const {
+  auto it = fns.find(name);
+  return it == fns.end() ? kNoStmt : it->second;
+}
+
+Jit::~Jit() = default;
+
+// Functions compiled together (a function and the callees it pulled in)
+// become usable only once all of them have compiled. When one fails, so do
+// the callers waiting on it; the rest of the group goes back to counting.
+bool Jit::compile(StmtId decl, const Env& env) {
+  bool outer = compiling.empty();
+  Entry& e = entry(decl);
+  e.state = State::Compiling;
+  compiling.push_back(decl);
+  try {
+    FnCompiler c(*this, env, decl);
+    e.mem = c.compile();
+    e.leaf = !c.calls_functions;
+    e.code = reinterpret_cast<NativeCode>(e.mem->mem);
+  } catch (const Ineligible&) {
+    e.state = State::Failed;
+    e.mem.reset();
+    e.code = nullptr;
+    if (outer) {
+      for (StmtId d : compiling) {
+        if (entry(d).state != State::Compiling) continue;
+        entry(d) = Entry{State::Counting, entry(d).calls, entry(d).deopts, entry(d).boolean, false, nullptr, nullptr};
+      }
+      compiling.clear();
+    }
+    return false;
+  }
+  if (outer) {
+    for (StmtId d : compiling) {
+      entry(d).state = State::Compiled;
+      ++compiled;
+      if (dump) *dump << entry(d).mem->listing;
+    }
+    compiling.clear();
+  }
+  return true;
+}
+
+bool Jit::call(StmtId decl, const FnDecl& fn, const VarCell* params, const Env& env, Value& result) {
+  if (!RIVET_JIT || decl == kNoStmt) return false;
+  Entry& e = entry(decl);
+  if (e.state == State::Counting && ++e.calls >= kHotCalls) compile(decl, env);
+  if (e.state != State::Compiled) return false;
+
+  double small[16];
+  std::vector<double> large;
+  double* args = small;
+  if (fn.params.size > 16) { large.resize(fn.params.size); args = large.data(); }
+  bool typed = true;
+  for (uint32_t i = 0; i < fn.params.size; ++i) {
+    if (!is_number(params[i].val)) { typed = false; break; }
+    args[i] = as_number(params[i].val);
+  }
+  char here;
+  stack_limit = reinterpret_cast<uintptr_t>(&here) - kStackBudget;
+  double out;
+  if (!typed || e.code(args, &out) != 0) {
+    ++deopts;
+    if (++e.deopts >= kMaxDeopts) e.state = State::Failed;
+    return false;
+  }
+  ++native_calls;
+  if (e.boolean) result = Value(out != 0); else result = Value(out);
+  return true;
+}
+
+void Jit::report(std::ostream& out) const {
+  out << "jit: " << compiled << " function" << (compiled == 1 ? "" : "s") << " compiled, "
+      << native_calls << " compiled calls from the interpreter, " << deopts << " deopts\n";
+}
+
+}
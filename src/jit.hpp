@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "eval.hpp"
+
+namespace rivet {
+
+// A baseline JIT from numeric functions to x86-64 machine code (Linux only;
+// elsewhere nothing is ever compiled). The tree walker counts calls to each
+// function; past kHotCalls the function is compiled, together with every
+// function it calls, if all of them are made only of
+//   - number literals, parameters and Local variables bound to numbers,
+//   - arithmetic, comparisons, `!`, `&&` and `||`,
+//   - let/var/assignment, if, while, C-style for, return,
+//   - calls to such functions and to the natives sqrt, abs and floor.
+// A function may instead return only conditions; calls to it are then
+// allowed only where a condition is expected.
+// Such code prints nothing and changes nothing outside its frame, so the
+// compiled version can give up at any point and have the interpreter run
+// the whole call again. It gives up (deoptimizes) when an argument is not a
+// number, on a division by zero, and when the native stack runs low. A
+// function that deoptimizes kMaxDeopts times goes back to being interpreted.
+//
+// Compiled code calls a memoized function directly, skipping its result
+// cache, only if that function calls no others: bypassing the cache of a
+// recursive function could turn a linear computation exponential. Calls
+// from the interpreter to a compiled memoized function still probe first.
+class Jit {
+public:
+  static constexpr uint32_t kHotCalls = 10;
+  static constexpr uint32_t kMaxDeopts = 50;
+
+  // With `dump`, writes a listing of each function compiled to `dump`.
+  explicit Jit(const Program& p, std::ostream* dump = nullptr);
+  ~Jit();
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  // True if the call ran compiled and `result` is set. Otherwise the caller
+  // interprets it. `params` are the callee's bound parameter cells.
+  bool call(StmtId decl, const FnDecl& fn, const VarCell* params, const Env& env, Value& result);
+
+  void report(std::ostream& out) const;
+
+private:
+  struct Code;
+  using NativeCode = uint32_t (*)(const double* args, double* result);
+  enum class State : uint8_t { Counting, Compiling, Compiled, Failed };
+  struct Entry {
+    State state {State::Counting};
+    uint32_t calls {}, deopts {};
+    bool boolean {};                  // returns only conditions: 0 or 1 for false or true
+    bool leaf {};                     // its code calls no other compiled function
+    NativeCode code {};               // read by compiled callers through this
+    std::unique_ptr<Code> mem;
+  };
+  friend class FnCompiler;
+
+  bool compile(StmtId decl, const Env& env);
+  Entry& entry(StmtId decl) { return entries[static_cast<uint32_t>(decl)]; }
+  // The function a name refers to when it is declared exactly once.
+  StmtId unique_fn(Symbol name) const;
+  // Whether e is a condition: a comparison, `!`, `&&`, `||`, a boolean
+  // literal or a call to a boolean function.
+  bool is_bool(ExprId e) const;
+  void scan_returns(StmtId s, bool& any, bool& all) const;
+
+  const Program& prog;
+  std::ostream* dump;
+  std::vector<Entry> entries;                               // by StmtId
+  std::unordered_map<Symbol, StmtId> fns;                   // kNoStmt if declared twice
+  std::vector<StmtId> compiling;                            // this compile's group
+  size_t compiled {}, native_calls {}, deopts {};
+};
+
+}
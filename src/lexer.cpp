@@ -1,12 +1,15 @@
 #include "lexer.hpp"
-#include <cctype>
 #include <cassert>
-#include <unordered_map>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
 
 namespace rivet {
 
-Lexer::Lexer(std::string source, std::string filename)
-  : m_src(std::move(source)), m_filename(std::move(filename)) {}
+Lexer::Lexer(std::string_view source, std::string filename, const ScanKernels& scan)
+  : m_src(source), m_filename(std::move(filename)), m_scan(&scan) {
+  if (m_src.size() > UINT32_MAX) throw std::runtime_error(m_filename + ": source larger than 4 GiB");
+}
 
 char Lexer::peek() const {
   return m_index < m_src.size() ? m_src[m_index] : '\0';
@@ -14,127 +17,166 @@ char Lexer::peek() const {
 char Lexer::peek_next() const {
   return (m_index + 1) < m_src.size() ? m_src[m_index + 1] : '\0';
 }
-char Lexer::advance() {
-  char c = peek();
-  if (c == '\0') return '\0';
-  ++m_index;
-  if (c == '\n') newline(); else ++m_col;
-  return c;
-}
 bool Lexer::match(char expected) {
   if (peek() != expected) return false;
-  advance();
+  ++m_index;
   return true;
 }
-void Lexer::newline() {
-  ++m_line; m_col = 1;
+
+SourcePos Lexer::position(size_t offset) const {
+  if (offset < m_pos_offset) { m_pos_offset = m_pos_line_start = 0; m_pos_line = 1; }
+  const char* base = m_src.data();
+  const char* p = base + m_pos_offset;
+  const char* end = base + offset;
+  while (p < end) {
+    auto nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (!nl) break;
+    ++m_pos_line;
+    p = nl + 1;
+    m_pos_line_start = static_cast<size_t>(p - base);
+  }
+  m_pos_offset = offset;
+  return {m_pos_line, static_cast<int>(offset - m_pos_line_start) + 1};
 }
 
-Token Lexer::make_token(TokenKind kind, std::string_view text) {
+Token Lexer::make_token(TokenKind kind, size_t start, size_t end) {
   Token t;
   t.kind = kind;
-  t.lexeme.assign(text.begin(), text.end());
-  t.pos = {m_line, m_col - static_cast<int>(text.size())};
+  t.offset = static_cast<uint32_t>(start);
+  t.length = static_cast<uint32_t>(end - start);
   return t;
 }
 
-Token Lexer::error_token(const std::string& msg) {
+Token Lexer::error_token(std::string msg, size_t at) {
+  m_error = std::move(msg);
   Token t;
   t.kind = TokenKind::Error;
-  t.lexeme = msg;
-  t.pos = {m_line, m_col};
+  t.offset = static_cast<uint32_t>(at);
   return t;
 }
 
 void Lexer::skip_space_and_comments() {
+  const size_t n = m_src.size();
   for (;;) {
-    char c = peek();
-    if (c == ' ' || c == '\t' || c == '\r') { advance(); continue; }
-    if (c == '\n') { advance(); continue; }
+    m_index += scan(m_scan->space);
+    if (peek() != '/') break;
 
-    
-    if (c == '/' && peek_next() == '/') {
-      while (peek() != '\n' && peek() != '\0') advance();
+    if (peek_next() == '/') {
+      auto nl = static_cast<const char*>(std::memchr(m_src.data() + m_index, '\n', n - m_index));
+      m_index = nl ? static_cast<size_t>(nl - m_src.data()) : n;
       continue;
     }
 
-    if (c == '/' && peek_next() == '*') {
-      advance(); advance();
-      while (peek() != '\0' && !(peek() == '*' && peek_next() == '/')) {
-        advance();
+    if (peek_next() == '*') {
+      m_index += 2;
+      for (;;) {
+        m_index += scan(m_scan->to_star);
+        if (m_index >= n) break;
+        ++m_index;                                   // the '*'
+        if (match('/')) break;
       }
-      if (peek() == '*' && peek_next() == '/') { advance(); advance(); }
       continue;
     }
     break;
   }
 }
 
+// ========== keywords ==========
+// A perfect hash over the keyword set: (3 * first + last + length) mod 32 is
+// distinct for every keyword, which the static_assert below re-checks
+// whenever the list changes. A lookup is one hash, one slot and one compare.
+namespace {
+
+struct Keyword { std::string_view text; TokenKind kind {TokenKind::Identifier}; };
+
+constexpr Keyword kKeywords[] = {
+  {"let",    TokenKind::KwLet},
+  {"var",    TokenKind::KwVar},
+  {"fn",     TokenKind::KwFn},
+  {"if",     TokenKind::KwIf},
+  {"else",   TokenKind::KwElse},
+  {"while",  TokenKind::KwWhile},
+  {"for",    TokenKind::KwFor},
+  {"parallel", TokenKind::KwParallel},
+  {"in",     TokenKind::KwIn},
+  {"return", TokenKind::KwReturn},
+  {"print",  TokenKind::KwPrint},
+  {"true",   TokenKind::KwTrue},
+  {"false",  TokenKind::KwFalse},
+  {"nil",    TokenKind::KwNil},
+};
+
+constexpr size_t kKeywordSlots = 32;
+
+constexpr size_t keyword_hash(std::string_view s) {
+  return (3u * static_cast<unsigned char>(s.front()) + static_cast<unsigned char>(s.back()) + s.size()) % kKeywordSlots;
+}
+
+struct KeywordTable { Keyword slots[kKeywordSlots] {}; };
+
+constexpr KeywordTable make_keyword_table() {
+  KeywordTable t {};
+  for (const Keyword& k : kKeywords) t.slots[keyword_hash(k.text)] = k;
+  return t;
+}
+
+constexpr KeywordTable kKeywordTable = make_keyword_table();
+
+constexpr bool keyword_hash_is_perfect() {
+  for (const Keyword& k : kKeywords)
+    if (kKeywordTable.slots[keyword_hash(k.text)].text != k.text) return false;
+  return true;
+}
+static_assert(keyword_hash_is_perfect(), "keyword hash collides; pick new multipliers");
+
+}
+
 TokenKind Lexer::keyword_kind(std::string_view s) {
-  static const std::unordered_map<std::string_view, TokenKind> map = {
-    {"let",    TokenKind::KwLet},
-    {"var",    TokenKind::KwVar},
-    {"fn",     TokenKind::KwFn},
-    {"if",     TokenKind::KwIf},
-    {"else",   TokenKind::KwElse},
-    {"while",  TokenKind::KwWhile},
-    {"for",    TokenKind::KwFor},
-    {"in",     TokenKind::KwIn},
-    {"return", TokenKind::KwReturn},
-    {"print",  TokenKind::KwPrint},
-    {"true",   TokenKind::KwTrue},
-    {"false",  TokenKind::KwFalse},
-    {"nil",    TokenKind::KwNil},
-  };
-  if (auto it = map.find(s); it != map.end()) return it->second;
-  return TokenKind::Identifier;
+  if (s.size() < 2 || s.size() > 8) return TokenKind::Identifier;
+  const Keyword& k = kKeywordTable.slots[keyword_hash(s)];
+  return k.text == s ? k.kind : TokenKind::Identifier;
 }
 
 Token Lexer::identifier_or_keyword() {
   size_t start = m_index;
-  while (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_') advance();
-  std::string_view text{m_src.data() + start, m_index - start};
-  return make_token(keyword_kind(text), text);
+  m_index += scan(m_scan->ident);
+  std::string_view text = m_src.substr(start, m_index - start);
+  Token t = make_token(keyword_kind(text), start, m_index);
+  if (t.kind == TokenKind::Identifier) t.sym = intern(text);
+  return t;
 }
 
 Token Lexer::number() {
   size_t start = m_index;
-  while (std::isdigit(static_cast<unsigned char>(peek()))) advance();
+  m_index += scan(m_scan->digits);
   if (peek() == '.' && std::isdigit(static_cast<unsigned char>(peek_next()))) {
-    advance();
-    while (std::isdigit(static_cast<unsigned char>(peek()))) advance();
+    ++m_index;
+    m_index += scan(m_scan->digits);
   }
-  std::string_view text{m_src.data() + start, m_index - start};
-  return make_token(TokenKind::Number, text);
+  return make_token(TokenKind::Number, start, m_index);
 }
 
 Token Lexer::string() {
-  char quote = advance();
+  char quote = m_src[m_index++];
   assert(quote == '"' || quote == '\'');
   size_t start = m_index;
 
   while (peek() != '\0' && peek() != quote) {
-    if (peek() == '\\') {
-      advance();
-      if (peek() != '\0') advance();
-    } else {
-      advance();
-    }
+    if (peek() == '\\' && peek_next() != '\0') m_index += 2;
+    else ++m_index;
   }
   if (peek() == '\0') {
-    return error_token("Unterminated string");
+    return error_token("Unterminated string", m_index);
   }
-  size_t end = m_index;
-  advance();
-  std::string_view inner{m_src.data() + start, end - start};
-  return make_token(TokenKind::String, inner);
+  size_t end = m_index++;
+  return make_token(TokenKind::String, start, end);
 }
 
 Token Lexer::next() {
   skip_space_and_comments();
   char c = peek();
   if (c == '\0') {
-    return make_token(TokenKind::End, "");
+    return make_token(TokenKind::End, m_index, m_index);
   }
 
   // Identifiers
@@ -151,62 +193,59 @@ Token Lexer::next() {
   }
 
   // Single / compound operators & punctuation
-  advance();
+  size_t start = m_index++;
+  auto tok = [&](TokenKind k) { return make_token(k, start, m_index); };
   switch (c) {
-    case '(': return make_token(TokenKind::LParen, "(");
-    case ')': return make_token(TokenKind::RParen, ")");
-    case '{': return make_token(TokenKind::LBrace, "{");
-    case '}': return make_token(TokenKind::RBrace, "}");
-    case '[': return make_token(TokenKind::LBracket, "[");
-    case ']': return make_token(TokenKind::RBracket, "]");
-    case ',': return make_token(TokenKind::Comma, ",");
-    case '.': return make_token(TokenKind::Dot, ".");
-    case ':': return make_token(TokenKind::Colon, ":");
-    case ';': return make_token(TokenKind::Semicolon, ";");
+    case '(': return tok(TokenKind::LParen);
+    case ')': return tok(TokenKind::RParen);
+    case '{': return tok(TokenKind::LBrace);
+    case '}': return tok(TokenKind::RBrace);
+    case '[': return tok(TokenKind::LBracket);
+    case ']': return tok(TokenKind::RBracket);
+    case ',': return tok(TokenKind::Comma);
+    case '.': return tok(TokenKind::Dot);
+    case ':': return tok(TokenKind::Colon);
+    case ';': return tok(TokenKind::Semicolon);
 
     // Math
-    case '+': return make_token(TokenKind::Plus, "+");
+    case '+': return tok(TokenKind::Plus);
     case '-': {
-      if (match('>')) return make_token(TokenKind::Arrow, "->");
-      return make_token(TokenKind::Minus, "-");
+      if (match('>')) return tok(TokenKind::Arrow);
+      return tok(TokenKind::Minus);
     }
-    case '*': return make_token(TokenKind::Star, "*");
-    case '/': return make_token(TokenKind::Slash, "/");
-    case '%': return make_token(TokenKind::Percent, "%");
+    case '*': return tok(TokenKind::Star);
+    case '/': return tok(TokenKind::Slash);
+    case '%': return tok(TokenKind::Percent);
 
     // Logical and comparison
     case '!': {
       bool eq = match('=');
-      return make_token(eq ? TokenKind::BangEqual : TokenKind::Bang, eq ? "!=" : "!");
+      return tok(eq ? TokenKind::BangEqual : TokenKind::Bang);
     }
     case '=': {
       bool eq = match('=');
-      return make_token(eq ? TokenKind::EqualEqual : TokenKind::Equal, eq ? "==" : "=");
+      return tok(eq ? TokenKind::EqualEqual : TokenKind::Equal);
     }
     case '<': {
       bool eq = match('=');
-      return make_token(eq ? TokenKind::LessEqual : TokenKind::Less, eq ? "<=" : "<");
+      return tok(eq ? TokenKind::LessEqual : TokenKind::Less);
     }
     case '>': {
       bool eq = match('=');
-      return make_token(eq ? TokenKind::GreaterEqual : TokenKind::Greater, eq ? ">=" : ">");
+      return tok(eq ? TokenKind::GreaterEqual : TokenKind::Greater);
     }
     case '&': {
-      if (match('&')) return make_token(TokenKind::AndAnd, "&&");
+      if (match('&')) return tok(TokenKind::AndAnd);
       break;
     }
     case '|': {
-      if (match('|')) return make_token(TokenKind::OrOr, "||");
+      if (match('|')) return tok(TokenKind::OrOr);
       break;
     }
   }
 
 
-  Token t;
-  t.kind = TokenKind::Error;
-  t.lexeme = std::string("Unexpected character: '") + static_cast<char>(c) + "'";
-  t.pos = {m_line, m_col - 1}; // we already advanced once
-  return t;
+  return error_token(std::string("Unexpected character: '") + static_cast<char>(c) + "'", start);
 }
 
-}
\ No newline at end of file
+}
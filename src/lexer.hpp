@@ -1,29 +1,40 @@
 #pragma once
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include "rivet/token.hpp"
+#include "scan.hpp"
 
 namespace rivet {
 
+// Tokens are views into `source`, which must outlive the lexer and every
+// token it hands out. Nothing is copied or allocated per token, and line and
+// column are only worked out when someone asks for a token's position.
 class Lexer {
 public:
-  explicit Lexer(std::string source, std::string filename = "<stdin>");
+  explicit Lexer(std::string_view source, std::string filename = "<stdin>",
+                 const ScanKernels& scan = scan_kernels());
 
   Token next();
   bool  is_at_end() const { return m_index >= m_src.size(); }
 
+  std::string_view text(const Token& t) const { return m_src.substr(t.offset, t.length); }
+  SourcePos position(const Token& t) const { return position(t.offset); }
+  SourcePos position(size_t offset) const;
+  // Message for the most recent Error token.
+  const std::string& error() const { return m_error; }
+
 private:
   char  peek() const;
   char  peek_next() const;
-  char  advance();
   bool  match(char expected);
-  void  newline();
+  size_t scan(size_t (*kernel)(const char*, const char*)) const {
+    return kernel(m_src.data() + m_index, m_src.data() + m_src.size());
+  }
 
   void  skip_space_and_comments();
 
-  Token make_token(TokenKind kind, std::string_view text);
-  Token error_token(const std::string& msg);
+  Token make_token(TokenKind kind, size_t start, size_t end);
+  Token error_token(std::string msg, size_t at);
 
   Token string();
   Token number();
@@ -32,11 +43,15 @@ private:
   static TokenKind keyword_kind(std::string_view ident);
 
 private:
-  std::string m_src;
-  std::string m_filename;
-  size_t      m_index {0};
-  int         m_line  {1};
-  int         m_col   {1};
+  std::string_view   m_src;
+  std::string        m_filename;
+  std::string        m_error;
+  const ScanKernels* m_scan;
+  size_t             m_index {0};
+
+  // Last answered position() query; lookups resume from here.
+  mutable size_t m_pos_offset {0}, m_pos_line_start {0};
+  mutable int    m_pos_line {1};
 };
 
-}
\ No newline at end of file
+}
@@ -1,60 +1,141 @@
-#include <iostream>
+#include <cstdlib>
 #include <fstream>
-#include <sstream>
+#include <iostream>
 #include <string>
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "eval.hpp"
+#include "resolver.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "optimizer.hpp"
+#include "memo.hpp"
+#include "jit.hpp"
+#include "heap.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+#include "memstats.hpp"
+#include "stats.hpp"
+#include "ast_dump.hpp"
+#include "source.hpp"
 #include "rivet/token.hpp"
 
 using namespace rivet;
 
-static std::string to_string_value(const Value& v) {
-  if (is_number(v))  { std::ostringstream os; os << as_number(v); return os.str(); }
-  if (is_bool(v))    return as_bool(v) ? "true" : "false";
-  if (is_string(v))  return as_string(v);
-  if (is_array(v)) {
-    const auto& arr = *as_array(v);
-    std::string s = "[";
-    for (size_t i = 0; i < arr.items.size(); ++i) {
-      if (i) s += ", ";
-      s += to_string_value(arr.items[i]);
-    }
-    s += "]";
-    return s;
-  }
-  return "<unknown>";
-}
+enum class Engine { Tree, Vm };
 
-static std::string slurp_file(const std::string& path) {
-  std::ifstream in(path, std::ios::binary);
-  if (!in) throw std::runtime_error("Could not open file: " + path);
-  std::ostringstream ss; ss << in.rdbuf(); return ss.str();
-}
+struct RunOptions {
+  Engine engine = Engine::Tree;
+  bool optimize = false;   // -O
+  bool dump_ast = false;   // --dump-ast: print the (optimized) tree, don't run
+  bool memo_stats = false; // --memo-stats
+  bool quick_stats = false; // --quick-stats
+  bool gc_stats = false;    // --gc-stats
+  bool jit = false;        // --jit (tree walker only)
+  bool jit_dump = false;   // --jit-dump: list compiled code, report on exit
+  bool profile = false;    // rvt profile (tree walker only)
+  std::string stacks = "profile.folded";  // --stacks=: where profile writes collapsed stacks
+  std::string trace;       // --trace=: write a Chrome trace of the run here (tree walker only)
+  bool trace_stmts = false; // --trace-stmts: trace top-level statements and loop bodies too
+  bool mem_stats = false;   // --mem-stats
+  std::string mem_dump;     // --mem-dump=: append JSON snapshots of the memory counters here
+  unsigned mem_interval = 1000; // --mem-interval=: ms between those snapshots
+  bool stats = false;       // --stats: interpreter and hardware counters (tree walker only)
+  bool stats_json = false;  // --stats=json
+};
 
-static int run_file(const std::string& path) {
-  Env env; env.push();
-  Parser p(slurp_file(path), path);
-  Program prog = p.parse_program();
-  auto last = exec_program(prog, env);
+static int run_file(const std::string& path, const RunOptions& opts) {
+  // Set before parsing, so the literals the parser interns are counted too.
+  if (opts.mem_stats || !opts.mem_dump.empty()) mem_tracking = true;
+  Program prog;
+  {
+    // The mapping is released once parsing is done; the AST owns its data.
+    SourceFile src(path);
+    Parser p(src.text(), path);
+    prog = p.parse_program();
+  }
+  // Before resolution, so frame slots are laid out for the pruned tree.
+  if (opts.optimize) optimize(prog);
+  if (opts.dump_ast) {
+    dump_ast(prog, std::cout);
+    return 0;
+  }
+  Resolver resolver;
+  resolver.resolve(prog);
+  mark_memoizable(prog);
+  if (mem_tracking) mem_charge_program(prog);
+  std::string name = path.substr(path.find_last_of('/') + 1);
+  std::optional<MemDump> dump;
+  if (!opts.mem_dump.empty()) dump.emplace(opts.mem_dump, opts.mem_interval);
+  Env env(prog);
+  env.ensure_main(resolver.main_frame_size());
+  std::optional<Jit> jit;
+  if (opts.jit) env.jit = &jit.emplace(prog, opts.jit_dump ? &std::cerr : nullptr);
+  std::optional<Value> last;
+  if (opts.stats) stats_start();
+  if (opts.engine == Engine::Vm) {
+    Module mod = compile_program(prog);
+    last = run_module(mod, env);
+  } else if (!opts.trace.empty()) {
+    trace_start(opts.trace_stmts);
+    try { last = exec_program(prog, env); }
+    catch (...) { trace_stop(); throw; }
+    trace_stop();
+  } else if (opts.profile) {
+    profile_start();
+    try { last = exec_program(prog, env); }
+    catch (...) { profile_stop(); throw; }
+    profile_stop();
+  } else {
+    last = exec_program(prog, env);
+  }
+  if (opts.stats) stats_stop();
   if (last.has_value()) {
     std::cout << to_string_value(*last) << "\n";
   }
+  if (opts.memo_stats) env.memo.report(prog, std::cerr);
+  if (opts.quick_stats) report_quickening(prog, std::cerr);
+  if (opts.gc_stats) heap_report(std::cerr);
+  if (opts.jit_dump) jit->report(std::cerr);
+  if (opts.mem_stats) mem_report(prog, name, std::cerr);
+  if (dump) dump->finish(prog, name);
+  if (opts.stats) stats_report(std::cerr, opts.stats_json);
+  if (!opts.trace.empty()) {
+    std::ofstream out(opts.trace);
+    if (!out) throw std::runtime_error("cannot write " + opts.trace);
+    uint64_t events = trace_write(prog, out);
+    std::cerr << "trace: " << events << " events written to " << opts.trace << "\n";
+  }
+  if (opts.profile) {
+    SourceFile src(path);
+    profile_report(prog, name, src.text(), std::cerr);
+    std::ofstream stacks(opts.stacks);
+    if (!stacks) throw std::runtime_error("cannot write " + opts.stacks);
+    profile_write_stacks(prog, name, stacks);
+    std::cerr << "\ncollapsed stacks written to " << opts.stacks << " (flamegraph.pl " << opts.stacks << " > profile.svg)\n";
+  }
   return 0;
 }
 
 static int repl() {
   std::cout << "Rivet REPL — statements/expressions — Ctrl+C to exit\n";
-  Env env; env.push();
+  // Every line is parsed into one program that lives for the whole session:
+  // functions declared on one line are called from later ones.
+  Program history;
+  Env env(history);
+  Resolver resolver(/*bind_globals=*/false);
   std::string line;
   while (true) {
     std::cout << "rvt> " << std::flush;
     if (!std::getline(std::cin, line)) break;
     if (line.empty()) continue;
     try {
-      Parser p(line + "\n", "<stdin>");
-      auto stmt = p.parse_one_stmt();
-      auto out  = exec_stmt(*stmt, env);
+      line += '\n';
+      Parser p(line, "<stdin>", history);
+      StmtId stmt = p.parse_one_stmt();
+      resolver.resolve(history, stmt);
+      env.ensure_main(resolver.main_frame_size());
+      auto out  = exec_stmt(stmt, env);
       if (out.has_value()) {
         std::cout << to_string_value(*out) << "\n";
       }
@@ -69,12 +150,67 @@ int main(int argc, char** argv) {
   try {
     if (argc == 1) return repl();
     std::string cmd = argv[1];
-    if (cmd == "run" && argc >= 3) {
-      return run_file(argv[2]);
+    if ((cmd == "run" || cmd == "profile") && argc >= 3) {
+      RunOptions opts;
+      opts.profile = cmd == "profile";
+      std::string file;
+      bool ok = true;
+      for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine=tree")    opts.engine = Engine::Tree;
+        else if (arg == "--engine=vm") opts.engine = Engine::Vm;
+        else if (arg == "-O")          opts.optimize = true;
+        else if (arg == "--dump-ast")  opts.dump_ast = true;
+        else if (arg == "--memo-stats") opts.memo_stats = true;
+        else if (arg == "--quick-stats") opts.quick_stats = true;
+        else if (arg == "--gc-stats")  opts.gc_stats = heap_timing = true;
+        else if (arg == "--jit")       opts.jit = true;
+        else if (arg == "--jit-dump")  opts.jit = opts.jit_dump = true;
+        else if (arg.rfind("--stacks=", 0) == 0 && opts.profile) opts.stacks = arg.substr(9);
+        else if (arg.rfind("--trace=", 0) == 0 && arg.size() > 8) opts.trace = arg.substr(8);
+        else if (arg == "--trace-stmts") opts.trace_stmts = true;
+        else if (arg == "--mem-stats") opts.mem_stats = true;
+        else if (arg == "--stats")     opts.stats = true;
+        else if (arg == "--stats=json") opts.stats = opts.stats_json = true;
+        else if (arg.rfind("--mem-dump=", 0) == 0 && arg.size() > 11) opts.mem_dump = arg.substr(11);
+        else if (arg.rfind("--mem-interval=", 0) == 0 && arg.size() > 15) {
+          opts.mem_interval = static_cast<unsigned>(std::strtoul(arg.c_str() + 15, nullptr, 10));
+          if (opts.mem_interval == 0) ok = false;
+        }
+        else if (arg.rfind("-", 0) == 0 || !file.empty()) ok = false;
+        else file = arg;
+      }
+      if (opts.jit && opts.engine == Engine::Vm) ok = false;
+      if (opts.profile && (opts.jit || opts.engine == Engine::Vm)) ok = false;
+      if (!opts.trace.empty() && (opts.profile || opts.engine == Engine::Vm)) ok = false;
+      if (opts.trace_stmts && opts.trace.empty()) ok = false;
+      if (opts.stats && opts.engine == Engine::Vm) ok = false;
+      if (opts.mem_interval != 1000 && opts.mem_dump.empty()) ok = false;
+      if (ok && !file.empty()) return run_file(file, opts);
     }
     std::cerr << "Usage:\n"
               << "  rvt           # REPL (statements + expressions)\n"
-              << "  rvt run <file.rvt>\n";
+              << "  rvt run [options] <file.rvt>\n"
+              << "  rvt profile [options] [--stacks=<out.folded>] <file.rvt>\n"
+              << "                # run on the tree engine, sampling every 1 ms of CPU time; print the\n"
+              << "                # hottest lines and functions, write collapsed stacks (default profile.folded)\n"
+              << "\n"
+              << "Options:\n"
+              << "  --engine=tree|vm   tree-walking interpreter (default) or bytecode VM\n"
+              << "  -O                 fold constants, prune constant branches and dead code\n"
+              << "  --dump-ast         print the syntax tree (after -O, if given) and exit\n"
+              << "  --memo-stats       report result-cache hit rates of pure functions\n"
+              << "  --quick-stats      report the tree walker's specialized nodes and fallbacks\n"
+              << "  --gc-stats         report object heap size, reuse and large-array release times\n"
+              << "  --jit              compile hot numeric functions to x86-64 code (tree engine)\n"
+              << "  --jit-dump         --jit, listing the code compiled and reporting deopts\n"
+              << "  --trace=<out.json> record every call as a Chrome trace (tree engine; Perfetto)\n"
+              << "  --trace-stmts      with --trace, also top-level statements and loop iterations\n"
+              << "  --mem-stats        report peak and live memory by kind and the top allocation sites\n"
+              << "  --mem-dump=<file>  append the memory counters to <file> as JSON lines while running\n"
+              << "  --mem-interval=<ms> time between --mem-dump lines (default 1000)\n"
+              << "  --stats[=json]     count statements, expressions, lookups, frames, calls and type checks,\n"
+              << "                     plus CPU cycles, instructions and misses where perf_event allows (tree engine)\n";
     return 2;
   } catch (const std::exception& e) {
     std::cerr << "fatal: " << e.what() << "\n";
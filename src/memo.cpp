@@ -0,0 +1,245 @@
+#include "memo.hpp"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include "eval.hpp"
+#include "rivet/symbol.hpp"
+
+namespace rivet {
+
+// ========== purity ==========
+namespace {
+
+struct FnInfo {
+  bool pure = true;
+  bool loops = false;
+  std::vector<Symbol> callees;
+};
+
+class Purity {
+public:
+  explicit Purity(Program& prog) : p(prog) {}
+
+  void run() {
+    for (StmtId s : p.body) stmt(s, nullptr);
+
+    // Optimistic fixpoint: recursion among pure functions stays pure, and
+    // impurity spreads to every caller.
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (auto& [id, info] : fns) {
+        if (!info.pure) continue;
+        for (Symbol c : info.callees) {
+          auto d = decls.find(c);
+          if (d == decls.end() || d->second.size() != 1 || !fns[d->second.front()].pure) {
+            info.pure = false;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+    for (auto& [id, info] : fns) {
+      if (!info.pure) continue;
+      std::unordered_set<StmtId> seen;
+      std::get<FnDecl>(p[id].node).memo = info.loops || reaches(id, id, seen);
+    }
+  }
+
+private:
+  // Whether a (pure, so uniquely declared) callee chain from `from` calls `to`.
+  bool reaches(StmtId from, StmtId to, std::unordered_set<StmtId>& seen) {
+    for (Symbol c : fns[from].callees) {
+      StmtId next = decls[c].front();
+      if (next == to) return true;
+      if (seen.insert(next).second && reaches(next, to, seen)) return true;
+    }
+    return false;
+  }
+
+  // `in` is the innermost enclosing function, or null in the main program.
+  void stmt(StmtId s, FnInfo* in) {
+    auto impure = [&] { if (in) in->pure = false; };
+    std::visit([&](auto const& node) {
+      using T = std::decay_t<decltype(node)>;
+      if constexpr (std::is_same_v<T, Let> || std::is_same_v<T, Var>) {
+        expr(node.init, in);
+      } else if constexpr (std::is_same_v<T, Assign>) {
+        if (node.ref.kind != RefKind::Local) impure();
+        expr(node.value, in);
+      } else if constexpr (std::is_same_v<T, ExprStmt>) {
+        expr(node.expr, in);
+      } else if constexpr (std::is_same_v<T, Print>) {
+        impure();
+        expr(node.expr, in);
+      } else if constexpr (std::is_same_v<T, Block>) {
+        for (StmtId st : p[node.stmts]) stmt(st, in);
+      } else if constexpr (std::is_same_v<T, If>) {
+        expr(node.cond, in);
+        stmt(node.then_br, in);
+        stmt(node.else_br, in);
+      } else if constexpr (std::is_same_v<T, While>) {
+        if (in) in->loops = true;
+        expr(node.cond, in);
+        stmt(node.body, in);
+      } else if constexpr (std::is_same_v<T, ForC>) {
+        if (in) in->loops = true;
+        if (node.init != kNoStmt) stmt(node.init, in);
+        if (node.cond != kNoExpr) expr(node.cond, in);
+        if (node.step != kNoStmt) stmt(node.step, in);
+        stmt(node.body, in);
+      } else if constexpr (std::is_same_v<T, ForIn>) {
+        if (in) in->loops = true;
+        expr(node.iterable, in);
+        stmt(node.body, in);
+      } else if constexpr (std::is_same_v<T, FnDecl>) {
+        impure();                                   // (re)defines a function
+        decls[node.name].push_back(s);
+        stmt(node.body, &fns[s]);
+      } else if constexpr (std::is_same_v<T, Return>) {
+        expr(node.value, in);
+      }
+    }, p[s].node);
+  }
+
+  void expr(ExprId e, FnInfo* in) {
+    std::visit([&](auto const& node) {
+      using T = std::decay_t<decltype(node)>;
+      if constexpr (std::is_same_v<T, ArrayLit>) {
+        for (ExprId el : p[node.elems]) expr(el, in);
+      } else if constexpr (std::is_same_v<T, Grouping>) {
+        expr(node.inner, in);
+      } else if constexpr (std::is_same_v<T, Unary>) {
+        expr(node.right, in);
+      } else if constexpr (std::is_same_v<T, Binary>) {
+        expr(node.left, in);
+        expr(node.right, in);
+      } else if constexpr (std::is_same_v<T, Variable>) {
+        if (in && node.ref.kind != RefKind::Local) in->pure = false;
+      } else if constexpr (std::is_same_v<T, Call>) {
+        // An in-place native only writes a variable already checked to be
+        // Local, and copy-on-write keeps cached arrays from changing under it.
+        if (node.native != kNoNative) { if (in && !(native(node.native).flags & kNativePure)) in->pure = false; }
+        else if (in) in->callees.push_back(node.callee);
+        for (ExprId a : p[node.args]) expr(a, in);
+      }
+    }, p[e].node);
+  }
+
+  Program& p;
+  std::unordered_map<Symbol, std::vector<StmtId>> decls;   // every declaration of a name
+  std::unordered_map<StmtId, FnInfo> fns;
+};
+
+// Whether a function could tell two arguments apart, which equal_values
+// does not answer: 0 == -0, yet print shows the sign. Numbers match bit for
+// bit, strings by content and arrays element by element.
+bool same_value(const Value& a, const Value& b) {
+  if (is_string(a)) return is_string(b) && as_string(a) == as_string(b);
+  if (!is_array(a) || !is_array(b)) return a.raw() == b.raw();
+  const Array* A = as_array(a);
+  const Array* B = as_array(b);
+  if (A == B) return true;
+  return std::equal(A->items.begin(), A->items.end(), B->items.begin(), B->items.end(), same_value);
+}
+
+// Values that are the same_value hash alike.
+size_t hash_value(const Value& v) {
+  auto mix = [](size_t h, size_t x) { return h ^ (x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)); };
+  if (is_number(v)) return std::hash<uint64_t>{}(v.raw());
+  if (is_bool(v))   return as_bool(v) ? 0x51ed27u : 0x2f8a61u;
+  if (is_string(v)) return std::hash<std::string_view>{}(as_string(v));
+  size_t h = 0x6a09e667u;
+  for (const Value& x : as_array(v)->items) h = mix(h, hash_value(x));
+  return h;
+}
+
+// Bytes kept alive through a cached value, beyond the Value itself.
+size_t payload(const Value& v) {
+  if (is_string(v)) return as_string(v).size();
+  if (!is_array(v)) return 0;
+  size_t n = 0;
+  for (const Value& x : as_array(v)->items) n += sizeof(Value) + payload(x);
+  return n;
+}
+
+}
+
+void mark_memoizable(Program& p) { Purity{p}.run(); }
+
+// ========== cache ==========
+size_t MemoCache::hash_args(StmtId fn, const Value* args, size_t argc) {
+  size_t h = std::hash<uint32_t>{}(static_cast<uint32_t>(fn));
+  for (size_t i = 0; i < argc; ++i) h = h * 31 + hash_value(args[i]);
+  return h;
+}
+
+size_t MemoCache::cost(const Entry& e) {
+  // The list node and its index node, plus whatever the values hold on to.
+  size_t n = sizeof(Entry) + 64 + e.args.size() * sizeof(Value) + payload(e.result);
+  for (const Value& a : e.args) n += payload(a);
+  return n;
+}
+
+const Value* MemoCache::find(StmtId fn, const Value* args, size_t argc) {
+  Stats& st = stats[fn];
+  size_t h = hash_args(fn, args, argc);
+  auto [first, last] = index.equal_range(h);
+  for (auto it = first; it != last; ++it) {
+    Entry& e = *it->second;
+    if (e.fn != fn || e.args.size() != argc) continue;
+    if (!std::equal(args, args + argc, e.args.begin(), same_value)) continue;
+    ++st.hits;
+    lru.splice(lru.begin(), lru, it->second);
+    return &e.result;
+  }
+  ++st.misses;
+  return nullptr;
+}
+
+void MemoCache::insert(StmtId fn, std::vector<Value> args, Value result) {
+  size_t h = hash_args(fn, args.data(), args.size());
+  auto [first, last] = index.equal_range(h);
+  for (auto it = first; it != last; ++it) {
+    const Entry& e = *it->second;
+    if (e.fn == fn && e.args.size() == args.size() &&
+        std::equal(args.begin(), args.end(), e.args.begin(), same_value)) return;
+  }
+
+  lru.push_front(Entry{fn, h, std::move(args), std::move(result)});
+  index.emplace(h, lru.begin());
+  used += cost(lru.front());
+
+  while (used > budget && lru.size() > 1) {
+    const Entry& victim = lru.back();
+    auto [vf, vl] = index.equal_range(victim.hash);
+    for (auto it = vf; it != vl; ++it)
+      if (&*it->second == &victim) { index.erase(it); break; }
+    ++stats[victim.fn].evictions;
+    used -= cost(victim);
+    lru.pop_back();
+  }
+}
+
+void MemoCache::report(const Program& p, std::ostream& out) const {
+  std::vector<std::pair<StmtId, Stats>> rows(stats.begin(), stats.end());
+  std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  out << "memo: " << lru.size() << " entries, " << (used + 1023) / 1024 << " KiB of "
+      << budget / 1024 << " KiB\n";
+  for (const auto& [fn, st] : rows) {
+    uint64_t calls = st.hits + st.misses;
+    double rate = calls ? 100.0 * static_cast<double>(st.hits) / static_cast<double>(calls) : 0.0;
+    out << "  " << std::left << std::setw(16) << symbol_name(std::get<FnDecl>(p[fn].node).name) << std::right
+        << " calls " << std::setw(10) << calls
+        << "  hits " << std::setw(10) << st.hits
+        << "  hit rate " << std::fixed << std::setprecision(1) << std::setw(5) << rate << "%"
+        << "  evicted " << st.evictions << "\n";
+  }
+  out.unsetf(std::ios::floatfield);
+}
+
+}
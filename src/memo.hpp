@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "rivet/ast.hpp"
+#include "rivet/value.hpp"
+
+namespace rivet {
+
+// Sets FnDecl::memo on every function whose result depends only on its
+// arguments and is worth caching. Such a function:
+//   - reads and writes only its own locals (every reference is Local),
+//   - prints nothing and declares no functions,
+//   - calls only functions that are declared exactly once and are pure too,
+//     and natives flagged kNativePure,
+//   - is recursive or loops; anything else costs about as much as a probe.
+// Run on a resolved program that will not grow any further (not the REPL).
+void mark_memoizable(Program& p);
+
+// Results of memoized calls, keyed on the function and its argument values.
+// Arguments match only when the function could not tell them apart: numbers
+// bit for bit, so 0 and -0 are different keys. Least recently used
+// entries are evicted once the estimated footprint exceeds the budget.
+class MemoCache {
+public:
+  explicit MemoCache(size_t budget_bytes = 16u << 20) : budget(budget_bytes) {}
+
+  // The cached result, or null; counts a hit or a miss for fn.
+  const Value* find(StmtId fn, const Value* args, size_t argc);
+  void insert(StmtId fn, std::vector<Value> args, Value result);
+
+  void report(const Program& p, std::ostream& out) const;
+
+private:
+  struct Entry {
+    StmtId fn;
+    size_t hash;
+    std::vector<Value> args;
+    Value result;
+  };
+  struct Stats { uint64_t hits {}, misses {}, evictions {}; };
+
+  static size_t hash_args(StmtId fn, const Value* args, size_t argc);
+  static size_t cost(const Entry& e);
+
+  std::list<Entry> lru;                                        // most recent first
+  std::unordered_multimap<size_t, std::list<Entry>::iterator> index;   // by hash
+  std::unordered_map<StmtId, Stats> stats;
+  size_t budget;
+  size_t used {0};
+};
+
+}
@@ -0,0 +1,154 @@
+#include "memstats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "ast_dump.hpp"
+#include "rivet/symbol.hpp"
+
+namespace rivet {
+
+namespace {
+
+constexpr const char* kKindNames[kMemKinds] = {
+  "ast", "arrays", "array items", "strings", "string bytes", "variable slots", "call frames"};
+constexpr const char* kKindKeys[kMemKinds] = {
+  "ast", "arrays", "array_items", "strings", "string_bytes", "slots", "frames"};
+
+// "512 B", "3.4 KiB", "12.0 MiB"
+std::string bytes_text(int64_t n) {
+  char buf[32];
+  double v = static_cast<double>(n);
+  int64_t a = n < 0 ? -n : n;
+  if (a < 1024) std::snprintf(buf, sizeof buf, "%lld B", static_cast<long long>(n));
+  else if (a < (int64_t{1} << 20)) std::snprintf(buf, sizeof buf, "%.1f KiB", v / 1024);
+  else if (a < (int64_t{1} << 30)) std::snprintf(buf, sizeof buf, "%.1f MiB", v / (1024 * 1024));
+  else std::snprintf(buf, sizeof buf, "%.1f GiB", v / (1024 * 1024 * 1024));
+  return buf;
+}
+
+// "fib.rvt:3:12", or a note for allocations made outside any site: while
+// parsing, by the VM, or by natives with no call on the stack.
+std::string where(const Program& p, uint32_t site, std::string_view file) {
+  if (site == UINT32_MAX) return "(no site)";
+  SourcePos at = p.pos(static_cast<ExprId>(site));
+  return std::string(file) + ":" + std::to_string(at.line) + ":" + std::to_string(at.col);
+}
+
+std::string what(const Program& p, uint32_t site) {
+  if (site == UINT32_MAX) return "";
+  return std::visit([](auto const& n) -> std::string {
+    using T = std::decay_t<decltype(n)>;
+    if constexpr (std::is_same_v<T, ArrayLit>)    return "array literal";
+    else if constexpr (std::is_same_v<T, Binary>) return std::string("operator ") + op_text(n.op);
+    else if constexpr (std::is_same_v<T, Call>)   return "call " + symbol_name(n.callee) + "()";
+    else return "expression";
+  }, p[static_cast<ExprId>(site)].node);
+}
+
+std::vector<std::pair<uint32_t, MemCount>> top_sites(size_t n) {
+  auto sites = mem_sites();
+  std::sort(sites.begin(), sites.end(), [](const auto& a, const auto& b) {
+    return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first;
+  });
+  if (sites.size() > n) sites.resize(n);
+  return sites;
+}
+
+std::string json_string(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+// One line: {"t_ms":..,"live":..,"peak":..,"kinds":{..}}, with the top sites
+// when `p` is given.
+void write_json(std::ostream& out, long long t_ms, const Program* p, std::string_view file) {
+  MemStats s = mem_stats();
+  out << "{\"t_ms\":" << t_ms << ",\"live\":" << s.live << ",\"peak\":" << s.peak << ",\"kinds\":{";
+  for (size_t k = 0; k < kMemKinds; ++k) {
+    const MemCount& c = s.kinds[k];
+    out << (k ? "," : "") << "\"" << kKindKeys[k] << "\":{\"live\":" << c.live << ",\"peak\":" << c.peak
+        << ",\"allocations\":" << c.allocations << ",\"bytes\":" << c.bytes << "}";
+  }
+  out << "}";
+  if (p) {
+    out << ",\"sites\":[";
+    bool first = true;
+    for (const auto& [site, c] : top_sites(10)) {
+      out << (first ? "" : ",") << "{\"at\":" << json_string(where(*p, site, file)) << ",\"what\":"
+          << json_string(what(*p, site)) << ",\"allocations\":" << c.allocations << ",\"bytes\":" << c.bytes << "}";
+      first = false;
+    }
+    out << "]";
+  }
+  out << "}\n";
+}
+
+}
+
+void mem_charge_program(const Program& p) {
+  size_t bytes = p.exprs.capacity() * sizeof(Expr) + p.stmts.capacity() * sizeof(Stmt)
+               + p.expr_lists.capacity() * sizeof(ExprId) + p.stmt_lists.capacity() * sizeof(StmtId)
+               + p.symbol_lists.capacity() * sizeof(Symbol) + p.strings.capacity() * sizeof(Value)
+               + p.body.capacity() * sizeof(StmtId)
+               + (p.expr_pos.capacity() + p.stmt_pos.capacity()) * sizeof(SourcePos);
+  mem_charge(MemKind::Ast, static_cast<int64_t>(bytes), p.exprs.size() + p.stmts.size());
+}
+
+void mem_report(const Program& p, std::string_view file, std::ostream& out, size_t top) {
+  MemStats s = mem_stats();
+  out << "memory: peak " << bytes_text(s.peak) << ", " << bytes_text(s.live) << " live at exit\n"
+      << "  kind                  live        peak   allocations\n";
+  for (size_t k = 0; k < kMemKinds; ++k) {
+    const MemCount& c = s.kinds[k];
+    out << "  " << std::left << std::setw(16) << kKindNames[k] << std::right << std::setw(10) << bytes_text(c.live)
+        << std::setw(12) << bytes_text(c.peak) << std::setw(14) << c.allocations << "\n";
+  }
+  auto sites = top_sites(top);
+  if (sites.empty()) return;
+  out << "top allocation sites (arrays and strings):\n"
+      << "       bytes   allocations  site\n";
+  for (const auto& [site, c] : sites)
+    out << std::setw(12) << bytes_text(static_cast<int64_t>(c.bytes)) << std::setw(14) << c.allocations << "  "
+        << where(p, site, file) << "  " << what(p, site) << "\n";
+}
+
+MemDump::MemDump(const std::string& path, unsigned interval_ms) : out(path), start(std::chrono::steady_clock::now()) {
+  if (!out) throw std::runtime_error("cannot write " + path);
+  writer = std::thread([this, interval_ms] {
+    std::unique_lock<std::mutex> lk(m);
+    while (!wake.wait_for(lk, std::chrono::milliseconds(interval_ms), [this] { return stopping; })) snapshot();
+  });
+}
+
+MemDump::~MemDump() { stop(); }
+
+void MemDump::stop() {
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (writer.joinable()) writer.join();
+}
+
+void MemDump::snapshot() {
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  write_json(out, static_cast<long long>(ms), nullptr, {});
+  out.flush();
+}
+
+void MemDump::finish(const Program& p, std::string_view file) {
+  stop();
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  write_json(out, static_cast<long long>(ms), &p, file);
+  out.flush();
+}
+
+}
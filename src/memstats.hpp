@@ -0,0 +1,68 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "heap.hpp"
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// ========== --mem-stats and --mem-dump ==========
+// Reports on the counters kept by mem_charge (src/heap.hpp).
+
+// Makes an expression the allocation site for the guard's lifetime: the
+// tree walker sets it around array literals, calls and the slow paths of
+// binary operators.
+class MemSite {
+public:
+  explicit MemSite(ExprId id) : on(mem_tracking) {
+    if (!on) return;
+    saved = mem_site;
+    mem_site = static_cast<uint32_t>(id);
+  }
+  ~MemSite() { if (on) mem_site = saved; }
+  MemSite(const MemSite&) = delete;
+  MemSite& operator=(const MemSite&) = delete;
+
+private:
+  bool on;
+  uint32_t saved {};
+};
+
+// Charges the Program's tables to MemKind::Ast once it is final.
+void mem_charge_program(const Program& p);
+
+// Live and peak bytes and allocations per kind, then the `top` sites that
+// allocated the most bytes; `file` names the source in their positions.
+void mem_report(const Program& p, std::string_view file, std::ostream& out, size_t top = 10);
+
+// Appends a line of JSON with the counters to `path` every `interval_ms`
+// while it lives; finish() stops it and appends a last line that also lists
+// the top sites.
+class MemDump {
+public:
+  MemDump(const std::string& path, unsigned interval_ms);
+  ~MemDump();
+  MemDump(const MemDump&) = delete;
+  MemDump& operator=(const MemDump&) = delete;
+
+  void finish(const Program& p, std::string_view file);
+
+private:
+  void stop();
+  void snapshot();
+
+  std::ofstream out;
+  std::chrono::steady_clock::time_point start;
+  std::mutex m;
+  std::condition_variable wake;
+  bool stopping {};
+  std::thread writer;
+};
+
+}
@@ -0,0 +1,389 @@
+#include "rivet/native.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "eval.hpp"
+#include "pool.hpp"
+#include "vec.hpp"
+
+namespace rivet {
+
+// ========== builtins ==========
+namespace {
+
+double number_arg(const Value& v, const char* fn) {
+  if (!is_number(v)) throw std::runtime_error(std::string("type error: ") + fn + " expects a number");
+  return as_number(v);
+}
+
+const Array& array_arg(const Value& v, const char* fn) {
+  if (!is_array(v)) throw std::runtime_error(std::string("type error: ") + fn + " expects an array");
+  return *as_array(v);
+}
+
+Value len(Value* a) {
+  if (is_array(a[0]))  return static_cast<double>(as_array(a[0])->items.size());
+  if (is_string(a[0])) return static_cast<double>(as_string(a[0]).size());
+  throw std::runtime_error("type error: len expects an array or string");
+}
+
+// push/pop keep a known shape, which mutable_array() would otherwise reset.
+Value push(Value* a) {
+  Array::Shape shape = array_arg(a[0], "push").shape;
+  Array* arr = a[0].mutable_array();
+  arr->items.push_back(a[1]);
+  arr->recharge();
+  if (shape != Array::Shape::Unknown)
+    arr->shape = shape == Array::Shape::Numbers && is_number(a[1]) ? Array::Shape::Numbers : Array::Shape::Mixed;
+  return static_cast<double>(arr->items.size());
+}
+
+Value pop(Value* a) {
+  Array::Shape shape = array_arg(a[0], "pop").shape;
+  if (as_array(a[0])->items.empty()) throw std::runtime_error("runtime error: pop from an empty array");
+  Array* arr = a[0].mutable_array();
+  Value last = std::move(arr->items.back());
+  arr->items.pop_back();
+  if (shape == Array::Shape::Numbers) arr->shape = shape;
+  return last;
+}
+
+Value sqrt(Value* a)  { return std::sqrt(number_arg(a[0], "sqrt")); }
+Value floor(Value* a) { return std::floor(number_arg(a[0], "floor")); }
+Value abs(Value* a)   { return std::fabs(number_arg(a[0], "abs")); }
+
+// Arrays of numbers are reduced by the SIMD kernels; anything else folds
+// with the language's own operators, so strings sum by concatenation.
+Value sum(Value* a) {
+  const Array& arr = array_arg(a[0], "sum");
+  if (numeric(arr)) return vec_kernels().sum(arr.items.data(), arr.items.size());
+  Value acc = arr.items.front();
+  for (size_t i = 1; i < arr.items.size(); ++i) acc = binary_op(BinaryOp::Add, acc, arr.items[i]);
+  return acc;
+}
+
+template<bool Min> Value extreme(Value* a) {
+  const char* fn = Min ? "min" : "max";
+  const Array& arr = array_arg(a[0], fn);
+  if (arr.items.empty()) throw std::runtime_error(std::string("runtime error: ") + fn + " of an empty array");
+  if (numeric(arr)) return (Min ? vec_kernels().min : vec_kernels().max)(arr.items.data(), arr.items.size());
+  const Value* best = &arr.items.front();
+  for (const Value& v : arr.items)
+    if (truthy(binary_op(Min ? BinaryOp::Lt : BinaryOp::Gt, v, *best))) best = &v;
+  return *best;
+}
+
+Value str(Value* a) { return is_string(a[0]) ? a[0] : Value(to_string_value(a[0])); }
+
+Value num(Value* a) {
+  const Value& v = a[0];
+  if (is_number(v)) return v;
+  if (is_bool(v))   return as_bool(v) ? 1.0 : 0.0;
+  if (!is_string(v)) throw std::runtime_error("type error: num expects a number, bool or string");
+  std::string_view s = as_string(v);
+  double d = 0;
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), d);
+  if (s.empty() || ec != std::errc{} || end != s.data() + s.size())
+    throw std::runtime_error("runtime error: num cannot convert \"" + std::string(s) + "\"");
+  return d;
+}
+
+// ========== sort ==========
+// Merges the sorted runs [a, mid) and [mid, end) into `out`, taking from the
+// left run on ties. Never reads outside the runs, whatever `less` answers.
+template<class T, class Less>
+void merge_into(T* a, T* mid, T* end, T* out, Less& less) {
+  T* b = mid;
+  while (a != mid && b != end) *out++ = less(*b, *a) ? std::move(*b++) : std::move(*a++);
+  std::move(b, end, std::move(a, mid, out));
+}
+
+// Sorts v as `chunks` slices sorted one per task, then merged pairwise in
+// rounds of tasks. run(tasks, task) calls task(less, i) for every i in
+// [0, tasks), in parallel; sort_slice(less, first, last, scratch) sorts one
+// slice, with a scratch area as long as the slice.
+template<class T, class Run, class SortSlice>
+void merge_sort(std::vector<T>& v, size_t chunks, const Run& run, const SortSlice& sort_slice) {
+  size_t n = v.size();
+  std::vector<T> tmp(n);
+  auto at = [&](size_t c) { return std::min(c, chunks) * n / chunks; };
+  run(chunks, [&](auto& less, size_t c) { sort_slice(less, v.data() + at(c), v.data() + at(c + 1), tmp.data() + at(c)); });
+  for (size_t w = 1; w < chunks; w *= 2) {
+    run((chunks + 2 * w - 1) / (2 * w), [&](auto& less, size_t p) {
+      size_t lo = at(2 * p * w), mid = at(2 * p * w + w), hi = at(2 * p * w + 2 * w);
+      merge_into(v.data() + lo, v.data() + mid, v.data() + hi, tmp.data() + lo, less);
+    });
+    v.swap(tmp);
+  }
+}
+
+// Bottom-up merge sort through `scratch`; safe with any comparator.
+template<class T, class Less>
+void merge_sort_slice(Less& less, T* first, T* last, T* scratch) {
+  size_t n = static_cast<size_t>(last - first);
+  T* src = first; T* dst = scratch;
+  for (size_t w = 1; w < n; w *= 2) {
+    for (size_t lo = 0; lo < n; lo += 2 * w)
+      merge_into(src + lo, src + std::min(n, lo + w), src + std::min(n, lo + 2 * w), dst + lo, less);
+    std::swap(src, dst);
+  }
+  if (src != first) std::move(src, src + n, first);
+}
+
+// Doubles as unsigned integers in the same order: negatives reversed below
+// the positives, -0 just before +0, NaN after +inf.
+uint64_t sort_key(double d) {
+  uint64_t b; std::memcpy(&b, &d, sizeof b);
+  return (b >> 63) ? ~b : b | (uint64_t{1} << 63);
+}
+double from_sort_key(uint64_t k) {
+  uint64_t b = (k >> 63) ? k & ~(uint64_t{1} << 63) : ~k;
+  double d; std::memcpy(&d, &b, sizeof d);
+  return d;
+}
+
+// LSD radix sort on 11-bit digits, skipping the digits every key shares
+// (the low mantissa bits of integers, the exponent of similar magnitudes).
+void radix_sort(uint64_t* first, uint64_t* last, uint64_t* scratch) {
+  constexpr unsigned kBits = 11, kPasses = 6;
+  constexpr size_t kBuckets = size_t{1} << kBits;
+  size_t n = static_cast<size_t>(last - first);
+  if (n < 256) { std::sort(first, last); return; }
+  size_t count[kPasses][kBuckets] = {};
+  for (size_t i = 0; i < n; ++i)
+    for (unsigned p = 0; p < kPasses; ++p) ++count[p][(first[i] >> (p * kBits)) & (kBuckets - 1)];
+  uint64_t* src = first; uint64_t* dst = scratch;
+  for (unsigned p = 0; p < kPasses; ++p) {
+    unsigned shift = p * kBits;
+    if (count[p][(first[0] >> shift) & (kBuckets - 1)] == n) continue;
+    size_t at = 0;
+    for (size_t& c : count[p]) { size_t k = c; c = at; at += k; }
+    for (size_t i = 0; i < n; ++i) dst[count[p][(src[i] >> shift) & (kBuckets - 1)]++] = src[i];
+    std::swap(src, dst);
+  }
+  if (src != first) std::copy(src, src + n, first);
+}
+
+// Numbers are sorted as integer keys and strings as views into the array,
+// so the worker threads never touch a Value. One slice per worker, each at
+// least kMinSlice long: the result does not depend on how it is split.
+Value sort(Value* a) {
+  constexpr size_t kMinSlice = size_t{1} << 16;
+  const Array& arr = array_arg(a[0], "sort");
+  size_t n = arr.items.size();
+  ThreadPool& pool = ThreadPool::instance();
+  size_t chunks = std::max<size_t>(1, std::min(pool.size(), n / kMinSlice));
+  auto on_pool = [&](auto less) {
+    return [&pool, less](size_t tasks, const auto& task) {
+      pool.run(tasks, [&](size_t, size_t t) { auto l = less; task(l, t); });
+    };
+  };
+
+  if (numeric(arr)) {
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = sort_key(as_number(arr.items[i]));
+    merge_sort(keys, chunks, on_pool(std::less<uint64_t>{}),
+               [](auto&, uint64_t* first, uint64_t* last, uint64_t* scratch) { radix_sort(first, last, scratch); });
+    std::vector<Value> out;
+    out.reserve(n);
+    for (uint64_t k : keys) out.emplace_back(from_sort_key(k));
+    Value r = Value::array(std::move(out));
+    as_array(r)->shape = Array::Shape::Numbers;
+    return r;
+  }
+
+  struct Key { std::string_view s; size_t i; };
+  std::vector<Key> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    if (!is_string(arr.items[i])) throw std::runtime_error("type error: sort expects an array of numbers or of strings");
+    keys[i] = Key{as_string(arr.items[i]), i};
+  }
+  auto less = [](const Key& x, const Key& y) { return x.s < y.s || (x.s == y.s && x.i < y.i); };
+  merge_sort(keys, chunks, on_pool(less),
+             [](auto& l, Key* first, Key* last, Key*) { std::sort(first, last, l); });
+  std::vector<Value> out;
+  out.reserve(n);
+  for (const Key& k : keys) out.push_back(arr.items[k.i]);
+  return Value::array(std::move(out));
+}
+
+// ========== callbacks ==========
+// The algorithms taking a function work on chunks of kChunk items, one task
+// each, so which items meet in a call never depends on the thread count.
+constexpr size_t kChunk = 4096;
+
+size_t chunks_of(size_t n) { return (n + kChunk - 1) / kChunk; }
+
+const Value& fn_arg(const Value& v, const char* fn) {
+  if (!is_string(v)) throw std::runtime_error(std::string("type error: ") + fn + " expects a function");
+  return v;
+}
+
+// A stable merge sort: `less(x, y)` answers whether x goes before y.
+Value sort_by(Value* a, Caller& caller) {
+  const Array& arr = array_arg(a[0], "sort_by");
+  const Value& fn = fn_arg(a[1], "sort_by");
+  std::vector<Value> v = arr.items;
+  auto run = [&](size_t tasks, const auto& task) {
+    caller.parallel(tasks, [&](Caller& c, size_t t) {
+      auto less = [&](const Value& x, const Value& y) {
+        Value args[2] = {x, y};
+        return truthy(c.call(fn, args, 2));
+      };
+      task(less, t);
+    });
+  };
+  if (!v.empty())
+    merge_sort(v, chunks_of(v.size()), run,
+               [](auto& less, Value* first, Value* last, Value* scratch) { merge_sort_slice(less, first, last, scratch); });
+  return Value::array(std::move(v));
+}
+
+Value map(Value* a, Caller& caller) {
+  const Array& arr = array_arg(a[0], "map");
+  const Value& fn = fn_arg(a[1], "map");
+  size_t n = arr.items.size();
+  std::vector<Value> out(n);
+  caller.parallel(chunks_of(n), [&](Caller& c, size_t t) {
+    for (size_t i = t * kChunk, end = std::min(n, i + kChunk); i < end; ++i) {
+      Value x = arr.items[i];
+      out[i] = c.call(fn, &x, 1);
+    }
+  });
+  return Value::array(std::move(out));
+}
+
+// Each chunk keeps its matches in a list of its own; the lists are joined in
+// order.
+Value filter(Value* a, Caller& caller) {
+  const Array& arr = array_arg(a[0], "filter");
+  const Value& fn = fn_arg(a[1], "filter");
+  size_t n = arr.items.size();
+  std::vector<std::vector<Value>> kept(chunks_of(n));
+  caller.parallel(kept.size(), [&](Caller& c, size_t t) {
+    for (size_t i = t * kChunk, end = std::min(n, i + kChunk); i < end; ++i) {
+      Value x = arr.items[i];
+      if (truthy(c.call(fn, &x, 1))) kept[t].push_back(arr.items[i]);
+    }
+  });
+  std::vector<Value> out;
+  for (auto& part : kept) out.insert(out.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+  Value r = Value::array(std::move(out));
+  if (arr.shape == Array::Shape::Numbers) as_array(r)->shape = Array::Shape::Numbers;
+  return r;
+}
+
+// A left fold on the calling thread: f(...f(f(init, a[0]), a[1])..., a[n-1]).
+Value reduce(Value* a, Caller& caller) {
+  const Array& arr = array_arg(a[0], "reduce");
+  const Value& fn = fn_arg(a[1], "reduce");
+  Value acc = a[2];
+  for (const Value& x : arr.items) {
+    Value args[2] = {std::move(acc), x};
+    acc = caller.call(fn, args, 2);
+  }
+  return acc;
+}
+
+// Folds each chunk left to right with `fn`, every chunk starting from
+// `init`, then merges the chunk results pairwise in a tree with `combine`.
+// This is the left fold of the whole array when `combine` is associative,
+// `init` is its identity and combine(x, fn(y, e)) == fn(combine(x, y), e).
+Value parallel_reduce(Value* a, Caller& caller) {
+  const Array& arr = array_arg(a[0], "parallel_reduce");
+  const Value& fn = fn_arg(a[1], "parallel_reduce");
+  const Value& combine = fn_arg(a[3], "parallel_reduce");
+  size_t n = arr.items.size();
+  if (n == 0) return a[2];
+  std::vector<Value> part(chunks_of(n));
+  caller.parallel(part.size(), [&](Caller& c, size_t t) {
+    Value acc = a[2];
+    for (size_t i = t * kChunk, end = std::min(n, i + kChunk); i < end; ++i) {
+      Value args[2] = {std::move(acc), arr.items[i]};
+      acc = c.call(fn, args, 2);
+    }
+    part[t] = std::move(acc);
+  });
+  while (part.size() > 1) {
+    std::vector<Value> next((part.size() + 1) / 2);
+    caller.parallel(part.size() / 2, [&](Caller& c, size_t j) { next[j] = c.call(combine, &part[2 * j], 2); });
+    if (part.size() % 2) next.back() = std::move(part.back());
+    part.swap(next);
+  }
+  return part[0];
+}
+
+struct Registry {
+  std::vector<Native> natives;
+  std::unordered_map<Symbol, uint32_t> ids;
+
+  uint32_t add(std::string_view name, uint32_t arity, NativeFn fn, NativeCallerFn with_caller, uint8_t flags) {
+    if (arity > kMaxNativeArity || ((flags & kNativeInPlace) && arity == 0))
+      throw std::invalid_argument("native '" + std::string(name) + "': bad arity " + std::to_string(arity));
+    if (with_caller && (flags & kNativeInPlace))
+      throw std::invalid_argument("native '" + std::string(name) + "': an in-place native cannot take a Caller");
+    Symbol sym = intern(name);
+    Native n{sym, arity, fn, with_caller, flags};
+    auto [it, fresh] = ids.try_emplace(sym, static_cast<uint32_t>(natives.size()));
+    if (fresh) natives.push_back(n);
+    else natives[it->second] = n;
+    return it->second;
+  }
+  uint32_t add(std::string_view name, uint32_t arity, NativeFn fn, uint8_t flags) {
+    return add(name, arity, fn, nullptr, flags);
+  }
+  uint32_t add(std::string_view name, uint32_t arity, NativeCallerFn fn, uint8_t flags) {
+    return add(name, arity, nullptr, fn, flags);
+  }
+
+  Registry() {
+    add("len",   1, len,   kNativePure);
+    add("push",  2, push,  kNativePure | kNativeInPlace);
+    add("pop",   1, pop,   kNativePure | kNativeInPlace);
+    add("sqrt",  1, sqrt,  kNativePure);
+    add("floor", 1, floor, kNativePure);
+    add("abs",   1, abs,   kNativePure);
+    add("min",   1, extreme<true>,  kNativePure);
+    add("max",   1, extreme<false>, kNativePure);
+    add("sum",   1, sum,   kNativePure);
+    add("str",   1, str,   kNativePure);
+    add("num",   1, num,   kNativePure);
+    add("sort",  1, sort,  kNativePure);
+    add("sort_by", 2, sort_by, 0);
+    add("map",     2, map,     0);
+    add("filter",  2, filter,  0);
+    add("reduce",  3, reduce,  0);
+    add("parallel_reduce", 4, parallel_reduce, 0);
+  }
+};
+
+Registry& registry() {
+  static Registry r;
+  return r;
+}
+
+}
+
+// ========== registry ==========
+uint32_t register_native(std::string_view name, uint32_t arity, NativeFn fn, uint8_t flags) {
+  return registry().add(name, arity, fn, flags);
+}
+
+uint32_t register_native(std::string_view name, uint32_t arity, NativeCallerFn fn, uint8_t flags) {
+  return registry().add(name, arity, fn, flags);
+}
+
+uint32_t find_native(Symbol name) {
+  const Registry& r = registry();
+  auto it = r.ids.find(name);
+  return it != r.ids.end() ? it->second : kNoNative;
+}
+
+const Native& native(uint32_t id) { return registry().natives[id]; }
+
+}
@@ -0,0 +1,152 @@
+#include "optimizer.hpp"
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include "eval.hpp"
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+namespace {
+
+class Optimizer {
+public:
+  explicit Optimizer(Program& prog) : p(prog) {}
+
+  void run() {
+    for (StmtId s : p.body) stmt(s);
+    p.body.resize(live_prefix(p.body.data(), p.body.size()));
+  }
+
+private:
+  // ========== literals ==========
+  std::optional<Value> literal(ExprId e) const {
+    const auto& n = p[e].node;
+    if (auto* x = std::get_if<NumberLit>(&n)) return Value(x->value);
+    if (auto* x = std::get_if<BoolLit>(&n))   return Value(x->value);
+    if (auto* x = std::get_if<StringLit>(&n)) return p.strings[x->id];
+    return std::nullopt;
+  }
+
+  std::optional<Expr> to_literal(const Value& v) {
+    if (is_number(v)) return Expr{NumberLit{as_number(v)}};
+    if (is_bool(v))   return Expr{BoolLit{as_bool(v)}};
+    if (is_string(v)) {
+      p.strings.push_back(v);
+      return Expr{StringLit{static_cast<uint32_t>(p.strings.size() - 1)}};
+    }
+    return std::nullopt;
+  }
+
+  template<class F> std::optional<Expr> fold(F&& f) {
+    try { return to_literal(f()); }
+    catch (const std::runtime_error&) { return std::nullopt; }   // keep the run-time error
+  }
+
+  // Statements after an unconditional `return` never run.
+  static size_t live_prefix(const StmtId* first, size_t n, const Program& p) {
+    for (size_t i = 0; i < n; ++i)
+      if (std::holds_alternative<Return>(p[first[i]].node)) return i + 1;
+    return n;
+  }
+  size_t live_prefix(const StmtId* first, size_t n) const { return live_prefix(first, n, p); }
+
+  // ========== exprs ==========
+  // Each node is simplified after its children; a replacement is written
+  // back once the visitor no longer refers to the old node.
+  void expr(ExprId e) {
+    std::optional<Expr> out = std::visit([&](auto& node) -> std::optional<Expr> {
+      using T = std::decay_t<decltype(node)>;
+      if constexpr (std::is_same_v<T, Grouping>) {
+        expr(node.inner);
+        return p[node.inner];
+      } else if constexpr (std::is_same_v<T, Unary>) {
+        expr(node.right);
+        auto r = literal(node.right);
+        if (!r) return std::nullopt;
+        return fold([&] { return unary_op(node.op, *r); });
+      } else if constexpr (std::is_same_v<T, Binary>) {
+        expr(node.left);
+        expr(node.right);
+        auto l = literal(node.left);
+        auto r = literal(node.right);
+        if (node.op == BinaryOp::LOr || node.op == BinaryOp::LAnd) {
+          if (!l) return std::nullopt;
+          bool lt = truthy(*l);
+          if (node.op == BinaryOp::LOr && lt)   return Expr{BoolLit{true}};
+          if (node.op == BinaryOp::LAnd && !lt) return Expr{BoolLit{false}};
+          if (r) return Expr{BoolLit{truthy(*r)}};
+          return std::nullopt;
+        }
+        if (!l || !r) return std::nullopt;
+        return fold([&] { return binary_op(node.op, *l, *r); });
+      } else if constexpr (std::is_same_v<T, ArrayLit>) {
+        for (ExprId el : p[node.elems]) expr(el);
+        return std::nullopt;
+      } else if constexpr (std::is_same_v<T, Call>) {
+        for (ExprId a : p[node.args]) expr(a);
+        return std::nullopt;
+      } else {
+        return std::nullopt;
+      }
+    }, p[e].node);
+    if (out) p[e] = *out;
+  }
+
+  // ========== stmts ==========
+  void stmt(StmtId s) {
+    std::optional<Stmt> out = std::visit([&](auto& node) -> std::optional<Stmt> {
+      using T = std::decay_t<decltype(node)>;
+
+      if constexpr (std::is_same_v<T, Let> || std::is_same_v<T, Var>) {
+        expr(node.init);
+      } else if constexpr (std::is_same_v<T, Assign> || std::is_same_v<T, Return>) {
+        expr(node.value);
+      } else if constexpr (std::is_same_v<T, ExprStmt> || std::is_same_v<T, Print>) {
+        expr(node.expr);
+
+      } else if constexpr (std::is_same_v<T, Block>) {
+        for (StmtId st : p[node.stmts]) stmt(st);
+        node.stmts.size = static_cast<uint32_t>(live_prefix(p[node.stmts].begin(), node.stmts.size));
+
+      } else if constexpr (std::is_same_v<T, If>) {
+        expr(node.cond);
+        stmt(node.then_br);
+        stmt(node.else_br);
+        if (auto c = literal(node.cond)) return p[truthy(*c) ? node.then_br : node.else_br];
+
+      } else if constexpr (std::is_same_v<T, While>) {
+        expr(node.cond);
+        stmt(node.body);
+        if (auto c = literal(node.cond); c && !truthy(*c)) return Stmt{Block{}};
+
+      } else if constexpr (std::is_same_v<T, ForC>) {
+        if (node.init != kNoStmt) stmt(node.init);
+        if (node.cond != kNoExpr) expr(node.cond);
+        if (node.step != kNoStmt) stmt(node.step);
+        stmt(node.body);
+
+      } else if constexpr (std::is_same_v<T, ForIn>) {
+        expr(node.iterable);
+        stmt(node.body);
+
+      } else if constexpr (std::is_same_v<T, FnDecl>) {
+        stmt(node.body);
+
+      } else {
+        static_assert(always_false_v<T>, "Unhandled Stmt node");
+      }
+      return std::nullopt;
+    }, p[s].node);
+    if (out) p[s] = *out;
+  }
+
+  Program& p;
+};
+
+}
+
+void optimize(Program& p) { Optimizer{p}.run(); }
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// Simplifies a freshly parsed program in place, before it is resolved:
+//   - Unary/Binary/Grouping subtrees over literals become literals,
+//   - an `if` with a literal condition becomes the branch that would run,
+//   - a `while` whose literal condition is falsy becomes an empty block,
+//   - statements after a `return` in the same block are dropped.
+// A fold that would fail (division by zero, a type error) is left in place,
+// so the program still fails at the point where it would have.
+void optimize(Program& p);
+
+}
@@ -1,40 +1,44 @@
 #include "parser.hpp"
 #include <stdexcept>
 #include <sstream>
+#include <charconv>
 #include <cstdlib>
 
 namespace rivet {
 
-static std::string pos_str(const std::string& file, const Token& t) {
-  std::ostringstream oss; oss << file << ":" << t.pos.line << ":" << t.pos.col << ": "; return oss.str();
+std::string Parser::where(const Token& t) const {
+  SourcePos pos = lex.position(t);
+  std::ostringstream oss; oss << filename << ":" << pos.line << ":" << pos.col << ": "; return oss.str();
 }
 
-Parser::Parser(std::string source, std::string filename_)
-  : lex(std::move(source), filename_), filename(std::move(filename_)) {
+Parser::Parser(std::string_view source, std::string filename_) : Parser(source, std::move(filename_), own) {}
+
+Parser::Parser(std::string_view source, std::string filename_, Program& into)
+  : lex(source, filename_), filename(std::move(filename_)), prog(into) {
   current = lex.next();
-  if (current.kind == TokenKind::Error) throw std::runtime_error(pos_str(filename, current) + "lex error: " + current.lexeme);
+  if (current.kind == TokenKind::Error) throw std::runtime_error(where(current) + "lex error: " + lex.error());
 }
 
 const Token& Parser::advance() {
   current = lex.next();
-  if (current.kind == TokenKind::Error) throw std::runtime_error(pos_str(filename, current) + "lex error: " + current.lexeme);
+  if (current.kind == TokenKind::Error) throw std::runtime_error(where(current) + "lex error: " + lex.error());
   return current;
 }
 bool Parser::match(TokenKind k) { if (check(k)) { advance(); return true; } return false; }
 const Token& Parser::expect(TokenKind k, const char* msg) {
-  if (!check(k)) throw std::runtime_error(pos_str(filename, current) + std::string("parse error: expected ") + msg);
+  if (!check(k)) throw std::runtime_error(where(current) + std::string("parse error: expected ") + msg);
   return advance();
 }
 
-Program Parser::parse_program() { Program p; while (!check(TokenKind::End)) p.push_back(statement()); return p; }
-StmtPtr Parser::parse_one_stmt() { auto s=statement(); if(!check(TokenKind::End)) throw std::runtime_error(pos_str(filename,current)+"parse error: expected end of input"); return s; }
+Program Parser::parse_program() { while (!check(TokenKind::End)) prog.body.push_back(statement()); return std::move(prog); }
+StmtId Parser::parse_one_stmt() { StmtId s=statement(); if(!check(TokenKind::End)) throw std::runtime_error(where(current)+"parse error: expected end of input"); return s; }
 
-StmtPtr Parser::statement() {
+StmtId Parser::statement() {
   if (check(TokenKind::KwLet))    return let_stmt();
   if (check(TokenKind::KwVar))    return var_stmt();
   if (check(TokenKind::KwIf))     return if_stmt();
   if (check(TokenKind::KwWhile))  return while_stmt();
-  if (check(TokenKind::KwFor))    return for_stmt();
+  if (check(TokenKind::KwFor) || check(TokenKind::KwParallel)) return for_stmt();
   if (check(TokenKind::KwPrint))  return print_stmt();
   if (check(TokenKind::KwFn))     return fn_decl();
   if (check(TokenKind::KwReturn)) return return_stmt();
@@ -42,136 +46,151 @@ StmtPtr Parser::statement() {
   return assign_or_expr_stmt();
 }
 
-StmtPtr Parser::let_stmt() {
+StmtId Parser::let_stmt() {
+  SourcePos at = here();
   expect(TokenKind::KwLet, "'let'");
-  if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected identifier");
-  std::string name = current.lexeme; advance();
+  if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected identifier");
+  Symbol name = current.sym; advance();
   expect(TokenKind::Equal, "'='");
   auto init = expression();
   if (check(TokenKind::Semicolon)) advance();
-  return Stmt::make_let(std::move(name), std::move(init));
+  return prog.add_stmt(Let{name, init}, at);
 }
 
-StmtPtr Parser::var_stmt() {
+StmtId Parser::var_stmt() {
+  SourcePos at = here();
   expect(TokenKind::KwVar, "'var'");
-  if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected identifier");
-  std::string name = current.lexeme; advance();
+  if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected identifier");
+  Symbol name = current.sym; advance();
   expect(TokenKind::Equal, "'='");
   auto init = expression();
   if (check(TokenKind::Semicolon)) advance();
-  return Stmt::make_var(std::move(name), std::move(init));
+  return prog.add_stmt(Var{name, init}, at);
 }
 
-StmtPtr Parser::assign_or_expr_stmt() {
+StmtId Parser::assign_or_expr_stmt() {
+  SourcePos at = here();
   if (check(TokenKind::Identifier)) {
-    Token ident = current; advance();
+    Symbol name = current.sym; advance();
     if (check(TokenKind::Equal)) {
       advance();
       auto rhs = expression();
       if (check(TokenKind::Semicolon)) advance();
-      return Stmt::make_assign(ident.lexeme, std::move(rhs));
+      return prog.add_stmt(Assign{name, rhs}, at);
     } else if (check(TokenKind::LParen)) {
       advance();
-      std::vector<ExprPtr> args;
+      List<ExprId> args;
       if (!check(TokenKind::RParen)) args = arg_list();
       expect(TokenKind::RParen, "')'");
       if (check(TokenKind::Semicolon)) advance();
-      return Stmt::make_expr(Expr::make_call(ident.lexeme, std::move(args)));
+      return prog.add_stmt(ExprStmt{prog.add_expr(Call{name, args}, at)}, at);
     } else {
-      auto e = Expr::make_variable(ident.lexeme);
+      ExprId e = prog.add_expr(Variable{name}, at);
       if (check(TokenKind::Semicolon)) advance();
-      return Stmt::make_expr(std::move(e));
+      return prog.add_stmt(ExprStmt{e}, at);
     }
   }
   auto e = expression();
   if (check(TokenKind::Semicolon)) advance();
-  return Stmt::make_expr(std::move(e));
+  return prog.add_stmt(ExprStmt{e}, at);
 }
 
-StmtPtr Parser::block_stmt() {
+StmtId Parser::block_stmt() {
+  SourcePos at = here();
   expect(TokenKind::LBrace, "'{'");
-  std::vector<StmtPtr> ss;
+  size_t mark = stmt_scratch.size();
   while (!check(TokenKind::RBrace)) {
-    if (check(TokenKind::End)) throw std::runtime_error(pos_str(filename, current) + "parse error: unterminated block");
-    ss.push_back(statement());
+    if (check(TokenKind::End)) throw std::runtime_error(where(current) + "parse error: unterminated block");
+    StmtId st = statement();
+    stmt_scratch.push_back(st);
   }
   expect(TokenKind::RBrace, "'}'");
-  return Stmt::make_block(std::move(ss));
+  return prog.add_stmt(Block{take_list(stmt_scratch, mark)}, at);
 }
 
-StmtPtr Parser::if_stmt() {
+StmtId Parser::if_stmt() {
+  SourcePos at = here();
   expect(TokenKind::KwIf, "'if'");
   expect(TokenKind::LParen, "'('");
   auto c = expression();
   expect(TokenKind::RParen, "')'");
   auto t = statement();
-  StmtPtr e; if (match(TokenKind::KwElse)) e = statement(); else e = Stmt::make_block({});
-  return Stmt::make_if(std::move(c), std::move(t), std::move(e));
+  StmtId e = match(TokenKind::KwElse) ? statement() : prog.add_stmt(Block{}, at);
+  return prog.add_stmt(If{c, t, e}, at);
 }
 
-StmtPtr Parser::while_stmt() {
+StmtId Parser::while_stmt() {
+  SourcePos at = here();
   expect(TokenKind::KwWhile, "'while'");
   expect(TokenKind::LParen, "'('");
   auto c = expression();
   expect(TokenKind::RParen, "')'");
   auto b = statement();
-  return Stmt::make_while(std::move(c), std::move(b));
+  return prog.add_stmt(While{c, b}, at);
 }
 
 
-StmtPtr Parser::let_decl_no_semi() {
+StmtId Parser::let_decl_no_semi() {
+  SourcePos at = here();
   expect(TokenKind::KwLet, "'let'");
-  if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected identifier");
-  std::string name = current.lexeme; advance();
+  if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected identifier");
+  Symbol name = current.sym; advance();
   expect(TokenKind::Equal, "'='");
   auto init = expression();
-  return Stmt::make_let(std::move(name), std::move(init));
+  return prog.add_stmt(Let{name, init}, at);
 }
-StmtPtr Parser::var_decl_no_semi() {
+StmtId Parser::var_decl_no_semi() {
+  SourcePos at = here();
   expect(TokenKind::KwVar, "'var'");
-  if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected identifier");
-  std::string name = current.lexeme; advance();
+  if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected identifier");
+  Symbol name = current.sym; advance();
   expect(TokenKind::Equal, "'='");
   auto init = expression();
-  return Stmt::make_var(std::move(name), std::move(init));
+  return prog.add_stmt(Var{name, init}, at);
 }
-StmtPtr Parser::assign_or_expr_no_semi() {
+StmtId Parser::assign_or_expr_no_semi() {
+  SourcePos at = here();
   if (check(TokenKind::Identifier)) {
-    Token ident = current; advance();
+    Symbol name = current.sym; advance();
     if (check(TokenKind::Equal)) {
       advance();
       auto rhs = expression();
-      return Stmt::make_assign(ident.lexeme, std::move(rhs));
+      return prog.add_stmt(Assign{name, rhs}, at);
     } else if (check(TokenKind::LParen)) {
       advance();
-      std::vector<ExprPtr> args; if (!check(TokenKind::RParen)) args = arg_list();
+      List<ExprId> args; if (!check(TokenKind::RParen)) args = arg_list();
       expect(TokenKind::RParen, "')'");
-      return Stmt::make_expr(Expr::make_call(ident.lexeme, std::move(args)));
+      return prog.add_stmt(ExprStmt{prog.add_expr(Call{name, args}, at)}, at);
     } else {
-      return Stmt::make_expr(Expr::make_variable(ident.lexeme));
+      return prog.add_stmt(ExprStmt{prog.add_expr(Variable{name}, at)}, at);
     }
   }
   auto e = expression();
-  return Stmt::make_expr(std::move(e));
+  return prog.add_stmt(ExprStmt{e}, at);
 }
 
 
-StmtPtr Parser::for_stmt() {
+StmtId Parser::for_stmt() {
+  SourcePos at = here();
+  bool parallel = match(TokenKind::KwParallel);
   expect(TokenKind::KwFor, "'for'");
 
 
   if (!check(TokenKind::LParen)) {
-    if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected identifier after 'for'");
-    std::string var = current.lexeme; advance();
+    if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected identifier after 'for'");
+    Symbol var = current.sym; advance();
     expect(TokenKind::KwIn, "'in'");
     auto it = expression();
+    parallel_depth += parallel;
     auto body = statement();
-    return Stmt::make_for_in(std::move(var), std::move(it), std::move(body));
+    parallel_depth -= parallel;
+    return prog.add_stmt(ForIn{var, it, body, parallel}, at);
   }
+  if (parallel) throw std::runtime_error(where(current) + "parse error: expected 'for x in' after 'parallel'");
 
 
   advance();
-  StmtPtr init;
+  StmtId init = kNoStmt;
   if (!check(TokenKind::Semicolon)) {
     if (check(TokenKind::KwLet))      init = let_decl_no_semi();
     else if (check(TokenKind::KwVar)) init = var_decl_no_semi();
@@ -179,70 +198,78 @@ StmtPtr Parser::for_stmt() {
   }
   expect(TokenKind::Semicolon, "';'");
 
-  ExprPtr cond;
+  ExprId cond = kNoExpr;
   if (!check(TokenKind::Semicolon)) cond = expression();
   expect(TokenKind::Semicolon, "';'");
 
-  StmtPtr step;
+  StmtId step = kNoStmt;
   if (!check(TokenKind::RParen)) step = assign_or_expr_no_semi();
   expect(TokenKind::RParen, "')'");
 
   auto body = statement();
-  return Stmt::make_for_c(std::move(init), std::move(cond), std::move(step), std::move(body));
+  return prog.add_stmt(ForC{init, cond, step, body}, at);
 }
 
 
-StmtPtr Parser::print_stmt() {
+StmtId Parser::print_stmt() {
+  SourcePos at = here();
   expect(TokenKind::KwPrint, "'print'");
   auto e = expression();
   if (check(TokenKind::Semicolon)) advance();
-  return Stmt::make_print(std::move(e));
+  return prog.add_stmt(Print{e}, at);
 }
 
-StmtPtr Parser::fn_decl() {
+StmtId Parser::fn_decl() {
+  SourcePos at = here();
   expect(TokenKind::KwFn, "'fn'");
-  if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected function name");
-  std::string name = current.lexeme; advance();
+  if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected function name");
+  Symbol name = current.sym; advance();
   expect(TokenKind::LParen, "'('");
-  std::vector<std::string> params;
+  std::vector<Symbol> params;
   if (!check(TokenKind::RParen)) {
     do {
-      if (!check(TokenKind::Identifier)) throw std::runtime_error(pos_str(filename, current) + "parse error: expected parameter name");
-      params.push_back(current.lexeme); advance();
+      if (!check(TokenKind::Identifier)) throw std::runtime_error(where(current) + "parse error: expected parameter name");
+      params.push_back(current.sym); advance();
     } while (match(TokenKind::Comma));
   }
   expect(TokenKind::RParen, "')'");
+  uint32_t outer = parallel_depth;
+  parallel_depth = 0;
   auto body = block_stmt();
-  return Stmt::make_fn(std::move(name), std::move(params), std::move(body));
+  parallel_depth = outer;
+  return prog.add_stmt(FnDecl{name, prog.add_list(params.data(), params.data() + params.size()), body}, at);
 }
 
-StmtPtr Parser::return_stmt() {
+StmtId Parser::return_stmt() {
+  if (parallel_depth) throw std::runtime_error(where(current) + "parse error: 'return' inside parallel for");
+  SourcePos at = here();
   expect(TokenKind::KwReturn, "'return'");
-  ExprPtr v; if (!check(TokenKind::Semicolon) && !check(TokenKind::End) && !check(TokenKind::RBrace)) v = expression();
-  else v = Expr::make_number(0.0);
+  ExprId v; if (!check(TokenKind::Semicolon) && !check(TokenKind::End) && !check(TokenKind::RBrace)) v = expression();
+  else v = prog.add_expr(NumberLit{0.0}, at);
   if (check(TokenKind::Semicolon)) advance();
-  return Stmt::make_return(std::move(v));
-}
-
-ExprPtr Parser::expression() { return or_expr(); }
-ExprPtr Parser::or_expr() { auto l=and_expr(); while(check(TokenKind::OrOr)){advance(); auto r=and_expr(); l=Expr::make_binary(std::move(l), BinaryOp::LOr, std::move(r));} return l; }
-ExprPtr Parser::and_expr(){ auto l=equality(); while(check(TokenKind::AndAnd)){advance(); auto r=equality(); l=Expr::make_binary(std::move(l), BinaryOp::LAnd, std::move(r));} return l; }
-ExprPtr Parser::equality(){ auto l=comparison(); while(check(TokenKind::EqualEqual)||check(TokenKind::BangEqual)){Token op=current; advance(); auto r=comparison(); auto bop=(op.kind==TokenKind::EqualEqual)?BinaryOp::Eq:BinaryOp::Ne; l=Expr::make_binary(std::move(l), bop, std::move(r));} return l; }
-ExprPtr Parser::comparison(){ auto l=term(); while(check(TokenKind::Less)||check(TokenKind::LessEqual)||check(TokenKind::Greater)||check(TokenKind::GreaterEqual)){Token op=current; advance(); auto r=term(); BinaryOp bop; switch(op.kind){case TokenKind::Less:bop=BinaryOp::Lt;break;case TokenKind::LessEqual:bop=BinaryOp::Le;break;case TokenKind::Greater:bop=BinaryOp::Gt;break;default:bop=BinaryOp::Ge;} l=Expr::make_binary(std::move(l), bop, std::move(r)); } return l; }
-ExprPtr Parser::term(){ auto l=factor(); while(check(TokenKind::Plus)||check(TokenKind::Minus)){Token op=current; advance(); auto r=factor(); auto bop=(op.kind==TokenKind::Plus)?BinaryOp::Add:BinaryOp::Sub; l=Expr::make_binary(std::move(l), bop, std::move(r));} return l; }
-ExprPtr Parser::factor(){ auto l=unary(); while(check(TokenKind::Star)||check(TokenKind::Slash)){Token op=current; advance(); auto r=unary(); auto bop=(op.kind==TokenKind::Star)?BinaryOp::Mul:BinaryOp::Div; l=Expr::make_binary(std::move(l), bop, std::move(r));} return l; }
-ExprPtr Parser::unary(){ if(check(TokenKind::Minus)){advance(); return Expr::make_unary(UnaryOp::Negate, unary());} if(check(TokenKind::Bang)){advance(); return Expr::make_unary(UnaryOp::Not, unary());} return call(); }
-ExprPtr Parser::call(){ if(check(TokenKind::Identifier)){Token ident=current; advance(); if(check(TokenKind::LParen)){advance(); std::vector<ExprPtr> args; if(!check(TokenKind::RParen)) args=arg_list(); expect(TokenKind::RParen, "')'"); return Expr::make_call(ident.lexeme, std::move(args));} return Expr::make_variable(ident.lexeme);} return primary(); }
-std::vector<ExprPtr> Parser::arg_list(){ std::vector<ExprPtr> args; args.push_back(expression()); while(match(TokenKind::Comma)) args.push_back(expression()); return args; }
-ExprPtr Parser::array_lit(){ expect(TokenKind::LBracket, "'['"); std::vector<ExprPtr> elems; if(!check(TokenKind::RBracket)){ elems.push_back(expression()); while(match(TokenKind::Comma)) elems.push_back(expression()); } expect(TokenKind::RBracket, "']'"); return Expr::make_array(std::move(elems)); }
-ExprPtr Parser::primary(){
-  if (check(TokenKind::Number)) { char* end=nullptr; double v=std::strtod(current.lexeme.c_str(), &end); if (end==current.lexeme.c_str()) throw std::runtime_error(pos_str(filename,current)+"parse error: invalid number"); advance(); return Expr::make_number(v); }
-  if (check(TokenKind::KwTrue))  { advance(); return Expr::make_bool(true); }
-  if (check(TokenKind::KwFalse)) { advance(); return Expr::make_bool(false); }
-  if (check(TokenKind::String))  { std::string s=current.lexeme; advance(); return Expr::make_string(std::move(s)); }
+  return prog.add_stmt(Return{v}, at);
+}
+
+ExprId Parser::expression() { return or_expr(); }
+ExprId Parser::or_expr() { auto l=and_expr(); while(check(TokenKind::OrOr)){SourcePos at=here(); advance(); auto r=and_expr(); l=binary(l, BinaryOp::LOr, r, at);} return l; }
+ExprId Parser::and_expr(){ auto l=equality(); while(check(TokenKind::AndAnd)){SourcePos at=here(); advance(); auto r=equality(); l=binary(l, BinaryOp::LAnd, r, at);} return l; }
+ExprId Parser::equality(){ auto l=comparison(); while(check(TokenKind::EqualEqual)||check(TokenKind::BangEqual)){TokenKind op=current.kind; SourcePos at=here(); advance(); auto r=comparison(); auto bop=(op==TokenKind::EqualEqual)?BinaryOp::Eq:BinaryOp::Ne; l=binary(l, bop, r, at);} return l; }
+ExprId Parser::comparison(){ auto l=term(); while(check(TokenKind::Less)||check(TokenKind::LessEqual)||check(TokenKind::Greater)||check(TokenKind::GreaterEqual)){TokenKind op=current.kind; SourcePos at=here(); advance(); auto r=term(); BinaryOp bop; switch(op){case TokenKind::Less:bop=BinaryOp::Lt;break;case TokenKind::LessEqual:bop=BinaryOp::Le;break;case TokenKind::Greater:bop=BinaryOp::Gt;break;default:bop=BinaryOp::Ge;} l=binary(l, bop, r, at); } return l; }
+ExprId Parser::term(){ auto l=factor(); while(check(TokenKind::Plus)||check(TokenKind::Minus)){TokenKind op=current.kind; SourcePos at=here(); advance(); auto r=factor(); auto bop=(op==TokenKind::Plus)?BinaryOp::Add:BinaryOp::Sub; l=binary(l, bop, r, at);} return l; }
+ExprId Parser::factor(){ auto l=unary(); while(check(TokenKind::Star)||check(TokenKind::Slash)){TokenKind op=current.kind; SourcePos at=here(); advance(); auto r=unary(); auto bop=(op==TokenKind::Star)?BinaryOp::Mul:BinaryOp::Div; l=binary(l, bop, r, at);} return l; }
+ExprId Parser::unary(){ SourcePos at=here(); if(check(TokenKind::Minus)){advance(); return prog.add_expr(Unary{UnaryOp::Negate, unary()}, at);} if(check(TokenKind::Bang)){advance(); return prog.add_expr(Unary{UnaryOp::Not, unary()}, at);} return call(); }
+ExprId Parser::call(){ if(check(TokenKind::Identifier)){SourcePos at=here(); Symbol name=current.sym; advance(); if(check(TokenKind::LParen)){advance(); List<ExprId> args; if(!check(TokenKind::RParen)) args=arg_list(); expect(TokenKind::RParen, "')'"); return prog.add_expr(Call{name, args}, at);} return prog.add_expr(Variable{name}, at);} return primary(); }
+List<ExprId> Parser::arg_list(){ size_t mark=expr_scratch.size(); ExprId e=expression(); expr_scratch.push_back(e); while(match(TokenKind::Comma)){ e=expression(); expr_scratch.push_back(e); } return take_list(expr_scratch, mark); }
+ExprId Parser::array_lit(){ SourcePos at=here(); expect(TokenKind::LBracket, "'['"); size_t mark=expr_scratch.size(); if(!check(TokenKind::RBracket)){ ExprId e=expression(); expr_scratch.push_back(e); while(match(TokenKind::Comma)){ e=expression(); expr_scratch.push_back(e); } } expect(TokenKind::RBracket, "']'"); return prog.add_expr(ArrayLit{take_list(expr_scratch, mark)}, at); }
+ExprId Parser::primary(){
+  SourcePos at = here();
+  if (check(TokenKind::Number)) { auto text=lex.text(current); double v=0; auto r=std::from_chars(text.data(), text.data()+text.size(), v); if (r.ec==std::errc::result_out_of_range) v=std::strtod(std::string(text).c_str(), nullptr); else if (r.ec!=std::errc{}) throw std::runtime_error(where(current)+"parse error: invalid number"); advance(); return prog.add_expr(NumberLit{v}, at); }
+  if (check(TokenKind::KwTrue))  { advance(); return prog.add_expr(BoolLit{true}, at); }
+  if (check(TokenKind::KwFalse)) { advance(); return prog.add_expr(BoolLit{false}, at); }
+  if (check(TokenKind::String))  { auto text=lex.text(current); auto [it, fresh]=strings.try_emplace(text, static_cast<uint32_t>(prog.strings.size())); if(fresh) prog.strings.emplace_back(std::string(text)); advance(); return prog.add_expr(StringLit{it->second}, at); }
   if (check(TokenKind::LBracket)) return array_lit();
-  if (match(TokenKind::LParen))   { auto e=expression(); expect(TokenKind::RParen, "')'"); return Expr::make_grouping(std::move(e)); }
-  throw std::runtime_error(pos_str(filename, current) + "parse error: expected expression");
+  if (match(TokenKind::LParen))   { auto e=expression(); expect(TokenKind::RParen, "')'"); return prog.add_expr(Grouping{e}, at); }
+  throw std::runtime_error(where(current) + "parse error: expected expression");
 }
 
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include "lexer.hpp"
 #include "rivet/ast.hpp"
@@ -7,48 +9,71 @@
 namespace rivet {
     class Parser {
     public:
-        explicit Parser(std::string source, std::string filename = "<stdin>");
+        // `source` must outlive the parser; the finished AST owns all its data.
+        explicit Parser(std::string_view source, std::string filename = "<stdin>");
+        // Builds nodes into an existing program (the REPL's session history).
+        Parser(std::string_view source, std::string filename, Program& into);
 
         Program parse_program();
-        StmtPtr parse_one_stmt();
+        StmtId parse_one_stmt();
 
         private:
-        StmtPtr statement();
-        StmtPtr let_stmt();    
-        StmtPtr var_stmt();           
-        StmtPtr assign_or_expr_stmt();
-        StmtPtr block_stmt();
-        StmtPtr if_stmt();
-        StmtPtr while_stmt();
-        StmtPtr for_stmt();
-        StmtPtr print_stmt();
-        StmtPtr fn_decl();
-        StmtPtr return_stmt();
-        StmtPtr let_decl_no_semi();     
-        StmtPtr var_decl_no_semi();
-        StmtPtr assign_or_expr_no_semi();   
-        ExprPtr expression();
-        ExprPtr or_expr();
-        ExprPtr and_expr();
-        ExprPtr equality();
-        ExprPtr comparison();
-        ExprPtr term();
-        ExprPtr factor();
-        ExprPtr unary();
-        ExprPtr call();
-        ExprPtr primary();
-        ExprPtr array_lit();
-        std::vector<ExprPtr> arg_list();
+        StmtId statement();
+        StmtId let_stmt();    
+        StmtId var_stmt();           
+        StmtId assign_or_expr_stmt();
+        StmtId block_stmt();
+        StmtId if_stmt();
+        StmtId while_stmt();
+        StmtId for_stmt();
+        StmtId print_stmt();
+        StmtId fn_decl();
+        StmtId return_stmt();
+        StmtId let_decl_no_semi();     
+        StmtId var_decl_no_semi();
+        StmtId assign_or_expr_no_semi();   
+        ExprId expression();
+        ExprId or_expr();
+        ExprId and_expr();
+        ExprId equality();
+        ExprId comparison();
+        ExprId term();
+        ExprId factor();
+        ExprId unary();
+        ExprId call();
+        ExprId primary();
+        ExprId array_lit();
+        List<ExprId> arg_list();
+        ExprId binary(ExprId l, BinaryOp op, ExprId r, SourcePos at) { return prog.add_expr(Binary{l, op, r}, at); }
 
+        // Position of the current token. Productions ask before parsing their
+        // children, so the lexer's lookups only ever move forward.
+        SourcePos here() const { return lex.position(current); }
         const Token& advance();
         const Token& peek() const { return current; }
         bool check(TokenKind k) const { return current.kind == k; }
         bool match(TokenKind k);
         const Token& expect(TokenKind k, const char* msg);
+        std::string where(const Token& t) const;   // "file:line:col: " for error messages
+
+        // Children of the list being parsed are collected on a scratch stack
+        // (nested lists push above and pop back to their mark), then copied
+        // into the program's pool in one piece.
+        template<class T> List<T> take_list(std::vector<T>& scratch, size_t mark) {
+          List<T> l = prog.add_list(scratch.data() + mark, scratch.data() + scratch.size());
+          scratch.resize(mark);
+          return l;
+        }
 
         private:
         Lexer      lex;
         Token      current;
         std::string filename;
+        Program    own;
+        Program&   prog;
+        std::vector<ExprId> expr_scratch;
+        std::vector<StmtId> stmt_scratch;
+        std::unordered_map<std::string_view, uint32_t> strings;   // literal text -> Program::strings index
+        uint32_t parallel_depth = 0;      // parallel for bodies around this point in the current function
     };
-}
\ No newline at end of file
+}
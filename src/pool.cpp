@@ -0,0 +1,102 @@
+#include "pool.hpp"
+#include <cstdint>
+#include <cstdlib>
+
+namespace rivet {
+
+namespace {
+// The worker the current thread is running a task for, if any.
+thread_local size_t current_worker = SIZE_MAX;
+}
+
+ThreadPool& ThreadPool::instance() {
+  static ThreadPool pool([] {
+    if (const char* env = std::getenv("RIVET_THREADS")) {
+      char* end = nullptr;
+      unsigned long n = std::strtoul(env, &end, 10);
+      if (end != env && *end == '\0' && n > 0) return static_cast<size_t>(n);
+    }
+    unsigned n = std::thread::hardware_concurrency();
+    return static_cast<size_t>(n ? n : 1);
+  }());
+  return pool;
+}
+
+ThreadPool::ThreadPool(size_t workers) {
+  if (workers == 0) workers = 1;
+  for (size_t i = 0; i < workers; ++i) queues.push_back(std::make_unique<Queue>());
+  for (size_t i = 1; i < workers; ++i) threads.emplace_back([this, i] { work(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stop = true;
+  }
+  wake.notify_all();
+  for (std::thread& t : threads) t.join();
+}
+
+void ThreadPool::run(size_t tasks, const std::function<void(size_t, size_t)>& task) {
+  if (current_worker != SIZE_MAX || size() == 1) {
+    size_t self = current_worker != SIZE_MAX ? current_worker : 0;
+    for (size_t i = 0; i < tasks; ++i) task(self, i);
+    return;
+  }
+
+  for (size_t i = 0; i < tasks; ++i) queues[i % size()]->tasks.push_back(i);
+  {
+    std::lock_guard<std::mutex> lk(m);
+    job = &task;
+    busy = threads.size();
+    ++generation;
+  }
+  wake.notify_all();
+
+  current_worker = 0;
+  drain(0);
+  current_worker = SIZE_MAX;
+
+  std::unique_lock<std::mutex> lk(m);
+  done.wait(lk, [&] { return busy == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::work(size_t self) {
+  current_worker = self;
+  unsigned long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lk(m);
+      wake.wait(lk, [&] { return stop || generation != seen; });
+      if (stop) return;
+      seen = generation;
+    }
+    drain(self);
+    std::lock_guard<std::mutex> lk(m);
+    if (--busy == 0) done.notify_one();
+  }
+}
+
+void ThreadPool::drain(size_t self) {
+  size_t i;
+  while (next(self, i)) (*job)(self, i);
+}
+
+// Own queue first (front), then the others' (back), starting with the next
+// worker so thieves spread out.
+bool ThreadPool::next(size_t self, size_t& task) {
+  {
+    Queue& q = *queues[self];
+    std::lock_guard<std::mutex> lk(q.m);
+    if (!q.tasks.empty()) { task = q.tasks.front(); q.tasks.pop_front(); return true; }
+  }
+  for (size_t k = 1; k < size(); ++k) {
+    Queue& q = *queues[(self + k) % size()];
+    std::lock_guard<std::mutex> lk(q.m);
+    if (!q.tasks.empty()) { task = q.tasks.back(); q.tasks.pop_back(); return true; }
+  }
+  return false;
+}
+
+}
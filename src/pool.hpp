@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rivet {
+
+// Worker threads for `parallel for`. A job is a number of tasks; they are
+// dealt out round-robin to per-worker queues, each worker takes from the
+// front of its own queue, and a worker whose queue runs dry steals from the
+// back of the others'. The calling thread works as worker 0, so a job runs on
+// size() threads in all.
+class ThreadPool {
+public:
+  // Sized to the machine, or to $RIVET_THREADS when that is set.
+  static ThreadPool& instance();
+
+  explicit ThreadPool(size_t workers);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return queues.size(); }
+
+  // Calls task(worker, i) for every i in [0, tasks) and returns once all are
+  // done. `task` must not throw. Called from inside a task, it runs the
+  // nested job on the calling worker alone.
+  void run(size_t tasks, const std::function<void(size_t worker, size_t task)>& task);
+
+private:
+  struct Queue {
+    std::mutex m;
+    std::deque<size_t> tasks;
+  };
+
+  void work(size_t self);
+  void drain(size_t self);
+  bool next(size_t self, size_t& task);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex m;
+  std::condition_variable wake, done;
+  const std::function<void(size_t, size_t)>* job {};
+  unsigned long generation {0};
+  size_t busy {0};                  // helpers still inside the current job
+  bool stop {false};
+};
+
+}
@@ -0,0 +1,229 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RIVET_HAVE_SIGPROF 1
+#include <signal.h>
+#include <sys/time.h>
+#else
+#define RIVET_HAVE_SIGPROF 0
+#endif
+
+namespace rivet {
+
+namespace {
+
+// Samples are packed back to back as 32-bit words:
+//   frames | kTruncated, statement, then (fn, site) per frame, innermost first.
+// kTruncated marks a stack deeper than kMaxFrames, of which only the
+// innermost frames were kept.
+constexpr size_t kBufferWords = size_t{1} << 22;          // 16 MiB
+constexpr uint32_t kMaxFrames = 512;
+constexpr uint32_t kTruncated = 1u << 31;
+
+std::unique_ptr<uint32_t[]> buffer;
+std::atomic<size_t> used {0};               // words reserved so far
+std::atomic<size_t> limit {kBufferWords};   // where the first sample that did not fit would have gone
+std::atomic<uint64_t> dropped {0};
+std::atomic<bool> sampling {false};
+
+#if RIVET_HAVE_SIGPROF
+struct sigaction old_action;
+
+// Runs on whichever thread the timer interrupted, so it touches only that
+// thread's ProfileThread, the call chain it points to and the buffer.
+void on_sigprof(int) {
+  if (!sampling.load(std::memory_order_relaxed)) return;
+  StmtId stmt = profile_thread.stmt.load(std::memory_order_relaxed);
+  if (stmt == kNoStmt) return;
+  const ProfileCall* top = profile_thread.top.load(std::memory_order_acquire);
+  uint32_t n = 0;
+  const ProfileCall* c = top;
+  for (; c && n < kMaxFrames; c = c->caller) ++n;
+
+  size_t words = 2 + 2 * size_t{n};
+  size_t at = used.fetch_add(words, std::memory_order_relaxed);
+  if (at + words > kBufferWords) {
+    size_t l = limit.load(std::memory_order_relaxed);
+    while (at < l && !limit.compare_exchange_weak(l, at)) {}
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  uint32_t* w = buffer.get() + at;
+  w[0] = n | (c ? kTruncated : 0);
+  w[1] = static_cast<uint32_t>(stmt);
+  c = top;
+  for (uint32_t i = 0; i < n; ++i, c = c->caller) {
+    w[2 + 2 * i] = static_cast<uint32_t>(c->fn.load(std::memory_order_relaxed));
+    w[3 + 2 * i] = static_cast<uint32_t>(c->site);
+  }
+}
+#endif
+
+// One recorded sample; frames[2*i] is a callee, frames[2*i+1] its call site.
+struct Sample {
+  StmtId stmt;
+  const uint32_t* frames;
+  uint32_t depth;
+  bool truncated;
+  StmtId fn(uint32_t i) const { return static_cast<StmtId>(frames[2 * i]); }
+  StmtId site(uint32_t i) const { return static_cast<StmtId>(frames[2 * i + 1]); }
+};
+
+template<class F> uint64_t for_each_sample(F&& f) {
+  uint64_t count = 0;
+  size_t end = std::min(used.load(), limit.load());
+  for (size_t at = 0; at < end; ++count) {
+    const uint32_t* w = buffer.get() + at;
+    uint32_t depth = w[0] & ~kTruncated;
+    f(Sample{static_cast<StmtId>(w[1]), w + 2, depth, (w[0] & kTruncated) != 0});
+    at += 2 + 2 * size_t{depth};
+  }
+  return count;
+}
+
+int line_of(const Program& p, StmtId s) { return s == kNoStmt ? 0 : p.pos(s).line; }
+
+std::string fn_name(const Program& p, StmtId fn) {
+  if (fn == kNoStmt) return "<main>";
+  return symbol_name(std::get<FnDecl>(p[fn].node).name);
+}
+
+// "fib (fib.rvt:4)"
+std::string frame_name(const Program& p, StmtId fn, int line, std::string_view file) {
+  return fn_name(p, fn) + " (" + std::string(file) + ":" + std::to_string(line) + ")";
+}
+
+struct Counts { uint64_t self {}, total {}; };
+
+template<class K> std::vector<std::pair<K, Counts>> ranked(const std::unordered_map<K, Counts>& m) {
+  std::vector<std::pair<K, Counts>> v(m.begin(), m.end());
+  std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) {
+    if (a.second.self != b.second.self) return a.second.self > b.second.self;
+    if (a.second.total != b.second.total) return a.second.total > b.second.total;
+    return a.first < b.first;
+  });
+  return v;
+}
+
+void add_unique(std::vector<uint32_t>& seen, uint32_t key) {
+  if (std::find(seen.begin(), seen.end(), key) == seen.end()) seen.push_back(key);
+}
+
+}
+
+void profile_start() {
+#if RIVET_HAVE_SIGPROF
+  buffer.reset(new uint32_t[kBufferWords]);
+  used = 0;
+  limit = kBufferWords;
+  dropped = 0;
+  struct sigaction sa {};
+  sa.sa_handler = on_sigprof;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &sa, &old_action) != 0) throw std::runtime_error("runtime error: cannot install a SIGPROF handler");
+  profiling = true;
+  sampling = true;
+  itimerval timer {};
+  timer.it_interval.tv_usec = kProfileIntervalUs;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    profile_stop();
+    throw std::runtime_error("runtime error: cannot start the profiling timer");
+  }
+#else
+  throw std::runtime_error("runtime error: profiling needs SIGPROF, which this platform lacks");
+#endif
+}
+
+void profile_stop() {
+#if RIVET_HAVE_SIGPROF
+  itimerval off {};
+  setitimer(ITIMER_PROF, &off, nullptr);
+  sampling = false;
+  profiling = false;
+  sigaction(SIGPROF, &old_action, nullptr);
+#endif
+}
+
+void profile_report(const Program& p, std::string_view file, std::string_view source, std::ostream& out) {
+  constexpr size_t kRows = 20;
+  std::unordered_map<int, Counts> lines;
+  std::unordered_map<uint32_t, Counts> fns;                  // by FnDecl id; kNoStmt is <main>
+  std::vector<uint32_t> seen;
+  uint64_t samples = for_each_sample([&](const Sample& s) {
+    ++lines[line_of(p, s.stmt)].self;
+    ++fns[static_cast<uint32_t>(s.depth ? s.fn(0) : kNoStmt)].self;
+    seen.clear();
+    add_unique(seen, static_cast<uint32_t>(line_of(p, s.stmt)));
+    for (uint32_t i = 0; i < s.depth; ++i) add_unique(seen, static_cast<uint32_t>(line_of(p, s.site(i))));
+    for (uint32_t l : seen) ++lines[static_cast<int>(l)].total;
+    seen.clear();
+    add_unique(seen, static_cast<uint32_t>(kNoStmt));
+    for (uint32_t i = 0; i < s.depth; ++i) add_unique(seen, static_cast<uint32_t>(s.fn(i)));
+    for (uint32_t f : seen) ++fns[f].total;
+  });
+
+  out << "profile: " << samples << " samples, one per " << kProfileIntervalUs / 1000.0 << " ms of CPU time";
+  if (uint64_t d = dropped.load()) out << " (" << d << " more dropped: sample buffer full)";
+  out << "\n";
+  if (!samples) return;
+
+  std::vector<std::string_view> text;                        // by line - 1
+  for (size_t at = 0; at <= source.size();) {
+    size_t nl = source.find('\n', at);
+    if (nl == std::string_view::npos) nl = source.size();
+    std::string_view l = source.substr(at, nl - at);
+    size_t first = l.find_first_not_of(" \t\r");
+    text.push_back(first == std::string_view::npos ? std::string_view{} : l.substr(first));
+    at = nl + 1;
+  }
+  auto pct = [&](uint64_t n) { return 100.0 * static_cast<double>(n) / static_cast<double>(samples); };
+
+  out << std::fixed << std::setprecision(1)
+      << "\n   self   total  line\n";
+  auto by_line = ranked(lines);
+  for (size_t i = 0; i < by_line.size() && i < kRows; ++i) {
+    auto [line, c] = by_line[i];
+    std::string where = std::string(file) + ":" + std::to_string(line);
+    out << std::setw(6) << pct(c.self) << "% " << std::setw(6) << pct(c.total) << "%  " << std::left << std::setw(20)
+        << where << std::right;
+    if (line > 0 && static_cast<size_t>(line) <= text.size()) out << " " << text[static_cast<size_t>(line) - 1].substr(0, 60);
+    out << "\n";
+  }
+
+  out << "\n   self   total  function\n";
+  auto by_fn = ranked(fns);
+  for (size_t i = 0; i < by_fn.size() && i < kRows; ++i) {
+    auto [fn, c] = by_fn[i];
+    StmtId decl = static_cast<StmtId>(fn);
+    out << std::setw(6) << pct(c.self) << "% " << std::setw(6) << pct(c.total) << "%  "
+        << (decl == kNoStmt ? fn_name(p, decl) : frame_name(p, decl, line_of(p, decl), file)) << "\n";
+  }
+  out.unsetf(std::ios::floatfield);
+  out << std::setprecision(6);
+}
+
+void profile_write_stacks(const Program& p, std::string_view file, std::ostream& out) {
+  std::map<std::string, uint64_t> stacks;
+  std::string key;
+  for_each_sample([&](const Sample& s) {
+    // Each frame shows the line it is at: its call into the next frame, or
+    // for the innermost one the statement sampled.
+    auto at = [&](uint32_t i) { return line_of(p, i == 0 ? s.stmt : s.site(i - 1)); };
+    key = s.truncated ? "[truncated]" : frame_name(p, kNoStmt, line_of(p, s.depth ? s.site(s.depth - 1) : s.stmt), file);
+    for (uint32_t i = s.depth; i-- > 0;) key += ";" + frame_name(p, s.fn(i), at(i), file);
+    ++stacks[key];
+  });
+  for (const auto& [stack, n] : stacks) out << stack << " " << n << "\n";
+}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// ========== Sampling profiler (rvt profile) ==========
+// While `profiling` is set the tree walker keeps, for each thread, the
+// statement it is running and the chain of calls that led there. The chain
+// is linked through the C++ stack, so entering a call costs a few stores
+// and nothing is allocated. A SIGPROF timer interrupts the program every
+// kProfileIntervalUs of CPU time; the handler copies the chain into a buffer
+// reserved up front. Statements are turned into lines and functions into
+// names only once the program has finished.
+inline bool profiling = false;
+inline constexpr long kProfileIntervalUs = 1000;
+
+// A call in progress: `fn` is the callee's FnDecl (changed in place by a
+// tail call) and `site` the caller's statement that made the call.
+struct ProfileCall {
+  std::atomic<StmtId> fn;
+  StmtId site;
+  const ProfileCall* caller;
+};
+
+struct ProfileThread {
+  std::atomic<StmtId> stmt {kNoStmt};               // kNoStmt: not running Rivet code
+  std::atomic<const ProfileCall*> top {nullptr};
+};
+inline thread_local ProfileThread profile_thread;
+
+// Marks a statement as running for the guard's lifetime.
+class ProfileStmt {
+public:
+  explicit ProfileStmt(StmtId id) : on(profiling) {
+    if (!on) return;
+    saved = profile_thread.stmt.load(std::memory_order_relaxed);
+    profile_thread.stmt.store(id, std::memory_order_relaxed);
+  }
+  ~ProfileStmt() { if (on) profile_thread.stmt.store(saved, std::memory_order_relaxed); }
+  ProfileStmt(const ProfileStmt&) = delete;
+  ProfileStmt& operator=(const ProfileStmt&) = delete;
+
+private:
+  bool on;
+  StmtId saved {kNoStmt};
+};
+
+// Pushes a call to `fn` from the running statement for the guard's lifetime.
+// Until the body starts, and between tail calls, the callee's FnDecl is the
+// running statement: call overhead shows on the line the function starts.
+class ProfileScope {
+public:
+  explicit ProfileScope(StmtId fn) : on(profiling) {
+    if (!on) return;
+    call.fn.store(fn, std::memory_order_relaxed);
+    call.site = profile_thread.stmt.load(std::memory_order_relaxed);
+    call.caller = profile_thread.top.load(std::memory_order_relaxed);
+    profile_thread.top.store(&call, std::memory_order_release);
+    profile_thread.stmt.store(fn, std::memory_order_relaxed);
+  }
+  ~ProfileScope() {
+    if (!on) return;
+    profile_thread.top.store(call.caller, std::memory_order_relaxed);
+    profile_thread.stmt.store(call.site, std::memory_order_relaxed);
+  }
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  void retarget(StmtId fn) {
+    if (!on) return;
+    call.fn.store(fn, std::memory_order_relaxed);
+    profile_thread.stmt.store(fn, std::memory_order_relaxed);
+  }
+
+private:
+  bool on;
+  ProfileCall call {};
+};
+
+// Runs a parallel task on behalf of another thread: samples taken on this
+// one show the calls and statement of the thread that started the loop.
+class ProfileTask {
+public:
+  ProfileTask(const ProfileCall* top, StmtId stmt) : on(profiling) {
+    if (!on) return;
+    saved_top = profile_thread.top.load(std::memory_order_relaxed);
+    saved_stmt = profile_thread.stmt.load(std::memory_order_relaxed);
+    profile_thread.top.store(top, std::memory_order_release);
+    profile_thread.stmt.store(stmt, std::memory_order_relaxed);
+  }
+  ~ProfileTask() {
+    if (!on) return;
+    profile_thread.stmt.store(saved_stmt, std::memory_order_relaxed);
+    profile_thread.top.store(saved_top, std::memory_order_relaxed);
+  }
+  ProfileTask(const ProfileTask&) = delete;
+  ProfileTask& operator=(const ProfileTask&) = delete;
+
+private:
+  bool on;
+  const ProfileCall* saved_top {};
+  StmtId saved_stmt {kNoStmt};
+};
+
+// Sets `profiling` and arms the timer; profile_stop disarms it. Throws where
+// there is no SIGPROF.
+void profile_start();
+void profile_stop();
+
+// Flat tables of the samples by source line (`source` supplies each line's
+// text) and by function: self is the share of samples taken in the line or
+// function itself, total the share with it anywhere on the call stack.
+void profile_report(const Program& p, std::string_view file, std::string_view source, std::ostream& out);
+// One line per distinct call stack, "<main> (f:3);fib (f:2);fib (f:4) 17",
+// outermost first: the collapsed format flamegraph.pl and speedscope read.
+void profile_write_stacks(const Program& p, std::string_view file, std::ostream& out);
+
+}
@@ -0,0 +1,259 @@
+#include "resolver.hpp"
+#include <algorithm>
+#include <type_traits>
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+Resolver::Resolver(bool bind_globals_) : bind_globals(bind_globals_) {
+  Frame main;
+  main.scopes.emplace_back();
+  main.conditional = &main_conditional;
+  frames.push_back(std::move(main));
+}
+
+// ========== scan ==========
+// Collects, ahead of resolution, which names are declared where: a name that
+// some function declares can shadow a global for that function's callees,
+// and a conditional declaration (`while (c) let x = ...;`) makes every use of
+// that name in the same function depend on run-time control flow.
+void Resolver::scan(StmtId s, StmtId fn, bool top_level, bool conditional) {
+  auto declared = [&](Symbol name, bool top, bool cond) {
+    if (fn != kNoStmt) {
+      in_functions.insert(name);
+      if (cond) fn_conditional[fn].insert(name);
+    } else {
+      if (!top || cond) nested_in_main.insert(name);
+      if (cond) main_conditional.insert(name);
+    }
+  };
+
+  std::visit([&](auto const& node) {
+    using T = std::decay_t<decltype(node)>;
+    if constexpr (std::is_same_v<T, Let> || std::is_same_v<T, Var>) {
+      declared(node.name, top_level, conditional);
+    } else if constexpr (std::is_same_v<T, Block>) {
+      for (StmtId st : (*prog)[node.stmts]) scan(st, fn, false, false);
+    } else if constexpr (std::is_same_v<T, If>) {
+      scan(node.then_br, fn, top_level, true);
+      scan(node.else_br, fn, top_level, true);
+    } else if constexpr (std::is_same_v<T, While>) {
+      scan(node.body, fn, top_level, true);
+    } else if constexpr (std::is_same_v<T, ForC>) {
+      if (node.init != kNoStmt) scan(node.init, fn, false, false);
+      if (node.step != kNoStmt) scan(node.step, fn, false, false);
+      scan(node.body, fn, false, true);
+    } else if constexpr (std::is_same_v<T, ForIn>) {
+      declared(node.var, false, false);
+      scan(node.body, fn, false, true);
+    } else if constexpr (std::is_same_v<T, FnDecl>) {
+      fn_conditional[s];
+      declared_fns.insert(node.name);
+      for (Symbol p : (*prog)[node.params]) in_functions.insert(p);
+      scan(node.body, s, false, false);
+    }
+  }, (*prog)[s].node);
+}
+
+void Resolver::resolve(Program& p) {
+  prog = &p;
+  for (StmtId s : p.body) scan(s, kNoStmt, true, false);
+
+  // Top-level declarations get dedicated main-frame slots up front, so a
+  // Global reference never aliases a slot reused by some nested scope.
+  Frame& main = frames.front();
+  for (StmtId s : p.body) {
+    Symbol name = kNoSymbol;
+    if (auto* l = std::get_if<Let>(&p[s].node)) name = l->name;
+    else if (auto* v = std::get_if<Var>(&p[s].node)) name = v->name;
+    if (name != kNoSymbol && globals.try_emplace(name, main.top).second) ++main.top;
+  }
+  main.max = std::max(main.max, main.top);
+
+  for (StmtId s : p.body) stmt(s);
+  mark_tail_calls();
+}
+
+void Resolver::resolve(Program& p, StmtId s) {
+  prog = &p;
+  scan(s, kNoStmt, true, false);
+  stmt(s);
+  // A later line may add a Dynamic reference that pins an earlier function's
+  // frame, so every candidate is re-decided.
+  mark_tail_calls();
+}
+
+void Resolver::mark_tail_calls() {
+  for (auto [ret, fn] : tail_returns) {
+    bool pinned = false;
+    for (Symbol name : fn_names[fn]) pinned = pinned || dynamic_names.count(name);
+    std::get<Return>((*prog)[ret].node).tail = !pinned;
+  }
+}
+
+// ========== scopes ==========
+void Resolver::open_scope() {
+  Frame& f = frames.back();
+  Scope sc; sc.begin = f.top;
+  f.scopes.push_back(std::move(sc));
+}
+
+uint32_t Resolver::close_scope() {
+  Frame& f = frames.back();
+  uint32_t end = f.top;
+  f.top = f.scopes.back().begin;
+  f.scopes.pop_back();
+  return end;
+}
+
+uint32_t Resolver::declare(Symbol name) {
+  Frame& f = frames.back();
+  Scope& sc = f.scopes.back();
+  if (auto it = sc.names.find(name); it != sc.names.end()) return it->second;
+
+  uint32_t slot;
+  auto g = globals.find(name);
+  if (frames.size() == 1 && f.scopes.size() == 1 && g != globals.end()) {
+    slot = g->second;
+  } else {
+    slot = f.top++;
+    f.max = std::max(f.max, f.top);
+  }
+  sc.names.emplace(name, slot);
+  if (f.fn != kNoStmt) fn_names[f.fn].insert(name);
+  return slot;
+}
+
+VarRef Resolver::ref(Symbol name) {
+  const Frame& f = frames.back();
+  if (!f.conditional->count(name)) {
+    for (auto it = f.scopes.rbegin(); it != f.scopes.rend(); ++it) {
+      if (auto n = it->names.find(name); n != it->names.end()) return VarRef{RefKind::Local, n->second};
+    }
+  }
+  if (bind_globals && frames.size() > 1 && !in_functions.count(name) && !nested_in_main.count(name)) {
+    if (auto g = globals.find(name); g != globals.end()) return VarRef{RefKind::Global, g->second};
+  }
+  if (frames.size() > 1) dynamic_names.insert(name);
+  return VarRef{RefKind::Dynamic, 0};
+}
+
+// A function or native name, where no variable of that name can be in scope.
+bool Resolver::names_function(Symbol name) const {
+  if (!declared_fns.count(name) && find_native(name) == kNoNative) return false;
+  if (globals.count(name) || in_functions.count(name) || nested_in_main.count(name)) return false;
+  for (const Frame& f : frames)
+    for (const Scope& sc : f.scopes)
+      if (sc.names.count(name)) return false;
+  return true;
+}
+
+// ========== stmts ==========
+void Resolver::stmt(StmtId s) {
+  std::visit([&](auto& node) {
+    using T = std::decay_t<decltype(node)>;
+
+    if constexpr (std::is_same_v<T, Let> || std::is_same_v<T, Var>) {
+      expr(node.init);
+      node.slot = declare(node.name);
+
+    } else if constexpr (std::is_same_v<T, Assign>) {
+      expr(node.value);
+      node.ref = ref(node.name);
+
+    } else if constexpr (std::is_same_v<T, ExprStmt>) {
+      expr(node.expr);
+
+    } else if constexpr (std::is_same_v<T, Print>) {
+      expr(node.expr);
+
+    } else if constexpr (std::is_same_v<T, Block>) {
+      open_scope();
+      node.slot_begin = frames.back().top;
+      for (StmtId st : (*prog)[node.stmts]) stmt(st);
+      node.slot_end = close_scope();
+
+    } else if constexpr (std::is_same_v<T, If>) {
+      expr(node.cond);
+      stmt(node.then_br);
+      stmt(node.else_br);
+
+    } else if constexpr (std::is_same_v<T, While>) {
+      expr(node.cond);
+      stmt(node.body);
+
+    } else if constexpr (std::is_same_v<T, ForC>) {
+      open_scope();
+      node.slot_begin = frames.back().top;
+      if (node.init != kNoStmt) stmt(node.init);
+      if (node.cond != kNoExpr) expr(node.cond);
+      stmt(node.body);
+      if (node.step != kNoStmt) stmt(node.step);
+      node.slot_end = close_scope();
+
+    } else if constexpr (std::is_same_v<T, ForIn>) {
+      expr(node.iterable);
+      open_scope();
+      node.slot = declare(node.var);
+      stmt(node.body);
+      node.slot_end = close_scope();
+
+    } else if constexpr (std::is_same_v<T, FnDecl>) {
+      Frame f;
+      f.conditional = &fn_conditional[s];
+      f.fn = s;
+      f.scopes.emplace_back();
+      // Parameters are bound positionally; a repeated name refers to the last one.
+      auto params = (*prog)[node.params];
+      for (uint32_t i = 0; i < params.size(); ++i) f.scopes.back().names[params[i]] = i;
+      fn_names[s].insert(params.begin(), params.end());
+      f.top = f.max = node.params.size;
+      frames.push_back(std::move(f));
+      stmt(node.body);
+      node.frame_size = frames.back().max;
+      frames.pop_back();
+
+    } else if constexpr (std::is_same_v<T, Return>) {
+      expr(node.value);
+      StmtId fn = frames.back().fn;
+      auto* call = std::get_if<Call>(&(*prog)[node.value].node);
+      if (fn != kNoStmt && call && call->native == kNoNative) tail_returns.emplace_back(s, fn);
+
+    } else {
+      static_assert(always_false_v<T>, "Unhandled Stmt node");
+    }
+  }, (*prog)[s].node);
+}
+
+// ========== exprs ==========
+void Resolver::expr(ExprId e) {
+  std::visit([&](auto& node) {
+    using T = std::decay_t<decltype(node)>;
+    if constexpr (std::is_same_v<T, ArrayLit>) {
+      for (ExprId el : (*prog)[node.elems]) expr(el);
+    } else if constexpr (std::is_same_v<T, Grouping>) {
+      expr(node.inner);
+    } else if constexpr (std::is_same_v<T, Unary>) {
+      expr(node.right);
+    } else if constexpr (std::is_same_v<T, Binary>) {
+      expr(node.left); expr(node.right);
+    } else if constexpr (std::is_same_v<T, Variable>) {
+      node.ref = ref(node.name);
+    } else if constexpr (std::is_same_v<T, Call>) {
+      node.native = declared_fns.count(node.callee) ? kNoNative : find_native(node.callee);
+      bool callback = node.native != kNoNative && native(node.native).with_caller;
+      for (ExprId a : (*prog)[node.args]) {
+        auto* v = std::get_if<Variable>(&(*prog)[a].node);
+        if (callback && v && names_function(v->name)) {
+          prog->strings.emplace_back(symbol_name(v->name));
+          (*prog)[a].node = StringLit{static_cast<uint32_t>(prog->strings.size() - 1)};
+        } else {
+          expr(a);
+        }
+      }
+    }
+  }, (*prog)[e].node);
+}
+
+}
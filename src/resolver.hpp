@@ -0,0 +1,78 @@
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// Assigns every Let/Var/parameter/for-in variable a slot in its function's
+// flat frame and rewrites Variable/Assign references to use it.
+//
+// Scoping stays what Env always implemented: a name is looked up in the
+// innermost live scope of the current call, then in the caller's, and so on.
+// References that cannot be pinned statically (free names in a function
+// body, names declared conditionally such as `if (c) let x = 1;`) stay
+// Dynamic and are looked up by name at run time.
+//
+// A call binds to a native function (rivet/native.hpp) unless the program
+// declares a function of that name anywhere (in the REPL: on this line or an
+// earlier one). Passed to a native that calls back into the program, a bare
+// function name (`map(xs, f)`) becomes the string literal "f", unless a
+// variable of that name may be in scope.
+//
+// A `return f(...)` in a function body is marked as a tail call unless some
+// Dynamic reference could be looking for a name bound in that function's
+// frame: then the frame must stay visible while f runs.
+class Resolver {
+public:
+  // With bind_globals, free names in function bodies that only ever name an
+  // unconditional top-level declaration are bound to its main-frame slot. The
+  // REPL turns this off: a later line may still declare a shadowing function.
+  explicit Resolver(bool bind_globals = true);
+
+  void resolve(Program& p);
+  void resolve(Program& p, StmtId s);   // one more top-level statement (REPL)
+
+  uint32_t main_frame_size() const { return frames.front().max; }
+
+private:
+  using NameSet = std::unordered_set<Symbol>;
+
+  struct Scope {
+    std::unordered_map<Symbol, uint32_t> names;
+    uint32_t begin {};
+  };
+  struct Frame {
+    std::vector<Scope> scopes;
+    uint32_t top {}, max {};
+    const NameSet* conditional {};
+    StmtId fn {kNoStmt};
+  };
+
+  void scan(StmtId s, StmtId fn, bool top_level, bool conditional);
+
+  void stmt(StmtId s);
+  void expr(ExprId e);
+  void open_scope();
+  uint32_t close_scope();
+  uint32_t declare(Symbol name);
+  VarRef ref(Symbol name);
+  bool names_function(Symbol name) const;
+  void mark_tail_calls();
+
+  bool bind_globals;
+  Program* prog {};
+  std::vector<Frame> frames;                          // front() is the main program
+  std::unordered_map<Symbol, uint32_t> globals;       // pre-assigned top-level slots
+  NameSet in_functions;                               // declared anywhere in a function
+  NameSet nested_in_main;                             // declared in main below top level
+  std::unordered_map<StmtId, NameSet> fn_conditional;
+  NameSet main_conditional;
+  NameSet declared_fns;                               // names of every FnDecl seen
+  std::unordered_map<StmtId, NameSet> fn_names;       // bound in each function's frame
+  NameSet dynamic_names;                              // looked up by name from a function
+  std::vector<std::pair<StmtId, StmtId>> tail_returns;  // (return, enclosing function)
+};
+
+}
@@ -0,0 +1,61 @@
+#include "scan.hpp"
+#include <initializer_list>
+#include "scan_simd.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define RIVET_SCAN_X86 1
+#include <emmintrin.h>
+#else
+#define RIVET_SCAN_X86 0
+#endif
+
+namespace rivet {
+
+const ScanKernels* avx2_scan_kernels();   // scan_avx2.cpp; null when not built
+
+namespace {
+
+const ScanKernels kScalar {"scalar", scalar_run<is_space>, scalar_run<is_ident>, scalar_run<is_digit>, scalar_run<not_star>};
+
+#if RIVET_SCAN_X86
+struct Sse2 {
+  using V = __m128i;
+  static constexpr size_t width = 16;
+  static constexpr unsigned full = 0xFFFFu;
+  static V load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const V*>(p)); }
+  static V splat(char c) { return _mm_set1_epi8(c); }
+  static V eq(V a, V b) { return _mm_cmpeq_epi8(a, b); }
+  static V either(V a, V b) { return _mm_or_si128(a, b); }
+  static V sub(V a, V b) { return _mm_sub_epi8(a, b); }
+  static V min_u8(V a, V b) { return _mm_min_epu8(a, b); }
+  static unsigned mask(V m) { return static_cast<unsigned>(_mm_movemask_epi8(m)); }
+};
+
+const ScanKernels kSse2 = vector_kernels<Sse2>("sse2");
+#endif
+
+}
+
+const ScanKernels* scan_kernels(ScanLevel level) {
+  switch (level) {
+    case ScanLevel::Scalar: return &kScalar;
+#if RIVET_SCAN_X86
+    case ScanLevel::SSE2: return &kSse2;      // part of the x86-64 baseline
+    case ScanLevel::AVX2: return __builtin_cpu_supports("avx2") ? avx2_scan_kernels() : nullptr;
+#else
+    default: return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+const ScanKernels& scan_kernels() {
+  static const ScanKernels& best = []() -> const ScanKernels& {
+    for (ScanLevel l : {ScanLevel::AVX2, ScanLevel::SSE2})
+      if (const ScanKernels* k = scan_kernels(l)) return *k;
+    return kScalar;
+  }();
+  return best;
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+
+namespace rivet {
+
+// Byte-run scanners behind the lexer's hot loops. Each returns how many
+// leading bytes of [p, end) belong to the run; none reads past `end`.
+struct ScanKernels {
+  const char* name;
+  size_t (*space)(const char* p, const char* end);      // ' ' '\t' '\r' '\n'
+  size_t (*ident)(const char* p, const char* end);      // [A-Za-z0-9_]
+  size_t (*digits)(const char* p, const char* end);     // [0-9]
+  size_t (*to_star)(const char* p, const char* end);    // bytes before the next '*'
+};
+
+enum class ScanLevel { Scalar, SSE2, AVX2 };
+
+// The widest kernels this CPU supports, chosen on first use.
+const ScanKernels& scan_kernels();
+// Kernels for a specific level, or nullptr when the CPU or build lacks it.
+const ScanKernels* scan_kernels(ScanLevel level);
+
+}
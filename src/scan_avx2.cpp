@@ -0,0 +1,36 @@
+// Built with -mavx2 (see CMakeLists.txt); only called after a CPUID check.
+#include "scan.hpp"
+#include "scan_simd.hpp"
+
+#if defined(__AVX2__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+namespace rivet {
+
+#if defined(__AVX2__) && defined(__GNUC__)
+namespace {
+
+struct Avx2 {
+  using V = __m256i;
+  static constexpr size_t width = 32;
+  static constexpr unsigned full = 0xFFFFFFFFu;
+  static V load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+  static V splat(char c) { return _mm256_set1_epi8(c); }
+  static V eq(V a, V b) { return _mm256_cmpeq_epi8(a, b); }
+  static V either(V a, V b) { return _mm256_or_si256(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_epi8(a, b); }
+  static V min_u8(V a, V b) { return _mm256_min_epu8(a, b); }
+  static unsigned mask(V m) { return static_cast<unsigned>(_mm256_movemask_epi8(m)); }
+};
+
+const ScanKernels kAvx2 = vector_kernels<Avx2>("avx2");
+
+}
+
+const ScanKernels* avx2_scan_kernels() { return &kAvx2; }
+#else
+const ScanKernels* avx2_scan_kernels() { return nullptr; }
+#endif
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+// Shared by scan.cpp (scalar, SSE2) and scan_avx2.cpp, which is built with
+// -mavx2. Everything here has internal linkage so the two translation units
+// never share a function compiled for the wider ISA.
+#include <cstddef>
+
+namespace rivet {
+namespace {
+
+// ========== scalar ==========
+inline bool is_space(unsigned char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+inline bool is_digit(unsigned char c) { return static_cast<unsigned char>(c - '0') < 10; }
+inline bool is_ident(unsigned char c) {
+  return static_cast<unsigned char>((c | 0x20) - 'a') < 26 || is_digit(c) || c == '_';
+}
+inline bool not_star(unsigned char c) { return c != '*'; }
+
+template<bool (*Pred)(unsigned char)> size_t scalar_run(const char* p, const char* end) {
+  const char* s = p;
+  while (p < end && Pred(static_cast<unsigned char>(*p))) ++p;
+  return static_cast<size_t>(p - s);
+}
+
+#if defined(__GNUC__)
+// ========== vector ==========
+// S wraps one vector ISA (see scan.cpp / scan_avx2.cpp). Each chunk is
+// classified into a bitmask of bytes that continue the run; the first clear
+// bit ends it. Bytes after the last full chunk take the scalar loop.
+//
+// Range tests use unsigned wraparound: c in [lo, lo + n) iff
+// (c - lo) <=u n - 1, and a <=u b iff min_epu8(a, b) == a.
+template<class S> struct Classes {
+  using V = typename S::V;
+  static V in_range(V c, char lo, char n) {
+    V t = S::sub(c, S::splat(lo));
+    return S::eq(S::min_u8(t, S::splat(static_cast<char>(n - 1))), t);
+  }
+  static V space(V c) {
+    return S::either(S::either(S::eq(c, S::splat(' ')), S::eq(c, S::splat('\t'))),
+                     S::either(S::eq(c, S::splat('\r')), S::eq(c, S::splat('\n'))));
+  }
+  static V digits(V c)  { return in_range(c, '0', 10); }
+  static V ident(V c)   { return S::either(S::either(in_range(S::either(c, S::splat(0x20)), 'a', 26), digits(c)), S::eq(c, S::splat('_'))); }
+  static V to_star(V c) { return S::eq(S::eq(c, S::splat('*')), S::splat(0)); }
+};
+
+template<class S, typename S::V (*Class)(typename S::V), bool (*Pred)(unsigned char)>
+size_t vector_run(const char* p, const char* end) {
+  const char* s = p;
+  while (static_cast<size_t>(end - p) >= S::width) {
+    unsigned m = S::mask(Class(S::load(p)));
+    if (m != S::full) return static_cast<size_t>(p - s) + static_cast<size_t>(__builtin_ctz(~m));
+    p += S::width;
+  }
+  return static_cast<size_t>(p - s) + scalar_run<Pred>(p, end);
+}
+
+template<class S> ScanKernels vector_kernels(const char* name) {
+  return ScanKernels{name,
+    vector_run<S, Classes<S>::space,   is_space>,
+    vector_run<S, Classes<S>::ident,   is_ident>,
+    vector_run<S, Classes<S>::digits,  is_digit>,
+    vector_run<S, Classes<S>::to_star, not_star>};
+}
+#endif
+
+}
+}
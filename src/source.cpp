@@ -0,0 +1,47 @@
+#include "source.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RIVET_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define RIVET_HAVE_MMAP 0
+#endif
+
+namespace rivet {
+
+SourceFile::SourceFile(const std::string& path) {
+#if RIVET_HAVE_MMAP
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Could not open file: " + path);
+  struct stat st {};
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size_t len = static_cast<size_t>(st.st_size);
+    void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      ::madvise(p, len, MADV_SEQUENTIAL);
+      data = static_cast<const char*>(p); size = len; mapped = true;
+    }
+  }
+  ::close(fd);
+  if (mapped) return;
+#endif
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Could not open file: " + path);
+  std::ostringstream ss; ss << in.rdbuf();
+  buffer = ss.str();
+  data = buffer.data(); size = buffer.size();
+}
+
+SourceFile::~SourceFile() {
+#if RIVET_HAVE_MMAP
+  if (mapped) ::munmap(const_cast<char*>(data), size);
+#endif
+}
+
+}
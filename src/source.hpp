@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace rivet {
+
+// A read-only source file. Regular files are memory-mapped, so the lexer
+// scans the page cache directly; anything mmap cannot handle (pipes, empty
+// files, non-POSIX hosts) is read into memory instead.
+class SourceFile {
+public:
+  explicit SourceFile(const std::string& path);
+  ~SourceFile();
+  SourceFile(const SourceFile&) = delete;
+  SourceFile& operator=(const SourceFile&) = delete;
+
+  std::string_view text() const { return {data, size}; }
+
+private:
+  const char* data {};
+  size_t      size {};
+  bool        mapped {};
+  std::string buffer;
+};
+
+}
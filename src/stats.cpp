@@ -0,0 +1,285 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#define RIVET_HAVE_PERF_EVENT 1
+#include <cerrno>
+#include <cstdio>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define RIVET_HAVE_PERF_EVENT 0
+#endif
+
+namespace rivet {
+
+namespace {
+
+// In the order of Stmt::node's and Expr::node's alternatives.
+constexpr const char* kStmtNames[] = {
+  "let", "var", "assign", "expr", "block", "if", "while", "print", "fn", "return", "for_in", "for_c"};
+constexpr const char* kExprNames[] = {
+  "number", "bool", "string", "array", "grouping", "unary", "binary", "variable", "call"};
+static_assert(std::size(kStmtNames) == kStmtKinds && std::size(kExprNames) == kExprKinds);
+constexpr const char* kDepthNames[kDepthBuckets] = {"1", "2", "3", "4", "5-8", "9-16", "17+", "unbound"};
+
+std::mutex registry_m;
+std::vector<std::unique_ptr<RunCounters>> blocks;   // one per thread that counted
+std::chrono::steady_clock::time_point t0;
+double wall_ms = 0;
+
+// One hardware counter; `fd` is -1 when it could not be opened, `error`
+// saying why.
+struct HwCounter {
+  const char* name;
+  const char* key;
+  uint32_t type;
+  uint64_t config;
+  int fd {-1};
+  std::string error {};
+  uint64_t value {};
+  bool scaled {};                    // shared the PMU with other events; value extrapolated
+};
+
+// hw[0] and hw[1] are cycles and instructions, for the ratio of the two.
+#if RIVET_HAVE_PERF_EVENT
+constexpr uint64_t cache_miss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+HwCounter hw[] = {
+  {"cycles",          "cycles",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions",    "instructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"branch misses",   "branch_misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"L1D load misses", "l1d_load_misses", PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+  {"LLC load misses", "llc_load_misses", PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+};
+#else
+HwCounter hw[] = {
+  {"cycles",          "cycles",          0, 0},
+  {"instructions",    "instructions",    0, 0},
+  {"branch misses",   "branch_misses",   0, 0},
+  {"L1D load misses", "l1d_load_misses", 0, 0},
+  {"LLC load misses", "llc_load_misses", 0, 0},
+};
+#endif
+
+#if RIVET_HAVE_PERF_EVENT
+std::string open_error(int err) {
+  if (err == ENOENT || err == EOPNOTSUPP || err == ENODEV) return "not supported here (no PMU, e.g. in a VM)";
+  if (err == ENOSYS) return "perf_event_open not available";
+  std::string why = std::strerror(err);
+  if (err == EACCES || err == EPERM) {
+    if (FILE* f = std::fopen("/proc/sys/kernel/perf_event_paranoid", "r")) {
+      int level = 0;
+      if (std::fscanf(f, "%d", &level) == 1) why += " (kernel.perf_event_paranoid is " + std::to_string(level) + ")";
+      std::fclose(f);
+    }
+  }
+  return why;
+}
+
+// User-space events of the calling thread only: what the paranoid levels
+// below 3 still allow an unprivileged process.
+void hw_open(HwCounter& c) {
+  perf_event_attr attr {};
+  attr.size = sizeof attr;
+  attr.type = c.type;
+  attr.config = c.config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0) { c.error = open_error(errno); return; }
+  c.fd = static_cast<int>(fd);
+}
+
+void hw_read(HwCounter& c) {
+  uint64_t v[3];                     // value, time enabled, time running
+  if (read(c.fd, v, sizeof v) != static_cast<ssize_t>(sizeof v)) { c.error = "read failed"; return; }
+  c.value = v[0];
+  if (v[2] && v[2] < v[1]) {
+    c.value = static_cast<uint64_t>(static_cast<double>(v[0]) * static_cast<double>(v[1]) / static_cast<double>(v[2]));
+    c.scaled = true;
+  } else if (!v[2]) {
+    c.error = "never scheduled";
+  }
+}
+#endif
+
+RunCounters total() {
+  RunCounters t {};
+  std::lock_guard<std::mutex> lk(registry_m);
+  for (const auto& b : blocks) {
+    const uint64_t* from = reinterpret_cast<const uint64_t*>(b.get());
+    uint64_t* to = reinterpret_cast<uint64_t*>(&t);
+    for (size_t i = 0; i < sizeof(RunCounters) / sizeof(uint64_t); ++i) to[i] += from[i];
+  }
+  return t;
+}
+
+uint64_t sum(const uint64_t* v, size_t n) {
+  uint64_t s = 0;
+  for (size_t i = 0; i < n; ++i) s += v[i];
+  return s;
+}
+
+// "1,234,567"
+std::string grouped(uint64_t n) {
+  std::string digits = std::to_string(n), out;
+  for (size_t i = 0; i < digits.size(); ++i) {
+    if (i && (digits.size() - i) % 3 == 0) out += ',';
+    out += digits[i];
+  }
+  return out;
+}
+
+void row(std::ostream& out, const std::string& name, uint64_t n, int indent = 2) {
+  out << std::string(static_cast<size_t>(indent), ' ') << std::left << std::setw(28 - indent) << name << std::right
+      << std::setw(16) << grouped(n) << "\n";
+}
+
+// Nonzero kinds only, most frequent first.
+template<size_t N> void by_kind(std::ostream& out, const uint64_t (&counts)[N], const char* const (&names)[N]) {
+  std::vector<size_t> order;
+  for (size_t i = 0; i < N; ++i) if (counts[i]) order.push_back(i);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return counts[a] > counts[b]; });
+  for (size_t i : order) row(out, names[i], counts[i], 4);
+}
+
+template<size_t N> void json_kinds(std::ostream& out, const uint64_t (&counts)[N], const char* const (&names)[N]) {
+  out << "{";
+  for (size_t i = 0; i < N; ++i) out << (i ? "," : "") << "\"" << names[i] << "\":" << counts[i];
+  out << "}";
+}
+
+}
+
+RunCounters& run_counters_slow() {
+  std::lock_guard<std::mutex> lk(registry_m);
+  return *(run_counters_local = blocks.emplace_back(std::make_unique<RunCounters>()).get());
+}
+
+void count_dynamic_lookup(size_t frames) {
+  size_t bucket = frames == 0 ? 7 : frames <= 4 ? frames - 1 : frames <= 8 ? 4 : frames <= 16 ? 5 : 6;
+  ++run_counters().dynamic_depth[bucket];
+}
+
+void stats_start() {
+#if RIVET_HAVE_PERF_EVENT
+  for (HwCounter& c : hw) hw_open(c);
+  for (HwCounter& c : hw) if (c.fd >= 0) ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  counting = true;
+  t0 = std::chrono::steady_clock::now();
+}
+
+void stats_stop() {
+  wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  counting = false;
+#if RIVET_HAVE_PERF_EVENT
+  for (HwCounter& c : hw) {
+    if (c.fd < 0) continue;
+    ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+    hw_read(c);
+    close(c.fd);
+    c.fd = -1;
+  }
+#else
+  for (HwCounter& c : hw) c.error = "needs Linux perf_event_open";
+#endif
+}
+
+void stats_report(std::ostream& out, bool json) {
+  RunCounters t = total();
+  uint64_t stmts = sum(t.stmts, kStmtKinds), exprs = sum(t.exprs, kExprKinds);
+  uint64_t dynamic = sum(t.dynamic_depth, kDepthBuckets);
+  const HwCounter& cycles = hw[0];
+  const HwCounter& instructions = hw[1];
+
+  if (json) {
+    out << "{\"wall_ms\":" << std::fixed << std::setprecision(3) << wall_ms << std::defaultfloat
+        << ",\"statements\":" << stmts << ",\"statements_by_kind\":";
+    json_kinds(out, t.stmts, kStmtNames);
+    out << ",\"expressions\":" << exprs << ",\"expressions_by_kind\":";
+    json_kinds(out, t.exprs, kExprNames);
+    out << ",\"variables\":{\"local\":" << t.local_reads << ",\"global\":" << t.global_reads
+        << ",\"dynamic\":" << dynamic << ",\"dynamic_frames_searched\":";
+    json_kinds(out, t.dynamic_depth, kDepthNames);
+    out << "},\"frames\":{\"entered\":" << t.frames_entered << ",\"left\":" << t.frames_left
+        << ",\"reused\":" << t.frames_reused << ",\"scopes_left\":" << t.scopes_left << "}"
+        << ",\"calls\":{\"functions\":" << t.calls << ",\"memo_hits\":" << t.memo_hits
+        << ",\"compiled\":" << t.compiled_calls << ",\"builtins\":" << t.native_calls << "}"
+        << ",\"binary_ops\":{\"type_checks\":" << t.type_checks << ",\"specialized\":" << t.specialized_ops
+        << ",\"generic\":" << t.generic_ops << ",\"deopts\":" << t.deopts << "},\"hardware\":{";
+    bool first = true;
+    for (const HwCounter& c : hw) {
+      out << (first ? "" : ",") << "\"" << c.key << "\":";
+      if (c.error.empty()) out << c.value;
+      else out << "null";
+      first = false;
+    }
+    out << "}}\n" << std::setprecision(6);
+    return;
+  }
+
+  out << "stats: " << std::fixed << std::setprecision(1) << wall_ms << " ms wall\n" << std::defaultfloat;
+  row(out, "statements", stmts, 0);
+  by_kind(out, t.stmts, kStmtNames);
+  row(out, "expressions", exprs, 0);
+  by_kind(out, t.exprs, kExprNames);
+  row(out, "variable accesses", t.local_reads + t.global_reads + dynamic, 0);
+  row(out, "local slot", t.local_reads);
+  row(out, "global slot", t.global_reads);
+  row(out, "dynamic", dynamic);
+  for (size_t i = 0; i < kDepthBuckets; ++i) {
+    std::string what = i + 1 == kDepthBuckets ? "unbound" : std::string("found ") + kDepthNames[i] + (i ? " frames up" : " frame up");
+    if (t.dynamic_depth[i]) row(out, what, t.dynamic_depth[i], 4);
+  }
+  row(out, "frames entered", t.frames_entered, 0);
+  row(out, "left", t.frames_left);
+  row(out, "reused by tail calls", t.frames_reused);
+  row(out, "block scopes left", t.scopes_left, 0);
+  row(out, "function calls", t.calls, 0);
+  row(out, "memo hits", t.memo_hits);
+  row(out, "run compiled (--jit)", t.compiled_calls);
+  row(out, "builtin calls", t.native_calls, 0);
+  row(out, "binary operand type checks", t.type_checks, 0);
+  row(out, "specialized", t.specialized_ops);
+  row(out, "generic", t.generic_ops);
+  row(out, "deopts", t.deopts);
+
+  bool same_error = true;
+  for (const HwCounter& c : hw) same_error = same_error && !c.error.empty() && c.error == hw[0].error;
+  if (same_error) {
+    out << "hardware counters: unavailable: " << hw[0].error << "\n" << std::setprecision(6);
+    return;
+  }
+  out << "hardware counters (main thread, user space):\n";
+  for (const HwCounter& c : hw) {
+    if (!c.error.empty()) {
+      out << "  " << std::left << std::setw(26) << c.name << std::right << "  unavailable: " << c.error << "\n";
+      continue;
+    }
+    out << "  " << std::left << std::setw(26) << c.name << std::right << std::setw(16) << grouped(c.value);
+    if (&c == &instructions && cycles.error.empty() && cycles.value)
+      out << "  " << std::fixed << std::setprecision(2)
+          << static_cast<double>(instructions.value) / static_cast<double>(cycles.value) << " per cycle" << std::defaultfloat;
+    if (c.scaled) out << "  (scaled)";
+    out << "\n";
+  }
+  out << std::setprecision(6);
+}
+
+}
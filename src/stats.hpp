@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <variant>
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// ========== Run counters (rvt run --stats) ==========
+// What the tree walker did while `counting` is set: statements and
+// expressions by kind, variable accesses, frames, calls and the operand
+// type checks of binary operators. Each thread counts into a block of its
+// own, so counting takes no locks; stats_report adds the blocks up. With
+// `counting` off, every counting point is one flag test.
+inline bool counting = false;
+
+inline constexpr size_t kStmtKinds = std::variant_size_v<decltype(Stmt::node)>;
+inline constexpr size_t kExprKinds = std::variant_size_v<decltype(Expr::node)>;
+// Dynamic lookups by frames searched: 1, 2, 3, 4, 5-8, 9-16, 17+, unbound.
+inline constexpr size_t kDepthBuckets = 8;
+
+struct RunCounters {
+  uint64_t stmts[kStmtKinds];         // by Stmt::node index
+  uint64_t exprs[kExprKinds];         // by Expr::node index
+  uint64_t local_reads, global_reads; // resolved slot accesses
+  uint64_t dynamic_depth[kDepthBuckets];
+  uint64_t frames_entered, frames_left, frames_reused, scopes_left;
+  uint64_t calls, memo_hits, compiled_calls, native_calls;
+  uint64_t type_checks, specialized_ops, generic_ops, deopts;
+};
+
+RunCounters& run_counters_slow();
+inline thread_local RunCounters* run_counters_local = nullptr;
+// This thread's counters; only touch them while `counting`.
+inline RunCounters& run_counters() { return run_counters_local ? *run_counters_local : run_counters_slow(); }
+
+// Records a dynamic lookup that searched `frames` frames; 0 if it found nothing.
+void count_dynamic_lookup(size_t frames);
+
+// Sets `counting`, starts the clock and, on Linux, the hardware counters of
+// the calling thread: cycles, instructions, branch misses, L1 data cache and
+// last-level cache load misses. Counters the kernel refuses are reported
+// as unavailable, with the reason; the run goes ahead either way.
+void stats_start();
+void stats_stop();
+// Call once every counting thread is idle. Human-readable, or one JSON
+// object with `json`.
+void stats_report(std::ostream& out, bool json);
+
+}
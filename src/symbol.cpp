@@ -0,0 +1,40 @@
+#include "rivet/symbol.hpp"
+#include <deque>
+#include <unordered_map>
+
+namespace rivet {
+
+namespace {
+
+struct SymbolTable {
+  std::deque<std::string> names {std::string{}};        // id 0 is kNoSymbol
+  std::unordered_map<std::string_view, Symbol> ids;     // views into `names`
+};
+
+SymbolTable& table() {
+  static SymbolTable t;
+  return t;
+}
+
+}
+
+Symbol intern(std::string_view name) {
+  SymbolTable& t = table();
+  if (auto it = t.ids.find(name); it != t.ids.end()) return it->second;
+  Symbol id = static_cast<Symbol>(t.names.size());
+  t.names.emplace_back(name);
+  t.ids.emplace(t.names.back(), id);
+  return id;
+}
+
+Symbol find_symbol(std::string_view name) {
+  const SymbolTable& t = table();
+  auto it = t.ids.find(name);
+  return it != t.ids.end() ? it->second : kNoSymbol;
+}
+
+const std::string& symbol_name(Symbol s) { return table().names[s]; }
+
+size_t symbol_count() { return table().names.size(); }
+
+}
@@ -0,0 +1,137 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace rivet {
+
+template<class> inline constexpr bool always_false_v = false;
+
+namespace {
+
+struct Event {
+  uint64_t ns;                       // since trace_start
+  uint32_t id;
+  TraceKind kind;
+  char phase;                        // 'B' or 'E'
+  uint16_t argc;
+};
+
+// One thread's events. Only its thread writes to it; it is read once that
+// thread is idle.
+struct Ring {
+  std::unique_ptr<Event[]> events {new Event[kTraceEvents]};
+  uint64_t next {};                  // events recorded, overwritten ones included
+};
+
+std::mutex registry_m;
+std::vector<std::unique_ptr<Ring>> rings;   // by thread, in order of first event
+thread_local Ring* local = nullptr;
+std::chrono::steady_clock::time_point t0;
+
+Ring& ring() {
+  if (!local) {
+    std::lock_guard<std::mutex> lk(registry_m);
+    local = rings.emplace_back(std::make_unique<Ring>()).get();
+  }
+  return *local;
+}
+
+const char* stmt_kind(const Stmt& s) {
+  return std::visit([](auto const& n) -> const char* {
+    using T = std::decay_t<decltype(n)>;
+    if constexpr (std::is_same_v<T, Let>)           return "let";
+    else if constexpr (std::is_same_v<T, Var>)      return "var";
+    else if constexpr (std::is_same_v<T, Assign>)   return "assign";
+    else if constexpr (std::is_same_v<T, ExprStmt>) return "expr";
+    else if constexpr (std::is_same_v<T, Block>)    return "block";
+    else if constexpr (std::is_same_v<T, If>)       return "if";
+    else if constexpr (std::is_same_v<T, While>)    return "while";
+    else if constexpr (std::is_same_v<T, Print>)    return "print";
+    else if constexpr (std::is_same_v<T, FnDecl>)   return "fn";
+    else if constexpr (std::is_same_v<T, Return>)   return "return";
+    else if constexpr (std::is_same_v<T, ForIn>)    return "for";
+    else if constexpr (std::is_same_v<T, ForC>)     return "for";
+    else { static_assert(always_false_v<T>, "Unhandled Stmt node"); return ""; }
+  }, s.node);
+}
+
+std::string event_name(const Program& p, TraceKind kind, uint32_t id) {
+  switch (kind) {
+    case TraceKind::Call:   return symbol_name(std::get<FnDecl>(p[static_cast<StmtId>(id)].node).name);
+    case TraceKind::Native: return symbol_name(native(id).name);
+    case TraceKind::Stmt:
+    case TraceKind::Loop:   break;
+  }
+  // "while body (line 12)", "print (line 3)"
+  StmtId s = static_cast<StmtId>(id);
+  return std::string(stmt_kind(p[s])) + (kind == TraceKind::Loop ? " body" : "")
+         + " (line " + std::to_string(p.pos(s).line) + ")";
+}
+
+const char* category(TraceKind kind) {
+  switch (kind) {
+    case TraceKind::Call:   return "call";
+    case TraceKind::Native: return "native";
+    case TraceKind::Stmt:   return "stmt";
+    case TraceKind::Loop:   return "loop";
+  }
+  return "";
+}
+
+}
+
+void trace_event(TraceKind kind, char phase, uint32_t id, uint32_t argc) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+  Ring& r = ring();
+  r.events[r.next++ & (kTraceEvents - 1)] =
+    Event{static_cast<uint64_t>(ns), id, kind, phase, static_cast<uint16_t>(std::min<uint32_t>(argc, UINT16_MAX))};
+}
+
+void trace_start(bool stmts) {
+  t0 = std::chrono::steady_clock::now();
+  (void)ring();                      // the calling thread is tid 0
+  tracing = true;
+  tracing_stmts = stmts;
+}
+
+void trace_stop() { tracing = tracing_stmts = false; }
+
+uint64_t trace_write(const Program& p, std::ostream& out) {
+  std::lock_guard<std::mutex> lk(registry_m);
+  uint64_t written = 0;
+  char ts[32];
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  bool first = true;
+  for (size_t tid = 0; tid < rings.size(); ++tid) {
+    const Ring& r = *rings[tid];
+    out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+        << ",\"args\":{\"name\":\"" << (tid == 0 ? "main" : "worker " + std::to_string(tid)) << "\"}}";
+    first = false;
+    // Once a ring has wrapped, the oldest events left may end spans whose
+    // begin was overwritten; those are skipped.
+    uint64_t begin = r.next > kTraceEvents ? r.next - kTraceEvents : 0;
+    size_t depth = 0;
+    for (uint64_t i = begin; i < r.next; ++i) {
+      const Event& e = r.events[i & (kTraceEvents - 1)];
+      if (e.phase == 'E' && depth == 0) continue;
+      depth = e.phase == 'B' ? depth + 1 : depth - 1;
+      std::snprintf(ts, sizeof ts, "%.3f", static_cast<double>(e.ns) / 1000.0);
+      out << ",\n{\"name\":\"" << event_name(p, e.kind, e.id) << "\",\"cat\":\"" << category(e.kind)
+          << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << tid;
+      if (e.phase == 'B' && (e.kind == TraceKind::Call || e.kind == TraceKind::Native))
+        out << ",\"args\":{\"argc\":" << e.argc << "}";
+      out << "}";
+      ++written;
+    }
+  }
+  out << "\n]}\n";
+  return written;
+}
+
+}
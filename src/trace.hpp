@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include "rivet/ast.hpp"
+
+namespace rivet {
+
+// ========== Event trace (rvt run --trace) ==========
+// Begin and end events for every call the tree walker makes and, with
+// `tracing_stmts`, for each top-level statement and each iteration of a
+// loop body. Each thread appends to a ring of its own: no locks and no
+// atomics, one clock read and a 16-byte store per event. A ring keeps its
+// thread's last kTraceEvents events, so a long run costs bounded memory and
+// the trace shows how it ended. trace_write turns the rings into Chrome
+// trace-event JSON, which Perfetto and chrome://tracing load.
+inline bool tracing = false;
+inline bool tracing_stmts = false;
+inline constexpr uint32_t kTraceEvents = 1u << 20;      // per thread; a power of two
+
+// What an event's id is: a FnDecl, a native, a top-level statement or a loop.
+enum class TraceKind : uint8_t { Call, Native, Stmt, Loop };
+
+void trace_event(TraceKind kind, char phase, uint32_t id, uint32_t argc);
+
+// A begin event now and the matching end event when the span goes out of
+// scope, unwinding included. Does nothing unless `on`.
+class TraceSpan {
+public:
+  TraceSpan(bool on, TraceKind kind, uint32_t id, uint32_t argc = 0) : on(on), kind(kind), id(id) {
+    if (on) trace_event(kind, 'B', id, argc);
+  }
+  ~TraceSpan() { if (on) trace_event(kind, 'E', id, 0); }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  // A tail call: ends this span and begins one for the new callee.
+  void retarget(uint32_t next, uint32_t argc) {
+    if (!on) return;
+    trace_event(kind, 'E', id, 0);
+    id = next;
+    trace_event(kind, 'B', id, argc);
+  }
+
+private:
+  bool on;
+  TraceKind kind;
+  uint32_t id;
+};
+
+// Sets `tracing` (and `tracing_stmts` with `stmts`) and starts the clock at 0.
+void trace_start(bool stmts);
+void trace_stop();
+// Call once every traced thread is idle, e.g. when the program has finished.
+// Returns the number of events written.
+uint64_t trace_write(const Program& p, std::ostream& out);
+
+}
@@ -0,0 +1,128 @@
+#include "rivet/value.hpp"
+#include "heap.hpp"
+#include <chrono>
+#include <functional>
+#include <type_traits>
+
+namespace rivet {
+
+namespace {
+
+// What a string's buffer takes beyond the StrObj: nothing while it fits in
+// the std::string itself.
+size_t buffer_bytes(const std::string& s) {
+  static const size_t inline_capacity = std::string().capacity();
+  return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+void charge(StrObj* s) {
+  s->charged = true;
+  mem_charge(MemKind::Strings, sizeof(StrObj), 1);
+  if (!s->base) mem_recharge(MemKind::StringBytes, s->buf_charged, buffer_bytes(s->buf));
+}
+
+void charge(Array* a) {
+  a->charged = true;
+  mem_charge(MemKind::Arrays, sizeof(Array), 1);
+  a->recharge();
+}
+
+template<class T> void discharge(T* o, MemKind header) {
+  mem_charge(header, -static_cast<int64_t>(sizeof(T)), 0);
+  if constexpr (std::is_same_v<T, Array>) mem_recharge(MemKind::ArrayItems, o->items_charged, 0);
+  else mem_recharge(MemKind::StringBytes, o->buf_charged, 0);
+}
+
+}
+
+void Array::recharge_items() { mem_recharge(MemKind::ArrayItems, items_charged, items.capacity() * sizeof(Value)); }
+
+Value::Value(std::string s) : Value(new StrObj(std::move(s)), kStringTag) {
+  if (mem_tracking) charge(reinterpret_cast<StrObj*>(bits & kPtrMask));
+}
+
+Value Value::array(std::vector<Value> items) {
+  auto* a = new Array();
+  a->items = std::move(items);
+  if (mem_tracking) charge(a);
+  return Value(a, kArrayTag);
+}
+
+Value Value::character(unsigned char c) {
+  static const std::vector<Value> table = [] {
+    std::vector<Value> t;
+    for (int i = 0; i < 256; ++i) t.emplace_back(std::string(1, static_cast<char>(i)));
+    return t;
+  }();
+  return table[c];
+}
+
+Array* Value::mutable_array() {
+  Array* a = array_ptr();
+  if (a->count() > 1) {
+    *this = array(a->items);
+    a = array_ptr();
+  }
+  a->shape = Array::Shape::Unknown;
+  return a;
+}
+
+Value Value::concat(const Value& l, std::string_view r) {
+  auto* s = reinterpret_cast<StrObj*>(l.bits & kPtrMask);
+  StrObj* owner = s->owner();
+  std::string& buf = owner->buf;
+  if (threads_active || buf.size() != s->len) {
+    // Not the tip: someone already appended past this prefix. Workers never
+    // append in place: another one may be reading the same buffer.
+    std::string out;
+    out.reserve(s->len + r.size());
+    out.append(buf.data(), s->len).append(r);
+    return Value(std::move(out));
+  }
+  // `s + s` hands us a view into the buffer we are about to grow.
+  std::less<const char*> lt;
+  if (!lt(r.data(), buf.data()) && lt(r.data(), buf.data() + buf.size())) {
+    std::string copy(r);
+    buf.append(copy);
+  } else {
+    buf.append(r);
+  }
+  if (owner->charged) mem_recharge(MemKind::StringBytes, owner->buf_charged, buffer_bytes(buf));
+  auto* tip = new StrObj(owner, buf.size());
+  if (mem_tracking) charge(tip);
+  return Value(tip, kStringTag);
+}
+
+void Value::destroy(Obj* o) {
+  switch (o->kind) {
+    case Obj::Kind::String: {
+      auto* s = static_cast<StrObj*>(o);
+      StrObj* owner = s->base;
+      if (s->charged) discharge(s, MemKind::Strings);
+      delete s;
+      if (owner && owner->release()) {
+        if (owner->charged) discharge(owner, MemKind::Strings);
+        delete owner;
+      }
+      return;
+    }
+    case Obj::Kind::Array: {
+      auto* a = static_cast<Array*>(o);
+      if (a->charged) discharge(a, MemKind::Arrays);
+      // Freeing a large array frees everything only it held on to, in one go:
+      // the pause a collector would have. Nested releases count toward the
+      // outermost one.
+      thread_local bool timing = false;
+      if (!heap_timing || timing || a->items.size() < kTimedRelease) { delete a; return; }
+      timing = true;
+      auto start = std::chrono::steady_clock::now();
+      delete a;
+      heap_record_release(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count()));
+      timing = false;
+      return;
+    }
+  }
+}
+
+}
@@ -0,0 +1,78 @@
+#include "vec.hpp"
+#include <initializer_list>
+#include "vec_simd.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define RIVET_VEC_X86 1
+#include <emmintrin.h>
+#else
+#define RIVET_VEC_X86 0
+#endif
+
+namespace rivet {
+
+const VecKernels* avx2_vec_kernels();   // vec_avx2.cpp; null when not built
+
+namespace {
+
+const VecKernels kScalar = vec_kernels_for<Scalar>("scalar");
+
+#if RIVET_VEC_X86
+struct Sse2 {
+  using V = __m128d;
+  static constexpr size_t width = 2;
+  static V load(const Value* p) { return _mm_loadu_pd(reinterpret_cast<const double*>(p)); }
+  static void store(Value* p, V x) { _mm_storeu_pd(reinterpret_cast<double*>(p), x); }
+  static void store_d(double* p, V x) { _mm_storeu_pd(p, x); }
+  static V splat(double d) { return _mm_set1_pd(d); }
+  static V add(V a, V b) { return _mm_add_pd(a, b); }
+  static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+  static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+  static V div(V a, V b) { return _mm_div_pd(a, b); }
+  static V min(V a, V b) { return _mm_min_pd(a, b); }
+  static V max(V a, V b) { return _mm_max_pd(a, b); }
+  static V lt(V a, V b) { return _mm_cmplt_pd(a, b); }
+  static V le(V a, V b) { return _mm_cmple_pd(a, b); }
+  static V gt(V a, V b) { return _mm_cmpgt_pd(a, b); }
+  static V ge(V a, V b) { return _mm_cmpge_pd(a, b); }
+  static V eq(V a, V b) { return _mm_cmpeq_pd(a, b); }
+  static V unord(V a, V b) { return _mm_cmpunord_pd(a, b); }
+  static V either(V a, V b) { return _mm_or_pd(a, b); }
+  static V select(V m, V a, V b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+  static unsigned mask(V m) { return static_cast<unsigned>(_mm_movemask_pd(m)); }
+  // SSE2 has no 64-bit compare: test the tag in each lane's high dword.
+  static bool boxed(V x) {
+    const __m128i tag = _mm_set_epi32(0x7FFC0000, 0, 0x7FFC0000, 0);
+    __m128i hit = _mm_cmpeq_epi32(_mm_and_si128(_mm_castpd_si128(x), tag), tag);
+    return (_mm_movemask_ps(_mm_castsi128_ps(hit)) & 0xA) != 0;
+  }
+};
+
+const VecKernels kSse2 = vec_kernels_for<Sse2>("sse2");
+#endif
+
+}
+
+const VecKernels* vec_kernels(ScanLevel level) {
+  switch (level) {
+    case ScanLevel::Scalar: return &kScalar;
+#if RIVET_VEC_X86
+    case ScanLevel::SSE2: return &kSse2;      // part of the x86-64 baseline
+    case ScanLevel::AVX2: return __builtin_cpu_supports("avx2") ? avx2_vec_kernels() : nullptr;
+#else
+    default: return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+const VecKernels& vec_kernels() {
+  static const VecKernels& best = []() -> const VecKernels& {
+    for (ScanLevel l : {ScanLevel::AVX2, ScanLevel::SSE2})
+      if (const VecKernels* k = vec_kernels(l)) return *k;
+    return kScalar;
+  }();
+  return best;
+}
+
+}
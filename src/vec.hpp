@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "rivet/value.hpp"
+#include "scan.hpp"
+
+namespace rivet {
+
+// Element-wise kernels over arrays of numbers. A number Value is its double
+// bit for bit, so they run straight over Array::items. Every level computes
+// the same results: NaNs come out canonical, and reductions always fold four
+// interleaved partial results as (p0 op p1) op (p2 op p3), then the tail.
+enum class VecOp : uint8_t { Add, Sub, Mul, Div, Lt, Le, Gt, Ge };
+
+struct VecKernels {
+  const char* name;
+  // out[i] = a[i] op b[i]: numbers for Add..Div, bools for Lt..Ge. An operand
+  // with stride 0 is a single number broadcast to every element.
+  void (*binary[8])(const Value* a, size_t sa, const Value* b, size_t sb, Value* out, size_t n);
+  bool   (*all_numbers)(const Value* a, size_t n);
+  bool   (*any_zero)(const Value* a, size_t n);
+  bool   (*equal)(const Value* a, const Value* b, size_t n);    // a[i] == b[i] for every i
+  double (*sum)(const Value* a, size_t n);
+  double (*min)(const Value* a, size_t n);                       // NaN if any element is NaN,
+  double (*max)(const Value* a, size_t n);                       //   +-inf when n == 0
+};
+
+// The widest kernels this CPU supports, chosen on first use.
+const VecKernels& vec_kernels();
+// Kernels for a specific level, or nullptr when the CPU or build lacks it.
+const VecKernels* vec_kernels(ScanLevel level);
+
+}
@@ -0,0 +1,52 @@
+// Built with -mavx2 (see CMakeLists.txt); only called after a CPUID check.
+#include "vec.hpp"
+#include "vec_simd.hpp"
+
+#if defined(__AVX2__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+namespace rivet {
+
+#if defined(__AVX2__) && defined(__GNUC__)
+namespace {
+
+struct Avx2 {
+  using V = __m256d;
+  static constexpr size_t width = 4;
+  static V load(const Value* p) { return _mm256_loadu_pd(reinterpret_cast<const double*>(p)); }
+  static void store(Value* p, V x) { _mm256_storeu_pd(reinterpret_cast<double*>(p), x); }
+  static void store_d(double* p, V x) { _mm256_storeu_pd(p, x); }
+  static V splat(double d) { return _mm256_set1_pd(d); }
+  static V add(V a, V b) { return _mm256_add_pd(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+  static V div(V a, V b) { return _mm256_div_pd(a, b); }
+  static V min(V a, V b) { return _mm256_min_pd(a, b); }
+  static V max(V a, V b) { return _mm256_max_pd(a, b); }
+  static V lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static V le(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+  static V gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static V ge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+  static V eq(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static V unord(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+  static V either(V a, V b) { return _mm256_or_pd(a, b); }
+  static V select(V m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+  static unsigned mask(V m) { return static_cast<unsigned>(_mm256_movemask_pd(m)); }
+  static bool boxed(V x) {
+    const __m256i tag = _mm256_set1_epi64x(0x7FFC'0000'0000'0000ll);
+    __m256i hit = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_castpd_si256(x), tag), tag);
+    return _mm256_movemask_pd(_mm256_castsi256_pd(hit)) != 0;
+  }
+};
+
+const VecKernels kAvx2 = vec_kernels_for<Avx2>("avx2");
+
+}
+
+const VecKernels* avx2_vec_kernels() { return &kAvx2; }
+#else
+const VecKernels* avx2_vec_kernels() { return nullptr; }
+#endif
+
+}
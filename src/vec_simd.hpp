@@ -0,0 +1,162 @@
+#pragma once
+// Shared by vec.cpp (scalar, SSE2) and vec_avx2.cpp, which is built with
+// -mavx2. Everything here has internal linkage so the two translation units
+// never share a function compiled for the wider ISA.
+#include <cstring>
+#include <limits>
+#include "vec.hpp"
+
+namespace rivet {
+namespace {
+
+// S wraps one ISA: `width` doubles per V, with masks as all-ones/zero lanes.
+// Scalar is the one-lane case, and also finishes every vector loop's tail.
+struct Scalar {
+  using V = double;
+  static constexpr size_t width = 1;
+  static uint64_t bits(V x) { uint64_t b; std::memcpy(&b, &x, sizeof b); return b; }
+  static V from_bits(uint64_t b) { V x; std::memcpy(&x, &b, sizeof x); return x; }
+  static V mask_of(bool c) { return from_bits(c ? ~0ull : 0); }
+
+  static V load(const Value* p) { return from_bits(p->raw()); }
+  static void store(Value* p, V x) { std::memcpy(static_cast<void*>(p), &x, sizeof x); }
+  static void store_d(double* p, V x) { *p = x; }
+  static V splat(double d) { return d; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V min(V a, V b) { return a < b ? a : b; }       // minpd/maxpd: the second
+  static V max(V a, V b) { return a > b ? a : b; }       //   operand unless strictly better
+  static V lt(V a, V b) { return mask_of(a < b); }
+  static V le(V a, V b) { return mask_of(a <= b); }
+  static V gt(V a, V b) { return mask_of(a > b); }
+  static V ge(V a, V b) { return mask_of(a >= b); }
+  static V eq(V a, V b) { return mask_of(a == b); }
+  static V unord(V a, V b) { return mask_of(a != a || b != b); }
+  static V either(V a, V b) { return from_bits(bits(a) | bits(b)); }
+  static V select(V m, V a, V b) { return from_bits((bits(m) & bits(a)) | (~bits(m) & bits(b))); }
+  static unsigned mask(V m) { return bits(m) ? 1u : 0u; }
+  static bool boxed(V x) { return (bits(x) & kBoxMask) == kBoxMask; }
+  static constexpr uint64_t kBoxMask = 0x7FFC'0000'0000'0000ull;
+};
+
+constexpr uint64_t kNaNBits = 0x7FF8'0000'0000'0000ull;
+
+template<class S, VecOp op> typename S::V apply(typename S::V x, typename S::V y) {
+  using V = typename S::V;
+  V r;
+  switch (op) {
+    case VecOp::Add: r = S::add(x, y); break;
+    case VecOp::Sub: r = S::sub(x, y); break;
+    case VecOp::Mul: r = S::mul(x, y); break;
+    case VecOp::Div: r = S::div(x, y); break;
+    case VecOp::Lt:  r = S::lt(x, y); break;
+    case VecOp::Le:  r = S::le(x, y); break;
+    case VecOp::Gt:  r = S::gt(x, y); break;
+    case VecOp::Ge:  r = S::ge(x, y); break;
+  }
+  if constexpr (op <= VecOp::Div) {
+    return S::select(S::unord(r, r), S::splat(Scalar::from_bits(kNaNBits)), r);
+  } else {
+    // Boxed bools differ in the low bit only.
+    return S::select(r, S::splat(Scalar::from_bits(Value::bool_bits(true))),
+                        S::splat(Scalar::from_bits(Value::bool_bits(false))));
+  }
+}
+
+template<class S, VecOp op>
+void binary(const Value* a, size_t sa, const Value* b, size_t sb, Value* out, size_t n) {
+  size_t i = 0;
+  if constexpr (S::width > 1) {
+    if (sa && sb) {
+      for (; i + S::width <= n; i += S::width) S::store(out + i, apply<S, op>(S::load(a + i), S::load(b + i)));
+    } else if (sa) {
+      auto y = S::splat(as_number(*b));
+      for (; i + S::width <= n; i += S::width) S::store(out + i, apply<S, op>(S::load(a + i), y));
+    } else {
+      auto x = S::splat(as_number(*a));
+      for (; i + S::width <= n; i += S::width) S::store(out + i, apply<S, op>(x, S::load(b + i)));
+    }
+  }
+  for (; i < n; ++i) Scalar::store(out + i, apply<Scalar, op>(Scalar::load(a + i * sa), Scalar::load(b + i * sb)));
+}
+
+template<class S> bool all_numbers(const Value* a, size_t n) {
+  size_t i = 0;
+  if constexpr (S::width > 1)
+    for (; i + S::width <= n; i += S::width) if (S::boxed(S::load(a + i))) return false;
+  for (; i < n; ++i) if (Scalar::boxed(Scalar::load(a + i))) return false;
+  return true;
+}
+
+template<class S> bool any_zero(const Value* a, size_t n) {
+  size_t i = 0;
+  if constexpr (S::width > 1)
+    for (; i + S::width <= n; i += S::width) if (S::mask(S::eq(S::load(a + i), S::splat(0.0)))) return true;
+  for (; i < n; ++i) if (as_number(a[i]) == 0.0) return true;
+  return false;
+}
+
+template<class S> bool equal(const Value* a, const Value* b, size_t n) {
+  constexpr unsigned full = (1u << S::width) - 1;
+  size_t i = 0;
+  if constexpr (S::width > 1)
+    for (; i + S::width <= n; i += S::width) if (S::mask(S::eq(S::load(a + i), S::load(b + i))) != full) return false;
+  for (; i < n; ++i) if (as_number(a[i]) != as_number(b[i])) return false;
+  return true;
+}
+
+// Reductions keep four partial results, element i going to p[i % 4]; a
+// vector level holds them in 4 / width registers.
+template<class S> double sum(const Value* a, size_t n) {
+  constexpr size_t R = 4 / S::width;
+  typename S::V acc[R];
+  for (size_t r = 0; r < R; ++r) acc[r] = S::splat(0.0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    for (size_t r = 0; r < R; ++r) acc[r] = S::add(acc[r], S::load(a + i + r * S::width));
+  double p[4];
+  for (size_t r = 0; r < R; ++r) S::store_d(p + r * S::width, acc[r]);
+  double s = (p[0] + p[1]) + (p[2] + p[3]);
+  for (; i < n; ++i) s += as_number(a[i]);
+  return s;
+}
+
+template<class S, bool Min> double extreme(const Value* a, size_t n) {
+  using V = typename S::V;
+  constexpr size_t R = 4 / S::width;
+  constexpr double inf = std::numeric_limits<double>::infinity();
+  V acc[R], nan[R];
+  for (size_t r = 0; r < R; ++r) { acc[r] = S::splat(Min ? inf : -inf); nan[r] = S::splat(0.0); }
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (size_t r = 0; r < R; ++r) {
+      V x = S::load(a + i + r * S::width);
+      acc[r] = Min ? S::min(acc[r], x) : S::max(acc[r], x);
+      nan[r] = S::either(nan[r], S::unord(x, x));
+    }
+  }
+
+  auto pick = [](double x, double y) { return Min ? Scalar::min(x, y) : Scalar::max(x, y); };
+  double p[4], q[4];
+  for (size_t r = 0; r < R; ++r) { S::store_d(p + r * S::width, acc[r]); S::store_d(q + r * S::width, nan[r]); }
+  bool saw_nan = Scalar::mask(q[0]) | Scalar::mask(q[1]) | Scalar::mask(q[2]) | Scalar::mask(q[3]);
+  double m = pick(pick(p[0], p[1]), pick(p[2], p[3]));
+  for (; i < n; ++i) {
+    double x = as_number(a[i]);
+    saw_nan = saw_nan || x != x;
+    m = pick(m, x);
+  }
+  return saw_nan ? std::numeric_limits<double>::quiet_NaN() : m;
+}
+
+template<class S> VecKernels vec_kernels_for(const char* name) {
+  return VecKernels{name,
+    {binary<S, VecOp::Add>, binary<S, VecOp::Sub>, binary<S, VecOp::Mul>, binary<S, VecOp::Div>,
+     binary<S, VecOp::Lt>,  binary<S, VecOp::Le>,  binary<S, VecOp::Gt>,  binary<S, VecOp::Ge>},
+    all_numbers<S>, any_zero<S>, equal<S>, sum<S>, extreme<S, true>, extreme<S, false>};
+}
+
+}
+}
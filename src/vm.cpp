@@ -0,0 +1,412 @@
+#include "vm.hpp"
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "pool.hpp"
+
+// GCC and Clang get a direct-threaded dispatch loop through computed gotos;
+// other compilers fall back to a switch inside a loop. Leaving a scope through
+// a computed goto skips its destructors, so an instruction keeps any local
+// that owns something in a block that closes before DISPATCH().
+#if defined(__GNUC__) || defined(__clang__)
+#define RIVET_THREADED_DISPATCH 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define RIVET_THREADED_DISPATCH 0
+#endif
+
+namespace rivet {
+
+namespace {
+
+struct Frame {
+  const uint8_t* ret;       // resume point in the caller
+  size_t iter_base;         // for-in iterators owned by the caller
+  const FnProto* memo;      // caches its result under the arguments copied
+  size_t memo_base;         //   to memo_args[memo_base..], when non-null
+};
+
+struct PendingCall {
+  const FnProto* fn;
+  size_t base;              // Env slot index of the reserved callee frame
+};
+
+struct Iter {
+  Value  src;               // array or string being iterated
+  size_t i {0};
+};
+
+// The dispatch loop's state besides the Env. Each parallel for worker runs
+// the loop body on a Machine of its own.
+struct Machine {
+  std::vector<Value> stack;
+  std::vector<Frame> frames;
+  std::vector<PendingCall> pending;
+  std::vector<Iter> iters;
+  std::vector<Value> memo_args;
+  std::vector<const FnProto*> fns;  // indexed by Symbol
+
+  explicit Machine(std::vector<const FnProto*> defined) : fns(std::move(defined)) { stack.reserve(256); }
+};
+
+std::optional<Value> execute(const Module& m, const uint8_t* ip, Env& env, Machine& vm);
+
+// Natives call back into the VM through this. A function is run by a nested
+// dispatch loop on the same Machine, its Return going to the module's Exit.
+class VmCaller final : public Caller {
+public:
+  VmCaller(const Module& m_, Machine& vm_, Env& e) : m(m_), vm(vm_), env(e) {}
+
+  Value call(const Value& fn, Value* args, uint32_t argc) override {
+    if (!is_string(fn)) throw std::runtime_error("type error: expected a function name");
+    // Natives call the same function over and over: look its name up once.
+    if (as_string(fn) != name) {
+      name = as_string(fn);
+      sym = find_symbol(name);
+      proto = sym < vm.fns.size() ? vm.fns[sym] : nullptr;
+      nat = sym != kNoSymbol && !proto ? find_native(sym) : kNoNative;
+    }
+    if (!proto && nat == kNoNative) throw std::runtime_error("runtime error: undefined function '" + std::string(as_string(fn)) + "'");
+    size_t arity = proto ? proto->params.size() : native(nat).arity;
+    if (argc != arity) throw std::runtime_error("runtime error: function '" + symbol_name(sym) + "' arity mismatch");
+    if (!proto) {
+      Value argv[kMaxNativeArity];
+      for (uint32_t i = 0; i < argc; ++i) argv[i] = args[i];
+      return native(nat).call(argv, *this);
+    }
+    if (proto->memo)
+      if (const Value* hit = env.memo.find(proto->decl, args, argc)) return *hit;
+    size_t base = env.open_frame(proto->frame_size);
+    for (uint32_t i = 0; i < argc; ++i) env.cell(base + i) = VarCell{args[i], proto->params[i], true};
+    env.enter_frame(base, proto->frame_size);
+    vm.frames.push_back(Frame{m.code.data() + m.exit, vm.iters.size(), proto->memo ? proto : nullptr, vm.memo_args.size()});
+    if (proto->memo) vm.memo_args.insert(vm.memo_args.end(), args, args + argc);
+    return *execute(m, m.code.data() + proto->entry, env, vm);
+  }
+
+  // Workers start from the functions defined so far, and start over after
+  // an error leaves their Machine mid-call.
+  void parallel(size_t tasks, const std::function<void(Caller&, size_t)>& body) override {
+    std::vector<std::unique_ptr<Machine>> workers(ThreadPool::instance().size());
+    run_parallel(env, tasks, [&](Env& e, size_t w, size_t t) {
+      if (!workers[w]) workers[w] = std::make_unique<Machine>(vm.fns);
+      try { VmCaller c(m, *workers[w], e); body(c, t); }
+      catch (...) { workers[w].reset(); throw; }
+    });
+  }
+
+private:
+  const Module& m;
+  Machine& vm;
+  Env& env;
+  std::string name;
+  Symbol sym {kNoSymbol};
+  const FnProto* proto {};
+  uint32_t nat {kNoNative};
+};
+
+}
+
+std::optional<Value> run_module(const Module& m, Env& env) {
+  Machine vm(std::vector<const FnProto*>(symbol_count(), nullptr));
+  return execute(m, m.code.data() + m.entry, env, vm);
+}
+
+namespace {
+
+// Runs from `ip` until Halt, EndBody for a parallel for body, or Exit for
+// a function a native called.
+std::optional<Value> execute(const Module& m, const uint8_t* ip, Env& env, Machine& vm) {
+  const uint8_t* const code = m.code.data();
+  const Value* const k = m.constants.data();
+
+  auto& stack = vm.stack;
+  auto& frames = vm.frames;
+  auto& pending = vm.pending;
+  auto& iters = vm.iters;
+  auto& memo_args = vm.memo_args;
+  auto& fns = vm.fns;
+  std::optional<Value> last;
+
+  auto pop = [&]() { Value v = std::move(stack.back()); stack.pop_back(); return v; };
+  auto name = [](Symbol s) -> const std::string& { return symbol_name(s); };
+  auto assign = [&](VarCell* c, uint32_t n) {
+    if (!c) throw std::runtime_error("runtime error: assignment to undefined variable '" + name(n) + "'");
+    if (!c->mut) throw std::runtime_error(immutable_error(*c, "assign to"));
+    c->val = pop();
+  };
+
+#if RIVET_THREADED_DISPATCH
+  static const void* const dispatch_table[] = {
+#define RIVET_OP_LABEL(op) &&op_##op,
+    RIVET_OPCODES(RIVET_OP_LABEL)
+#undef RIVET_OP_LABEL
+  };
+#define DISPATCH() goto *dispatch_table[*ip++]
+#define TARGET(op) op_##op
+#else
+#define DISPATCH() goto dispatch
+#define TARGET(op) case Op::op
+#endif
+
+#define BINARY(op, fast)                                                  \
+  {                                                                       \
+    Value r = pop(); Value& l = stack.back();                             \
+    if (is_number(l) && is_number(r)) { double a = as_number(l), b = as_number(r); l = (fast); } \
+    else l = binary_op(BinaryOp::op, l, r);                               \
+  }                                                                       \
+  DISPATCH();
+
+#if RIVET_THREADED_DISPATCH
+  DISPATCH();
+#else
+dispatch:
+  switch (static_cast<Op>(*ip++)) {
+#endif
+
+  TARGET(Const):     stack.push_back(k[read_u32(ip)]); ip += 4; DISPATCH();
+  TARGET(True):      stack.emplace_back(true); DISPATCH();
+  TARGET(False):     stack.emplace_back(false); DISPATCH();
+  TARGET(Pop):       stack.pop_back(); DISPATCH();
+
+  TARGET(MakeArray): {
+    size_t n = read_u32(ip); ip += 4;
+    std::vector<Value> items(std::make_move_iterator(stack.end() - static_cast<std::ptrdiff_t>(n)),
+                             std::make_move_iterator(stack.end()));
+    stack.resize(stack.size() - n);
+    stack.push_back(Value::array(std::move(items)));
+    DISPATCH();
+  }
+
+  TARGET(Negate): {
+    Value& v = stack.back();
+    if (is_number(v)) v = -as_number(v); else v = unary_op(UnaryOp::Negate, v);
+    DISPATCH();
+  }
+  TARGET(Not):    { Value& v = stack.back(); v = !truthy(v); DISPATCH(); }
+
+  TARGET(Add): BINARY(Add, a + b)
+  TARGET(Sub): BINARY(Sub, a - b)
+  TARGET(Mul): BINARY(Mul, a * b)
+  TARGET(Div): {
+    {
+      Value r = pop(); Value& l = stack.back();
+      if (is_number(l) && is_number(r) && as_number(r) != 0.0) l = as_number(l) / as_number(r);
+      else l = binary_op(BinaryOp::Div, l, r);
+    }
+    DISPATCH();
+  }
+  TARGET(Eq):  BINARY(Eq, a == b)
+  TARGET(Ne):  BINARY(Ne, a != b)
+  TARGET(Lt):  BINARY(Lt, a <  b)
+  TARGET(Le):  BINARY(Le, a <= b)
+  TARGET(Gt):  BINARY(Gt, a >  b)
+  TARGET(Ge):  BINARY(Ge, a >= b)
+
+  TARGET(Truthy): { Value& v = stack.back(); if (!is_bool(v)) v = truthy(v); DISPATCH(); }
+
+  TARGET(Jump): { int32_t off = read_i32(ip); ip += 4 + off; DISPATCH(); }
+  TARGET(JumpIfFalse): {
+    int32_t off = read_i32(ip); ip += 4;
+    if (!truthy(stack.back())) ip += off;
+    stack.pop_back();
+    DISPATCH();
+  }
+
+  TARGET(GetLocal): stack.push_back(env.local(read_u32(ip)).val); ip += 4; DISPATCH();
+  TARGET(GetGlobal): {
+    VarCell& c = env.global(read_u32(ip));
+    if (c.name == kNoSymbol) throw std::runtime_error("runtime error: undefined variable '" + name(read_u32(ip + 4)) + "'");
+    stack.push_back(c.val); ip += 8;
+    DISPATCH();
+  }
+  TARGET(GetDynamic): {
+    Symbol n = read_u32(ip); ip += 4;
+    const VarCell* c = env.find(n);
+    if (!c) throw std::runtime_error("runtime error: undefined variable '" + name(n) + "'");
+    stack.push_back(c->val);
+    DISPATCH();
+  }
+  TARGET(SetLocal):   assign(&env.local(read_u32(ip)), read_u32(ip + 4)); ip += 8; DISPATCH();
+  TARGET(SetGlobal): {
+    VarCell& c = env.global(read_u32(ip));
+    assign(c.name != kNoSymbol ? &c : nullptr, read_u32(ip + 4)); ip += 8;
+    DISPATCH();
+  }
+  TARGET(SetDynamic): { uint32_t n = read_u32(ip); ip += 4; assign(env.find(n), n); DISPATCH(); }
+  TARGET(DefLet): { env.define(read_u32(ip), read_u32(ip + 4), pop(), false); ip += 8; DISPATCH(); }
+  TARGET(DefVar): { env.define(read_u32(ip), read_u32(ip + 4), pop(), true);  ip += 8; DISPATCH(); }
+  TARGET(ClearSlots): env.clear(read_u32(ip), read_u32(ip + 4)); ip += 8; DISPATCH();
+
+  TARGET(Print):     *env.out << to_string_value(stack.back()) << "\n"; stack.pop_back(); DISPATCH();
+  TARGET(SetLast):   last = pop(); DISPATCH();
+  TARGET(ClearLast): last.reset(); DISPATCH();
+
+  TARGET(DefineFn): {
+    const FnProto& fn = m.fns[read_u32(ip)]; ip += 4;
+    fns[fn.name] = &fn;
+    DISPATCH();
+  }
+  TARGET(CallBegin): {
+    uint32_t n = read_u32(ip), argc = read_u32(ip + 4); ip += 8;
+    const FnProto* fn = fns[n];
+    if (!fn) throw std::runtime_error("runtime error: undefined function '" + name(n) + "'");
+    if (argc != fn->params.size())
+      throw std::runtime_error("runtime error: function '" + name(n) + "' arity mismatch");
+    pending.push_back(PendingCall{fn, env.open_frame(fn->frame_size)});
+    DISPATCH();
+  }
+  TARGET(SetParam): {
+    uint32_t i = read_u32(ip); ip += 4;
+    const PendingCall& call = pending.back();
+    env.cell(call.base + i) = VarCell{pop(), call.fn->params[i], true};
+    DISPATCH();
+  }
+  TARGET(CallEnd): {
+    const PendingCall call = pending.back();
+    pending.pop_back();
+    size_t mb = memo_args.size();
+    if (call.fn->memo) {
+      for (size_t i = 0; i < call.fn->params.size(); ++i) memo_args.push_back(env.cell(call.base + i).val);
+      if (const Value* hit = env.memo.find(call.fn->decl, memo_args.data() + mb, memo_args.size() - mb)) {
+        memo_args.resize(mb);
+        env.drop_frame(call.base);
+        stack.push_back(*hit);
+        DISPATCH();
+      }
+    }
+    env.enter_frame(call.base, call.fn->frame_size);
+    frames.push_back(Frame{ip, iters.size(), call.fn->memo ? call.fn : nullptr, mb});
+    ip = code + call.fn->entry;
+    DISPATCH();
+  }
+  TARGET(TailCall): {
+    const PendingCall call = pending.back();
+    pending.pop_back();
+    env.replace_frame(call.base, static_cast<uint32_t>(call.fn->params.size()), call.fn->frame_size);
+    iters.resize(frames.back().iter_base);
+    ip = code + call.fn->entry;
+    DISPATCH();
+  }
+  TARGET(Return): {
+    if (frames.empty()) return pop();
+    const Frame& f = frames.back();
+    if (f.memo) {
+      std::vector<Value> args(memo_args.begin() + static_cast<std::ptrdiff_t>(f.memo_base), memo_args.end());
+      memo_args.resize(f.memo_base);
+      env.memo.insert(f.memo->decl, std::move(args), stack.back());
+    }
+    env.leave_frame();
+    iters.resize(f.iter_base);
+    ip = f.ret;
+    frames.pop_back();
+    DISPATCH();
+  }
+
+  // The arguments are moved off the stack first: a native calling back into
+  // the program pushes onto it.
+  TARGET(Native): {
+    const Native& fn = native(read_u32(ip));
+    uint32_t argc = read_u32(ip + 4); ip += 8;
+    if (argc != fn.arity) throw std::runtime_error("runtime error: function '" + name(fn.name) + "' arity mismatch");
+    {
+      Value argv[kMaxNativeArity];
+      size_t base = stack.size() - argc;
+      std::move(stack.begin() + static_cast<std::ptrdiff_t>(base), stack.end(), argv);
+      stack.resize(base);
+      VmCaller caller(m, vm, env);
+      stack.push_back(fn.call(argv, caller));
+    }
+    DISPATCH();
+  }
+  TARGET(NativeVar): {
+    const Native& fn = native(read_u32(ip));
+    uint32_t argc = read_u32(ip + 4);
+    VarRef ref{static_cast<RefKind>(read_u32(ip + 8)), read_u32(ip + 12)};
+    Symbol n = read_u32(ip + 16); ip += 20;
+    if (argc != fn.arity) throw std::runtime_error("runtime error: function '" + name(fn.name) + "' arity mismatch");
+    VarCell* c = env.lookup(n, ref);
+    if (!c) throw std::runtime_error("runtime error: undefined variable '" + name(n) + "'");
+    if (!c->mut) throw std::runtime_error(immutable_error(*c, "modify"));
+    {
+      Value argv[kMaxNativeArity];
+      size_t base = stack.size() - (argc - 1);
+      std::move(stack.begin() + static_cast<std::ptrdiff_t>(base), stack.end(), argv + 1);
+      stack.resize(base);
+      argv[0] = std::move(c->val);
+      VmCaller caller(m, vm, env);
+      Value r;
+      try { r = fn.call(argv, caller); }
+      catch (...) { c->val = std::move(argv[0]); throw; }
+      c->val = std::move(argv[0]);
+      stack.push_back(std::move(r));
+    }
+    DISPATCH();
+  }
+
+  TARGET(IterInit): {
+    Value v = pop();
+    if (!is_array(v) && !is_string(v)) throw std::runtime_error("type error: for-in expects array or string");
+    iters.push_back(Iter{std::move(v), 0});
+    DISPATCH();
+  }
+  TARGET(IterNext): {
+    uint32_t slot = read_u32(ip), n = read_u32(ip + 4); int32_t off = read_i32(ip + 8); ip += 12;
+    Iter& it = iters.back();
+    if (is_array(it.src)) {
+      const auto& items = as_array(it.src)->items;
+      if (it.i < items.size()) { env.define(slot, n, items[it.i++], true); DISPATCH(); }
+    } else {
+      std::string_view s = as_string(it.src);
+      if (it.i < s.size()) { env.define(slot, n, Value::character(static_cast<unsigned char>(s[it.i++])), true); DISPATCH(); }
+    }
+    iters.pop_back();
+    ip += off;
+    DISPATCH();
+  }
+
+  TARGET(ParallelFor): {
+    const ForIn& loop = std::get<ForIn>(env.program()[static_cast<StmtId>(read_u32(ip))].node);
+    int32_t off = read_i32(ip + 4); ip += 8;
+    const uint8_t* body = ip;
+    {
+      Value iter = pop();
+      // Workers start from the functions defined so far, and start over
+      // after an error leaves their Machine mid-call.
+      std::vector<std::unique_ptr<Machine>> workers(ThreadPool::instance().size());
+      LoopBody run_body = [&](Env& e, size_t w) {
+        if (!workers[w]) workers[w] = std::make_unique<Machine>(fns);
+        Machine& mw = *workers[w];
+        try { execute(m, body, e, mw); }
+        catch (...) { workers[w].reset(); throw; }
+      };
+      parallel_for_in(loop, iter, env, &run_body);
+    }
+    ip += off;
+    DISPATCH();
+  }
+
+  TARGET(EndBody): return last;
+  TARGET(Halt): return last;
+  TARGET(Exit): return pop();
+
+#if !RIVET_THREADED_DISPATCH
+  }
+  throw std::runtime_error("vm: bad opcode");
+#endif
+
+#undef BINARY
+#undef TARGET
+#undef DISPATCH
+}
+
+}
+
+}
+
+#if RIVET_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#include <optional>
+#include "bytecode.hpp"
+#include "eval.hpp"
+
+namespace rivet {
+
+// Executes a compiled module. Variables live in `env` exactly as they do for
+// the tree walker; the result mirrors exec_program (the value of a top-level
+// `return`, or of the last top-level expression statement).
+std::optional<Value> run_module(const Module& m, Env& env);
+
+}